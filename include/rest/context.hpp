@@ -5,6 +5,7 @@
 #include "responder.hpp"
 #include "keywords.hpp"
 #include <string>
+#include <cstddef>
 #include <boost/noncopyable.hpp>
 #include <boost/scoped_ptr.hpp>
 
@@ -17,13 +18,22 @@ public:
   context();
   ~context();
 
-  void declare_keyword(std::string const &name, keyword_type type);
+  // the keywords the responders bound here get, also at the returned slot
+  keyword_slot declare_keyword(std::string const &name, keyword_type type);
   keyword_type get_keyword_type(std::string const &name) const;
   void enum_keywords(
     keyword_type,
     boost::function<void (std::string const &)> const &) const;
   void prepare_keywords(keywords &) const;
 
+  // Paths are segments separated by '/' or '=': literals, closures like
+  // {name} matching any segment and setting the keyword `name' to it, and
+  // "..." at the end for whatever follows. Typed closures match only some
+  // segments, others are not found: {id:int64} and {id:uint64} numbers in
+  // range, also available as keywords::get_value<boost::int64_t> or
+  // <boost::uint64_t>, {slug:[a-z0-9-]+} segments of the listed characters
+  // ('*' for empty ones too, '^' first to list those not allowed). A
+  // closure's type must be the same in all paths bound through it.
   template<class T>
   void bind(std::string const &a, T &r) {
     do_bind(a, r.get_interface(), detail::any_path());
@@ -42,9 +52,34 @@ public:
     context *&,
     keywords &);
 
+  // flattens the bindings, those of nested contexts included, so that
+  // find_responder matches a path in one pass without allocating; done by
+  // attach(), and again by the first find_responder after any further bind()
+  void compile();
+
+  // The results of find_responder of this process are kept by context and
+  // path (query string included), up to `entries' of them (0, the default,
+  // disables that); emptied by any bind() or declare_keyword().
+  static void set_route_cache_size(std::size_t entries);
+
+  struct route_cache_statistics {
+    unsigned long hits;
+    unsigned long misses;
+    std::size_t size;
+  };
+
+  static route_cache_statistics route_cache_stats();
+
   void attach(server &);
 
 private:
+  void resolve(
+    std::string const &,
+    detail::any_path &,
+    detail::responder_base *&,
+    context *&,
+    keywords &);
+
   void do_bind(
     std::string const &, detail::responder_base &, detail::any_path const &);
 
@@ -13,6 +13,25 @@
 
 namespace rest {
 
+// Parameters for the compressing encodings, -1 means unset. Unset values are
+// taken from the host, then from /general/compression, then the library
+// defaults are used.
+struct compression {
+  compression()
+    : level(-1), window_bits(-1), mem_level(-1), flush_size(-1) {}
+
+  int level;       // 0 (fastest) to 9 (best ratio)
+  int window_bits; // 8 to 15 (deflate only)
+  int mem_level;   // 1 to 9 (deflate only)
+  int flush_size;  // 0: only at the end, else every (at least) n input bytes
+
+  // takes the unset values from `defaults'
+  void merge(compression const &defaults);
+
+  // the values from /general/compression
+  static compression const &configured();
+};
+
 class encoding : public object {
 public:
   static std::string const &type_name();
@@ -33,6 +52,11 @@ public:
 
   virtual void add_reader(input_chain &) = 0;
   virtual void add_writer(output_chain &) = 0;
+
+  // compressing encodings override this, the others ignore the parameters
+  virtual void add_writer(output_chain &x, compression const &) {
+    add_writer(x);
+  }
 };
 
 struct compare_encoding {
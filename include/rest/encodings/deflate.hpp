@@ -15,6 +15,7 @@ public:
 
   void add_reader(input_chain &);
   void add_writer(output_chain &);
+  void add_writer(output_chain &, compression const &);
 };
 
 }}
@@ -11,6 +11,8 @@
 
 namespace rest {
 
+namespace utils { namespace http { class request_parser; } }
+
 class headers {
 public:
   headers();
@@ -46,6 +48,10 @@ public:
   std::string get_header(
       std::string const &name, std::string const &default_) const;
 
+  // get_header into `value' (keeping its capacity, for reading a header
+  // of every request without allocating); false if missing
+  bool find_header(std::string const &name, std::string &value) const;
+
   void erase_header(std::string const &name);
 
   typedef
@@ -55,6 +61,11 @@ public:
   void for_each_header(header_callback const &) const;
 
   void read_headers(std::streambuf &in);
+
+  // takes the fields `parser' found in the request head at `data'; they are
+  // looked up and enumerated in place, and only converted if the headers get
+  // modified
+  void read_headers(char const *data, utils::http::request_parser const &parser);
   void write_headers(std::streambuf &out) const;
 
 private:
@@ -12,6 +12,7 @@ namespace rest {
 class context;
 class response;
 class server;
+struct compression;
 
 class host : boost::noncopyable {
 public:
@@ -41,6 +42,9 @@ public:
   void prepare_response(response &) const;
   void set_response_preparer(boost::function<void (response &)> const &);
 
+  // defaults for the compression parameters of the responses
+  void set_compression(compression const &);
+
 private:
   template<class T>
   static void delete_helper(void *p) { delete static_cast<T *>(p); }
@@ -63,7 +67,12 @@ public:
   host_container();
   ~host_container();
 
+  // Host names are matched without regard to case. "example.com" serves
+  // that name and those below it, "*.example.com" only those below it and
+  // takes precedence there, "" serves any other name.
   void add_host(host &);
+
+  // the host for a Host header (port and a trailing dot ignored), 0 if none
   host const *get_host(std::string const &name) const;
 
   void attach(server &);
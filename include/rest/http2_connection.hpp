@@ -0,0 +1,53 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#ifndef REST_HTTP2_CONNECTION_HPP
+#define REST_HTTP2_CONNECTION_HPP
+
+#include "network.hpp"
+#include <string>
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace rest {
+
+class host_container;
+class logger;
+
+namespace utils { class input_buffer; class socket_device; }
+
+// An HTTP/2 connection (RFC 7540), as started by clients knowing the server
+// speaks it: negotiated with ALPN or with prior knowledge on plain sockets.
+// The requests of the streams are served through http_connection::serve().
+// Response entities are sent from where the responses hold them (strings,
+// files, else as they are written) as the flow control windows allow.
+// Serving blocks until the connection closes, so only the blocking engines
+// serve HTTP/2.
+class http2_connection : boost::noncopyable {
+public:
+  http2_connection(host_container const &hosts,
+                   rest::network::address const &addr,
+                   std::string const &servername,
+                   logger *log);
+
+  ~http2_connection();
+
+  // whether the input starts with the client connection preface, reading no
+  // further than needed to tell
+  static bool preface(utils::input_buffer &conn);
+
+  // serves the connection from the preface on until either side closes it;
+  // `socket', the plain socket below `conn' if any, is used for sendfile
+  void serve(utils::input_buffer &conn, utils::socket_device *socket = 0);
+
+private:
+  class impl;
+  boost::scoped_ptr<impl> p;
+};
+
+}
+
+#endif
+// Local Variables: **
+// mode: C++ **
+// coding: utf-8 **
+// c-electric-flag: nil **
+// End: **
@@ -15,6 +15,7 @@ namespace rest {
 class keywords;
 class host_container;
 class logger;
+class scheme;
 
 class http_connection {
 public:
@@ -27,6 +28,38 @@ public:
 
   void serve(std::auto_ptr<std::streambuf> conn);
 
+  // Serving event-driven connections, whose socket `connfd' does not block:
+  // open() takes the stream from schm.open(), advance() goes on whenever
+  // the socket is ready. It reads what the socket has, serves the requests
+  // whose head and entity arrived completely and writes the responses as far
+  // as the socket takes them; the rest waits for the next call. It returns
+  // what the connection waits for.
+  enum event_state { WANT_READ, WANT_WRITE, CLOSED };
+  void open(std::auto_ptr<std::streambuf> conn, scheme &schm, int connfd);
+  event_state advance();
+  // whether the client began a request (or the connection is not set up
+  // yet), as opposed to being idle between requests
+  bool request_started() const;
+
+  // Serves a request which did not come as HTTP/1.x text on this connection
+  // (an HTTP/2 stream): `h' are its header fields, Host included, `entity'
+  // its complete entity. The response comes back with its headers final;
+  // `enc' is set to the encoding of the entity to send, 0 if there is none.
+  response serve(std::string const &method,
+                 std::string const &uri,
+                 headers const &h,
+                 std::string const &entity,
+                 encoding *&enc);
+
+  // writes the entity of the response serve() returned last, cut to the
+  // ranges the request asked for if it is a 206 response
+  void print_entity(response const &r, encoding *enc, std::streambuf &out);
+
+  // Public responses of this process are kept for their lifetime up to a
+  // memory budget of `bytes' (0, the default, disables that and empties the
+  // cache). Set by the server from /general/response_cache/size.
+  static void set_response_cache_size(std::size_t bytes);
+
 private:
   class impl;
   boost::scoped_ptr<impl> p;
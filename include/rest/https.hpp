@@ -22,6 +22,13 @@ private:
     logger*,int,socket_param const&,network::address const&,std::string const&);
   boost::any create_context(
     logger *log, utils::property_tree const &socket_data, server &srv) const;
+
+  std::auto_ptr<std::streambuf> open(logger*, int, socket_param const &);
+  bool handshake(int, std::streambuf &, bool &);
+  std::streamsize read(int, std::streambuf &, char *, std::streamsize);
+  std::streamsize write(int, std::streambuf &, char const *, std::streamsize);
+  boost::int64_t send_file(
+    int, std::streambuf &, int, boost::int64_t, boost::int64_t);
 };
 
 }
@@ -3,7 +3,10 @@
 #define REST_KEYWORDS_HPP
 
 #include <string>
+#include <cstddef>
+#include <boost/any.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
 
 namespace rest {
 
@@ -20,11 +23,73 @@ enum keyword_type {
   NONE = -1
 };
 
+class keyword_layout;
+
+// Names a keyword declared on a context (see context::declare_keyword).
+// The keywords that context prepared have it at a fixed slot, others are
+// searched by name.
+class keyword_slot {
+public:
+  keyword_slot() : layout(0), index(0) {}
+
+  std::string const &get_name() const { return name; }
+
+private:
+  friend class keywords;
+  friend class keyword_layout;
+
+  keyword_slot(
+      std::string const &name, keyword_layout const *layout, std::size_t index)
+    : name(name), layout(layout), index(index) {}
+
+  std::string name;
+  keyword_layout const *layout;
+  std::size_t index;
+};
+
+// The keywords declared on a context, numbered in order of declaration.
+class keyword_layout : boost::noncopyable {
+public:
+  keyword_layout();
+  ~keyword_layout();
+
+  // throws std::logic_error if `name' was declared already
+  keyword_slot add(std::string const &name, keyword_type type);
+
+  // the slot of `name' (case-insensitive), -1 if it is not declared
+  int find(std::string const &name) const;
+
+  std::size_t size() const;
+  std::string const &name(std::size_t slot) const;
+  keyword_type type(std::size_t slot) const;
+
+private:
+  class impl;
+  boost::scoped_ptr<impl> p;
+};
+
 class keywords {
 public:
   keywords();
   ~keywords();
 
+  // Declares the keywords of `layout' (which must stay around) in slots,
+  // replacing the declarations of the layout prepared before. After reset()
+  // the storage of the slots is reused.
+  void prepare(keyword_layout const &layout);
+
+  // forgets the keywords, values, entity and layout, as if newly
+  // constructed but keeping the storage of the slots
+  void reset();
+
+  std::string const &get(keyword_slot const &slot) const {
+    return const_cast<keywords *>(this)->access(slot);
+  }
+
+  std::string &access(keyword_slot const &slot);
+  std::istream &read(keyword_slot const &slot);
+  bool is_set(keyword_slot const &slot) const;
+
   bool exists(std::string const &key, int index = 0) const;
 
   std::string const &get(std::string const &keyword, int index = 0) const {
@@ -50,18 +115,34 @@ public:
 
   void unset(std::string const &key, int index = 0);
 
+  // The value of a typed closure (like {id:uint64}, see context::bind) as
+  // converted when the path was matched, 0 if there is none. Setting the
+  // keyword's text again drops it.
+  boost::any const *get_value(std::string const &key, int index = 0) const;
+  void set_value(std::string const &key, int index, boost::any const &value);
+
   void flush();
 
   void set_entity(input_stream &entity, std::string const &type);
   void add_uri_encoded(std::string const &data);
 
+  // HEADER and COOKIE keywords take their values from `req' when first
+  // accessed, so it must stay around as long as they are used
   void set_request_data(request const &req);
 
+  // sets the keywords set in `other' here as well (declaring them if
+  // needed), with their values but without streams or outputs
+  void merge(keywords const &other);
+
 public:
   std::string &operator[](std::string const &key) {
     return access(key);
   }
 
+  std::string &operator[](keyword_slot const &slot) {
+    return access(slot);
+  }
+
   void declare(std::string const &key, keyword_type type) {
     return declare(key, 0, type);
   }
@@ -88,6 +169,16 @@ public:
     return set_output(key, 0, stream);
   }
 
+  // 0 unless the keyword has a value of type T
+  template<class T>
+  T const *get_value(std::string const &key, int index = 0) const {
+    return boost::any_cast<T>(get_value(key, index));
+  }
+
+  void set_value(std::string const &key, boost::any const &value) {
+    return set_value(key, 0, value);
+  }
+
 private:
   class impl;
   boost::scoped_ptr<impl> p;
@@ -15,11 +15,17 @@ class socket_param;
 
 namespace network {
 
-enum socket_type_t { ip4 = AF_INET, ip6 = AF_INET6 };
+// local: a unix domain socket, bound to a path (an abstract one if it starts
+// with '@')
+enum socket_type_t { ip4 = AF_INET, ip6 = AF_INET6, local = AF_UNIX };
 
 typedef union {
   boost::uint32_t ip4;
   boost::uint64_t ip6[2];
+  struct {
+    boost::int32_t pid; // -1 if unknown
+    boost::uint32_t uid;
+  } local;
 } addr_t;
 
 struct address {
@@ -29,11 +35,30 @@ struct address {
 
 std::string ntoa(address const &addr);
 
+// TCP tuning of a listen socket and its connections; 0 keeps the system
+// default
+struct tcp_options {
+  tcp_options()
+    : nodelay(false), defer_accept(0), fastopen(0),
+      send_buffer(0), receive_buffer(0)
+  {}
+
+  bool nodelay;       // TCP_NODELAY on every connection
+  int defer_accept;   // seconds to wait for the first data (TCP_DEFER_ACCEPT)
+  int fastopen;       // length of the TCP_FASTOPEN queue
+  int send_buffer;    // SO_SNDBUF
+  int receive_buffer; // SO_RCVBUF
+};
+
 int socket(int type);
 void close_on_exec(int fd);
 void getaddrinfo(socket_param const &sock, ::addrinfo **res);
 int accept(socket_param const &sock, address &remote);
-int create_listenfd(socket_param &sock, int backlog);
+// sets up a connection accepted on `sock' (by other means than accept()),
+// `from' is its peer's address as returned by the kernel
+void accepted(socket_param const &sock, int connfd, sockaddr const *from,
+              address &remote);
+int create_listenfd(socket_param &sock, int backlog, bool reuse_port = false);
 
 }}
 
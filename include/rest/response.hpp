@@ -20,7 +20,7 @@ class headers;
 /*
  * TODO:
  * - multi-chunk output
- * - mmap output / sendfile
+ * - mmap output
  */
 class response {
 public:
@@ -48,6 +48,10 @@ public:
   void move(response &o);
   void swap(response &o);
 
+  // copies the response into `o' unless it has data which is not held in
+  // memory (streams, files)
+  bool copy(response &o) const;
+
   void set(int code, std::string const &type, std::string const &data) {
     set_code(code);
     set_type(type);
@@ -64,11 +68,34 @@ public:
 
   void add_cookie(cookie const &c);
 
+  // parameters for compressing the entity, unset values are taken from the
+  // host and the configuration
+  void set_compression(compression const &c);
+  compression const &get_compression() const;
+
   void set_data(std::string const &data, encoding *enc = 0);
   void set_data(std::string const &data, std::string const &enc);
   void set_data(input_stream &data, bool seekable, encoding *enc = 0);
   void set_data(input_stream &data, bool seekable, std::string const &enc);
 
+  // `length' bytes (-1: up to the end) of the file `fd' starting at
+  // `offset'; the response takes over fd. Sent with sendfile if possible.
+  void set_file(int fd, boost::int64_t offset = 0, boost::int64_t length = -1,
+                encoding *enc = 0);
+  void set_file(int fd, boost::int64_t offset, boost::int64_t length,
+                std::string const &enc);
+
+  // whether the data for `enc' is a file set with set_file()
+  bool get_file(encoding *enc, int &fd, boost::int64_t &offset) const;
+
+  // the data for `enc' if it is held in memory, else 0
+  std::string const *get_string(encoding *enc) const;
+
+  // the bytes of data held in memory for all encodings
+  std::size_t data_size() const;
+
+  bool has_cookies() const;
+
   void set_length(boost::int64_t size, encoding *enc);
   void set_length(boost::int64_t size, std::string const &enc);
 
@@ -5,6 +5,9 @@
 #include "object.hpp"
 #include "network.hpp"
 #include <boost/any.hpp>
+#include <boost/cstdint.hpp>
+#include <iosfwd>
+#include <memory>
 
 namespace rest {
 
@@ -36,6 +39,31 @@ public:
     logger *log,
     utils::property_tree const &socket_data,
     server &srv) const = 0;
+
+  // event-driven serving (see /connections/engine):
+  // open() sets up the connection stream without serving anything, an
+  // empty result means the scheme only supports serve().
+  virtual std::auto_ptr<std::streambuf> open(
+    logger *log,
+    int connfd,
+    socket_param const &sock);
+
+  // The socket of an event-driven connection is in non-blocking mode, the
+  // transfers on it go through these, with `conn' from open(). They return
+  // what was transferred (0 from read() at the end of input), or -1 with
+  // errno EAGAIN if the socket is not ready. handshake() finishes setting up
+  // the connection, false while it waits for the socket (to take output if
+  // `want_write' is set). send_file() fails with ENOSYS where files cannot
+  // be sent without copying them through the connection. The defaults work
+  // on the socket directly.
+  virtual bool handshake(int connfd, std::streambuf &conn, bool &want_write);
+  virtual std::streamsize read(
+    int connfd, std::streambuf &conn, char *buf, std::streamsize n);
+  virtual std::streamsize write(
+    int connfd, std::streambuf &conn, char const *buf, std::streamsize n);
+  virtual boost::int64_t send_file(
+    int connfd, std::streambuf &conn,
+    int fd, boost::int64_t offset, boost::int64_t length);
 };
 
 class http_scheme : public scheme {
@@ -49,6 +77,8 @@ private:
     logger*,int,socket_param const&,network::address const&,std::string const&);
   boost::any create_context(
     logger*, utils::property_tree const &, server &) const;
+
+  std::auto_ptr<std::streambuf> open(logger*, int, socket_param const &);
 };
 
 }
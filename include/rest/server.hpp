@@ -40,7 +40,12 @@ public:
     watch_callback_t const &watch_callback);
   void unwatch_file(int wd);
 
-  void timeout(unsigned int ms, boost::function<void ()> const &);
+  typedef unsigned long timer_id;
+
+  // calls the function once after `ms' milliseconds
+  timer_id timeout(unsigned int ms, boost::function<void ()> const &);
+  // false if it ran already
+  bool cancel_timeout(timer_id id);
 
 private:
   class impl;
@@ -24,6 +24,7 @@ public:
 
   sigset_t const *pending_signals() const;
   void reset_pending();
+  void reset_pending(signal_type sig);
 
   bool is_pending(signal_type sig) const;
 
@@ -43,6 +43,13 @@ public:
   long timeout_read() const;
   long timeout_write() const;
 
+  network::tcp_options const &tcp() const;
+  void tcp(network::tcp_options const &options);
+
+  // file mode of a unix socket, 0 leaves it to the umask
+  unsigned permissions() const;
+  void permissions(unsigned mode);
+
   host_container &hosts();
 
   host_container const &hosts() const {
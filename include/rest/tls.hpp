@@ -63,11 +63,25 @@ namespace rest { namespace tls {
     struct impl;
     boost::scoped_ptr<impl> p;
   public:
+    // `http2': offer "h2" before "http/1.1" with ALPN; `handshake': do the
+    // handshake right away, else it is left to handshake()
     session(x509_certificate_credentials const &cred, priority const &prio,
-            int fd);
+            int fd, bool http2 = false, bool handshake = true);
     //explicit session(gnutls_session_t session_, int fd = -1);
     ~session();
 
+    // number of bytes received and decrypted but not yet read
+    std::size_t pending() const;
+
+    // For sockets in non-blocking mode: handshake() goes on with the
+    // handshake, false while it waits for the socket (to take output if
+    // `want_write' is set). read_some() and write_some() transfer what they
+    // can without waiting, -1 with errno EAGAIN if nothing; an unfinished
+    // write_some() has to be repeated with the same data.
+    bool handshake(bool &want_write);
+    std::streamsize read_some(char *buf, std::streamsize n);
+    std::streamsize write_some(char const *buf, std::streamsize n);
+
     impl const &i_get_() const { return *p.get(); } // internal!
   };
 
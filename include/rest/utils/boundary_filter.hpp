@@ -2,18 +2,30 @@
 #ifndef REST_UTILS_BOUNDARY_FILTER_HPP
 #define REST_UTILS_BOUNDARY_FILTER_HPP
 
+#include "scan.hpp"
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/read.hpp>
+#include <algorithm>
+#include <streambuf>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 namespace rest { namespace utils {
 
+// Reads up to `boundary' and skips it. Nothing after the boundary (and the
+// transport padding following it) is consumed from the source.
+//
+// Through a chain the filter can only look one boundary length ahead at a
+// time. If the source is pushed unbuffered on top of `input', the filter
+// reads `input' directly instead: it scans whatever `input' has buffered in
+// one go and puts back what it must not consume.
 class boundary_filter : public boost::iostreams::multichar_input_filter {
 public:
-  boundary_filter(std::string const &boundary)
+  boundary_filter(std::string const &boundary, std::streambuf *input = 0)
   : boundary(boundary),
     buf(new char[boundary.size()]),
+    input(input),
     eof(false),
     pos(boundary.size()),
     boundary_pos(pos)
@@ -24,6 +36,7 @@ public:
   boundary_filter(boundary_filter const &o)
   : boundary(o.boundary),
     buf(new char[boundary.size()]),
+    input(o.input),
     eof(false),
     pos(boundary.size()),
     boundary_pos(pos)
@@ -40,14 +53,28 @@ private:
 
 public:
   template<typename Source>
-  std::streamsize read(Source & __restrict, char * __restrict, std::streamsize);
+  std::streamsize read(Source & __restrict source,
+                       char * __restrict outbuf,
+                       std::streamsize outbuf_size)
+  {
+    if (input)
+      return read_from(*input, outbuf, outbuf_size);
+    return read_from(source, outbuf, outbuf_size);
+  }
 
 private:
+  template<typename Source>
+  std::streamsize read_from(
+      Source & __restrict, char * __restrict, std::streamsize);
+
   template<typename Source>
   std::size_t update(Source & __restrict);
 
+  std::size_t read_buffered(char * __restrict outbuf, std::size_t length);
+
   void kmp_init();
-  std::size_t check_boundary();
+  std::size_t find_boundary(
+      char const *data, std::size_t begin, std::size_t end) const;
 
   template<typename Source>
   void skip_transport_padding(Source & __restrict);
@@ -55,6 +82,7 @@ private:
 private:
   std::string const boundary;
   char * __restrict buf;
+  std::streambuf *input;
   bool eof;
   std::size_t pos;
   std::size_t boundary_pos;
@@ -62,7 +90,7 @@ private:
 };
 
 template<typename Source>
-std::streamsize boundary_filter::read(
+std::streamsize boundary_filter::read_from(
     Source & __restrict source,
     char * __restrict outbuf,
     std::streamsize outbuf_size_)
@@ -75,6 +103,15 @@ std::streamsize boundary_filter::read(
   std::size_t outbuf_pos = 0;
   try {
     while (outbuf_pos < outbuf_size) {
+      // nothing held back in `buf': scan what `input' has buffered
+      if (input && pos == boundary.size()) {
+        std::size_t n =
+          read_buffered(outbuf + outbuf_pos, outbuf_size - outbuf_pos);
+        if (n) {
+          outbuf_pos += n;
+          continue;
+        }
+      }
       std::size_t fresh_bytes = update(source) - pos;
       std::size_t read_bytes = std::min(fresh_bytes, outbuf_size - outbuf_pos);
       memcpy(outbuf + outbuf_pos, buf + pos, read_bytes);
@@ -115,7 +152,7 @@ std::size_t boundary_filter::update(Source & __restrict source) {
       memmove(buf + pos, buf, boundary.size() - pos);
     }
 
-    boundary_pos = check_boundary();
+    boundary_pos = find_boundary(buf, pos, boundary.size());
   }
 
   return boundary_pos;
@@ -135,22 +172,47 @@ inline void boundary_filter::kmp_init() {
   }
 }
 
-inline std::size_t boundary_filter::check_boundary() {
-  std::size_t i = pos;
-  int j = 0, j2;
-  std::size_t x = i;
-  while (i < boundary.size()) {
-    j2 = j;
-    while (j >= 0 && buf[i] != boundary[j])
+// the start of the first complete boundary in [begin, end), else of a
+// boundary prefix ending at `end', else `end'
+inline std::size_t boundary_filter::find_boundary(
+    char const *data, std::size_t begin, std::size_t end) const
+{
+  std::size_t i = begin;
+  int j = 0;
+  while (i < end) {
+    if (j == 0) {
+      // nothing matched so far, skip everything but the first byte
+      i = scan::find(data + i, data + end, boundary[0]) - data;
+      if (i == end)
+        break;
+    }
+    while (j >= 0 && data[i] != boundary[j])
       j = kmp_next[j];
     ++i;
     ++j;
-    if (j <= 0)
-      x = i;
-    else if (j <= j2)
-      x = i - 1;
+    if (std::size_t(j) == boundary.size())
+      return i - j;
   }
-  return x;
+  return end - j;
+}
+
+// Takes what `input' has buffered up to the first possible boundary; 0 if
+// that is right at the start or too little is buffered to tell.
+inline std::size_t boundary_filter::read_buffered(
+    char * __restrict outbuf, std::size_t length)
+{
+  std::streamsize avail = input->in_avail();
+  if (boundary.empty() || avail <= std::streamsize(boundary.size()))
+    return 0;
+  length = std::min(length, std::size_t(avail));
+
+  // all of it comes from the get area, so it can all be put back
+  length = std::size_t(input->sgetn(outbuf, std::streamsize(length)));
+  std::size_t n = find_boundary(outbuf, 0, length);
+  for (std::size_t i = length; i > n; --i)
+    if (input->sputbackc(outbuf[i - 1]) == std::streambuf::traits_type::eof())
+      throw std::logic_error("boundary_filter: cannot put back input");
+  return n;
 }
 
 template<typename Source>
@@ -143,6 +143,9 @@ public:
     return c;
   }
 
+  // the last chunk was read (the trailer is left in the source)
+  bool finished() const { return pending == -1; }
+
 private:
   std::streamsize pending;
 };
@@ -0,0 +1,93 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#ifndef REST_UTILS_DEFLATE_FILTER_HPP
+#define REST_UTILS_DEFLATE_FILTER_HPP
+
+#include <boost/iostreams/concepts.hpp>
+#include <boost/iostreams/write.hpp>
+#include <boost/iostreams/flush.hpp>
+#include <boost/shared_ptr.hpp>
+#include <ios>
+#include <cstddef>
+
+namespace rest { namespace utils {
+
+// Compressing output filter on top of zlib's deflate, with all of its
+// parameters settable. Unlike boost's zlib_compressor it can flush the
+// compressed data (Z_SYNC_FLUSH) every `flush_size' input bytes so that
+// streamed entities reach the client in time. The flush happens after the
+// write which completes `flush_size' bytes, so 1 flushes after every write.
+class deflate_filter {
+public:
+  typedef char char_type;
+
+  struct category
+    :
+      boost::iostreams::output_filter_tag,
+      boost::iostreams::multichar_tag,
+      boost::iostreams::closable_tag
+  {};
+
+  enum format { RAW, ZLIB, GZIP };
+
+  // -1 selects zlib's default for level, window_bits and mem_level;
+  // flush_size 0 flushes at the end only
+  deflate_filter(format fmt, int level = -1, int window_bits = -1,
+                 int mem_level = -1, std::size_t flush_size = 0);
+
+  template<typename Sink>
+  std::streamsize write(Sink &snk, char const *s, std::streamsize n) {
+    pending += n;
+    bool flush = flush_size && pending >= flush_size;
+    std::size_t len = n;
+    if (!output(snk, s, len, flush ? SYNC : NONE))
+      return -1;
+    if (flush) {
+      pending = 0;
+      boost::iostreams::flush(snk);
+    }
+    return n;
+  }
+
+  template<typename Sink>
+  void close(Sink &snk) {
+    std::size_t in_len = 0;
+    char const *s = 0;
+    output(snk, s, in_len, FINISH);
+    reset();
+  }
+
+private:
+  enum mode { NONE, SYNC, FINISH };
+
+  // compresses as much input as possible and writes all produced output
+  template<typename Sink>
+  bool output(Sink &snk, char const *&s, std::size_t &in_len, mode m) {
+    bool done;
+    do {
+      char *out;
+      std::size_t out_len;
+      done = deflate(s, in_len, out, out_len, m);
+      if (out_len > 0 &&
+          boost::iostreams::write(snk, out, out_len) != std::streamsize(out_len))
+        return false;
+    } while (!done);
+    return true;
+  }
+
+  // runs deflate once, `out' is the produced output (in an internal
+  // buffer); true once the input is used up and everything is written
+  bool deflate(char const *&in, std::size_t &in_len,
+               char *&out, std::size_t &out_len, mode m);
+
+  void reset();
+
+  std::size_t flush_size;
+  std::size_t pending;
+
+  class impl;
+  boost::shared_ptr<impl> p;
+};
+
+}}
+
+#endif
@@ -0,0 +1,65 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#ifndef REST_UTILS_HPACK_HPP
+#define REST_UTILS_HPACK_HPP
+
+#include "exceptions.hpp"
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+namespace rest { namespace utils { namespace hpack {
+
+// HPACK (RFC 7541), the header compression of HTTP/2
+
+typedef std::pair<std::string, std::string> header;
+typedef std::vector<header> header_list;
+
+// a malformed header block; the connection cannot go on after it
+class error : public utils::error {
+public:
+  error(std::string const &s) : utils::error("hpack: " + s) {}
+};
+
+// Decodes the header blocks of one direction of a connection, keeping the
+// dynamic table between them.
+class decoder : boost::noncopyable {
+public:
+  // `max_table_size' is what we announced as SETTINGS_HEADER_TABLE_SIZE,
+  // `max_list_size' limits the decoded size of a block (name and value
+  // lengths plus 32 per header, as in SETTINGS_MAX_HEADER_LIST_SIZE)
+  explicit decoder(std::size_t max_table_size = 4096,
+                   std::size_t max_list_size = 65536);
+  ~decoder();
+
+  // appends the headers of the block to `out', throws error
+  void decode(char const *data, std::size_t length, header_list &out);
+
+  std::size_t table_size() const;
+
+private:
+  class impl;
+  boost::scoped_ptr<impl> p;
+};
+
+// Encodes header blocks without ever adding to the dynamic table, so the
+// peer's table size does not matter. Headers found in the static table are
+// indexed, strings are Huffman coded where that is shorter.
+class encoder : boost::noncopyable {
+public:
+  encoder();
+  ~encoder();
+
+  void encode(header_list const &headers, std::string &out);
+};
+
+// the Huffman code of the strings, throw error on invalid input
+void huffman_encode(std::string const &in, std::string &out);
+void huffman_decode(char const *data, std::size_t length, std::string &out);
+std::size_t huffman_length(std::string const &in);
+
+}}}
+
+#endif
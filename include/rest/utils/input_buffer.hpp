@@ -0,0 +1,57 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#ifndef REST_UTILS_INPUT_BUFFER_HPP
+#define REST_UTILS_INPUT_BUFFER_HPP
+
+#include <streambuf>
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+namespace rest { namespace utils {
+
+// Buffers the input of another stream buffer so that all data read but not
+// consumed yet is accessible as one contiguous block (for parsing it in
+// place). Output is passed through unbuffered.
+class input_buffer : public std::streambuf {
+public:
+  input_buffer(std::auto_ptr<std::streambuf> next,
+               std::size_t initial_size = 4096);
+  ~input_buffer();
+
+  char const *data() const { return gptr(); }
+  std::size_t size() const { return egptr() - gptr(); }
+
+  // reads more data (at least one byte) and appends it to data(), which may
+  // move; returns false on end of input
+  bool fill();
+
+  void consume(std::size_t n);
+
+  // makes room for at least `n' more bytes after data(), to read into
+  // directly; commit() appends the `n' bytes read there
+  char *prepare(std::size_t n);
+  void commit(std::size_t n);
+
+  // the buffered stream buffer
+  std::streambuf *next_buffer() const { return next.get(); }
+
+protected:
+  int_type underflow();
+  std::streamsize xsgetn(char_type *s, std::streamsize n);
+  std::streamsize showmanyc();
+
+  int_type overflow(int_type c);
+  std::streamsize xsputn(char_type const *s, std::streamsize n);
+  int sync();
+
+private:
+  input_buffer(input_buffer const &);
+  input_buffer &operator=(input_buffer const &);
+
+  std::auto_ptr<std::streambuf> next;
+  std::vector<char> buffer;
+};
+
+}}
+
+#endif
@@ -35,6 +35,9 @@ public:
     return c;
   }
 
+  // bytes still to be read from the source
+  boost::uint64_t remaining() const { return length; }
+
 private:
   boost::uint64_t length;
 };
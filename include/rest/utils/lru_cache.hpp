@@ -0,0 +1,92 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#ifndef REST_UTILS_LRU_CACHE_HPP
+#define REST_UTILS_LRU_CACHE_HPP
+
+#include <boost/unordered_map.hpp>
+#include <boost/noncopyable.hpp>
+#include <list>
+#include <utility>
+#include <cstddef>
+
+namespace rest { namespace utils {
+
+// Maps keys to values up to a total cost (e.g. bytes of memory). When an
+// insertion exceeds the budget the least recently used entries are evicted.
+template<typename Key, typename Value>
+class lru_cache : boost::noncopyable {
+public:
+  explicit lru_cache(std::size_t budget) : budget_(budget), cost_(0) {}
+
+  std::size_t budget() const { return budget_; }
+
+  void set_budget(std::size_t budget) {
+    budget_ = budget;
+    while (cost_ > budget_)
+      erase(entries.back().key);
+  }
+
+  std::size_t cost() const { return cost_; }
+  std::size_t size() const { return index.size(); }
+
+  // 0 if not found, else the value, which becomes the most recently used one
+  Value const *find(Key const &key) {
+    typename index_type::iterator it = index.find(key);
+    if (it == index.end())
+      return 0;
+    entries.splice(entries.begin(), entries, it->second);
+    return &it->second->value;
+  }
+
+  // returns false (and does not store anything) if `cost' exceeds the budget
+  // on its own
+  bool insert(Key const &key, Value const &value, std::size_t cost) {
+    erase(key);
+    if (cost > budget_)
+      return false;
+
+    while (cost_ + cost > budget_)
+      erase(entries.back().key);
+
+    entries.push_front(entry(key, value, cost));
+    index[key] = entries.begin();
+    cost_ += cost;
+    return true;
+  }
+
+  void erase(Key const &key) {
+    typename index_type::iterator it = index.find(key);
+    if (it == index.end())
+      return;
+    cost_ -= it->second->cost;
+    entries.erase(it->second);
+    index.erase(it);
+  }
+
+  void clear() {
+    index.clear();
+    entries.clear();
+    cost_ = 0;
+  }
+
+private:
+  struct entry {
+    entry(Key const &key, Value const &value, std::size_t cost)
+      : key(key), value(value), cost(cost) {}
+
+    Key key;
+    Value value;
+    std::size_t cost;
+  };
+
+  typedef std::list<entry> entry_list;
+  typedef boost::unordered_map<Key, typename entry_list::iterator> index_type;
+
+  std::size_t budget_;
+  std::size_t cost_;
+  entry_list entries;
+  index_type index;
+};
+
+}}
+
+#endif
@@ -0,0 +1,96 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#ifndef REST_UTILS_REQUEST_PARSER_HPP
+#define REST_UTILS_REQUEST_PARSER_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace rest { namespace utils { namespace http {
+
+// a part of the parsed buffer
+struct span {
+  std::size_t offset;
+  std::size_t length;
+
+  span() : offset(0), length(0) {}
+  span(std::size_t offset, std::size_t length)
+    : offset(offset), length(length) {}
+
+  std::string str(char const *data) const {
+    return std::string(data + offset, length);
+  }
+};
+
+struct header_field {
+  span name;
+  span value; // may span continuation lines if `folded'
+  bool folded;
+};
+
+// the value of `field' with continuation lines joined and trailing spaces
+// removed (the same value read_headers() would produce)
+std::string field_value(char const *data, header_field const &field);
+
+// Parses the head of a request (request line and header fields) directly
+// from a contiguous buffer. Nothing is copied, names and values are
+// recorded as spans.
+//
+// parse() may be called again with more data (the buffer contents seen
+// before must be unchanged, though they may have moved) and resumes where
+// it stopped. Malformed requests result in bad_format being thrown.
+class request_parser {
+public:
+  enum state_t { REQUEST_LINE, HEADERS, DONE };
+
+  // 0 means unlimited, see get_request_line() and get_header_field()
+  request_parser(
+    std::size_t max_method_length = 0,
+    std::size_t max_uri_length = 0,
+    std::size_t max_version_length = 0,
+    std::size_t max_name_length = 0,
+    std::size_t max_value_length = 0,
+    std::size_t max_header_count = 0);
+
+  void reset();
+
+  // stops after the request line, so it can be checked before the headers
+  // are read
+  state_t parse(char const *data, std::size_t length);
+
+  state_t state() const { return state_; }
+
+  // length of the complete head including the empty line
+  std::size_t consumed() const { return pos; }
+
+  span const &method() const { return method_; }
+  span const &uri() const { return uri_; }
+  span const &version() const { return version_; }
+
+  typedef std::vector<header_field> fields_t;
+  fields_t const &fields() const { return fields_; }
+
+private:
+  void request_line(char const *data, std::size_t begin, std::size_t end);
+  void header_line(char const *data, std::size_t begin, std::size_t end);
+
+  std::size_t max_method_length;
+  std::size_t max_uri_length;
+  std::size_t max_version_length;
+  std::size_t max_name_length;
+  std::size_t max_value_length;
+  std::size_t max_header_count;
+
+  state_t state_;
+  std::size_t pos;  // start of the first line not parsed yet
+  std::size_t scan; // no line end in [pos, scan)
+
+  span method_;
+  span uri_;
+  span version_;
+  fields_t fields_;
+};
+
+}}}
+
+#endif
@@ -0,0 +1,32 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#ifndef REST_UTILS_SCAN_HPP
+#define REST_UTILS_SCAN_HPP
+
+namespace rest { namespace utils { namespace scan {
+
+// Delimiter search over contiguous buffers. On x86 SSE2 or AVX2 kernels
+// compare 16/32 bytes at a time, chosen at runtime (cpuid); elsewhere a
+// plain loop is used.
+
+enum implementation { SCALAR, SSE2, AVX2 };
+
+// the fastest implementation this CPU supports
+implementation best();
+
+implementation active();
+
+// forces an implementation (falls back to best() if it is not supported),
+// for benchmarks and tests
+void use(implementation);
+
+char const *name(implementation);
+
+// first `c' in [begin, end) or end
+char const *find(char const *begin, char const *end, char c);
+
+// first `a' or `b' in [begin, end) or end
+char const *find_first_of(char const *begin, char const *end, char a, char b);
+
+}}}
+
+#endif
@@ -4,8 +4,11 @@
 
 #include <boost/iostreams/concepts.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
 #include <iosfwd>
 
+struct iovec;
+
 namespace rest { namespace utils {
 
 struct socket_device {
@@ -25,6 +28,21 @@ struct socket_device {
   std::streamsize read(char *, std::streamsize);
   std::streamsize write(char const *, std::streamsize);
 
+  // writes all `count' buffers, gathered into as few system calls as
+  // possible; the total length or -1 on error
+  std::streamsize write(struct iovec const *, int count);
+
+  // writes `length' bytes of the file `fd' starting at `offset' without
+  // copying them through user space; -1 on error
+  boost::int64_t send_file(int fd, boost::int64_t offset, boost::int64_t length);
+
+  // holds back partial segments until uncorked (TCP_CORK / TCP_NOPUSH);
+  // does nothing on other sockets
+  void cork(bool on);
+
+  // the number of write system calls made so far
+  unsigned long write_calls() const;
+
 private:
   class impl;
   boost::shared_ptr<impl> p;
@@ -0,0 +1,53 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#ifndef REST_UTILS_TIMER_WHEEL_HPP
+#define REST_UTILS_TIMER_WHEEL_HPP
+
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <cstddef>
+
+namespace rest { namespace utils {
+
+// Hierarchical timer wheel: four levels of 64 slots each, the first one
+// `resolution' wide. Adding, cancelling and rescheduling a timer is O(1),
+// timers further away than the wheel reaches are cascaded down as time goes
+// on. Times are absolute milliseconds of any clock; a timer never fires
+// before its deadline but up to `resolution' after it.
+class timer_wheel : boost::noncopyable {
+public:
+  typedef boost::uint64_t time_type;
+  typedef unsigned long timer_id; // 0 is never a valid timer
+
+  static time_type const NEVER;
+
+  timer_wheel(time_type now, unsigned resolution = 1);
+  ~timer_wheel();
+
+  timer_id add(time_type deadline, boost::function<void ()> const &callback);
+
+  // false if the timer fired or was cancelled already
+  bool cancel(timer_id id);
+  bool reschedule(timer_id id, time_type deadline);
+
+  // runs the callbacks of all timers due at `now', in order of their
+  // deadlines (within the resolution) and returns how many ran. Callbacks may
+  // add, cancel and reschedule timers; those they add for the current tick
+  // run with the next one.
+  std::size_t advance(time_type now);
+
+  // when advance() has to be called next: at or before the earliest
+  // deadline, NEVER if there are no timers
+  time_type next_expiry() const;
+
+  std::size_t size() const;
+
+private:
+  class impl;
+  boost::scoped_ptr<impl> p;
+};
+
+}}
+
+#endif
@@ -3,6 +3,7 @@
 #define REST_UTILS_URI_HPP
 
 #include <string>
+#include <cstddef>
 
 namespace rest { namespace utils { namespace uri {
 
@@ -21,6 +22,9 @@ inline std::string unescape(std::string const &x, bool form) {
   return unescape(x.begin(), x.end(), form);
 }
 
+// into `out', which has room for end - begin characters; returns the length
+std::size_t unescape(char const *begin, char const *end, char *out, bool form);
+
 void make_basename(std::string &uri);
 
 }}}
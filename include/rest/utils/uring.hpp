@@ -0,0 +1,90 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#ifndef REST_UTILS_URING_HPP
+#define REST_UTILS_URING_HPP
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <signal.h>
+
+// io_uring support is compiled in where the kernel headers know it, unless
+// REST_NO_URING is defined
+#if !defined(REST_NO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define REST_HAVE_URING 1
+#endif
+#endif
+
+namespace rest { namespace utils {
+
+// A minimal io_uring event source (straight on the system calls, no
+// liburing): accepts, polls and transfers are queued and submitted in one go
+// with the next wait(), which also collects their completions. The
+// constructor throws errno_error where io_uring is not available (not
+// compiled in, kernel older than 5.13, disabled by the administrator).
+class uring : boost::noncopyable {
+public:
+  struct completion {
+    boost::uint64_t data;
+    int result; // as returned by the system call, -errno on failure
+    bool more;  // the operation goes on and completes again
+  };
+
+  // how read() and write() find their file and buffer
+  enum transfer_flags {
+    FIXED_FILE = 1,   // `fd' is an index into the registered files
+    FIXED_BUFFER = 2, // `buf' lies in the registered buffer
+    LINK = 4          // the next operation starts once this one succeeded
+  };
+
+  explicit uring(unsigned entries);
+  ~uring();
+
+  // Registers `size' bytes at `base' for FIXED_BUFFER transfers, and a table
+  // of `count' files, empty at first (see update_file()). false with errno
+  // set if the kernel refuses, e.g. beyond RLIMIT_MEMLOCK.
+  bool register_buffer(void *base, std::size_t size);
+  bool register_files(unsigned count);
+  // puts `*fd' (-1: none) at `index' of the registered files; `fd' has to
+  // stay valid until the next wait()
+  void update_file(unsigned index, int const *fd, boost::uint64_t data);
+
+  // queued until the next wait(); `addr' and `len' have to stay valid until
+  // the accept completes
+  void accept(int fd, sockaddr *addr, socklen_t *len, boost::uint64_t data);
+  // completes with the poll(2) revents whenever the file becomes ready
+  // (like EPOLLET) until cancelled or `more' is false
+  void poll(int fd, unsigned events, boost::uint64_t data);
+  // cancels the poll queued with `target'
+  void cancel_poll(boost::uint64_t target, boost::uint64_t data);
+
+  // read(2)/write(2) at `offset' (0 for sockets) with `flags' from
+  // transfer_flags; `buf' has to stay valid until the completion
+  void read(int fd, char *buf, std::size_t n, boost::int64_t offset,
+            unsigned flags, boost::uint64_t data);
+  void write(int fd, char const *buf, std::size_t n, boost::int64_t offset,
+             unsigned flags, boost::uint64_t data);
+  // cancels the transfer queued with `target', which completes with
+  // -ECANCELED unless it is done already
+  void cancel(boost::uint64_t target, boost::uint64_t data);
+
+  // submits everything queued and waits at most `ms' milliseconds
+  // (unsigned(-1): forever) for completions with `mask' as the signal mask;
+  // returns the number of completions stored in `out', 0 on timeout or
+  // signal
+  int wait(completion *out, int max, unsigned ms, sigset_t const *mask);
+
+  // the number of io_uring_enter system calls made so far
+  unsigned long enter_calls() const;
+
+private:
+  class impl;
+  boost::scoped_ptr<impl> p;
+};
+
+}}
+
+#endif
@@ -3,32 +3,229 @@
 #include <rest/utils/uri.hpp>
 #include <rest/utils/string.hpp>
 #include <rest/config.hpp>
+#include <rest/utils/lru_cache.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/key_extractors.hpp>
 #include <boost/tokenizer.hpp>
+#include <boost/cstdint.hpp>
 #include <stdexcept>
+#include <limits>
+#include <bitset>
 #include <algorithm>
+#include <vector>
+#include <map>
+#include <cstring>
 
 using namespace rest;
 namespace det = rest::detail;
 using namespace boost::multi_index;
 namespace uri = rest::utils::uri;
 
+namespace {
+  // bumped by every bind, compiled routers older than that are rebuilt
+  unsigned long bind_generation = 0;
+
+  // what find_responder found for a path in a context
+  struct cached_route {
+    det::any_path path_id;
+    det::responder_base *responder;
+    context *local;
+    boost::shared_ptr<keywords> kw;
+  };
+
+  typedef std::pair<context *, std::string> route_key;
+  typedef rest::utils::lru_cache<route_key, cached_route> route_cache_t;
+
+  // the budget is set by the server
+  route_cache_t &route_cache() {
+    static route_cache_t cache(0);
+    return cache;
+  }
+
+  // bumped by anything changing what find_responder finds (binds, keyword
+  // declarations, contexts going away), the route cache is emptied then
+  unsigned long route_generation = 0;
+  unsigned long route_cache_generation = 0;
+
+  unsigned long route_cache_hits = 0;
+  unsigned long route_cache_misses = 0;
+
+  // the tokens boost::char_separator<char>("/", "=", keep_empty_tokens)
+  // splits a path into, as ranges of the path
+  class path_segments {
+  public:
+    path_segments(char const *begin, char const *end)
+      : next(begin), end(end), output_done(false)
+    {
+      valid = advance();
+    }
+
+    void operator++() {
+      valid = advance();
+    }
+
+    bool valid;
+    char const *first;
+    char const *last;
+
+  private:
+    bool advance() {
+      char const *start = next;
+      if (next == end) {
+        if (output_done)
+          return false;
+        output_done = true;
+      } else if (*next == '=') {
+        if (output_done) {
+          ++next;
+          output_done = false;
+        } else {
+          output_done = true;
+        }
+      } else if (*next == '/' && !output_done) {
+        output_done = true;
+      } else {
+        if (*next == '/')
+          start = ++next;
+        while (next != end && *next != '/' && *next != '=')
+          ++next;
+        output_done = true;
+      }
+      first = start;
+      last = next;
+      return true;
+    }
+
+    char const *next;
+    char const *end;
+    bool output_done;
+  };
+}
+
+namespace {
+  // What a closure matches, from what follows the name: {name} any segment,
+  // {name:int64} and {name:uint64} decimal numbers in range (also set as
+  // keyword value), {name:[a-z0-9-]+} segments of the characters listed
+  // ('*' instead of '+' for empty ones too, '^' first for all but these).
+  class closure_spec {
+  public:
+    closure_spec() : kind(ANY), empty_ok(true) {}
+
+    explicit closure_spec(std::string const &spec)
+      : kind(ANY), empty_ok(true), spec(spec)
+    {
+      if (spec.empty())
+        return;
+      if (spec == "int64") {
+        kind = INT64;
+        return;
+      }
+      if (spec == "uint64") {
+        kind = UINT64;
+        return;
+      }
+
+      std::size_t const n = spec.size();
+      if (n < 4 || spec[0] != '[' || spec[n - 2] != ']' ||
+          (spec[n - 1] != '+' && spec[n - 1] != '*'))
+        throw std::logic_error("invalid closure type");
+      kind = CHARS;
+      empty_ok = spec[n - 1] == '*';
+
+      std::size_t i = 1;
+      bool const negate = spec[i] == '^' && n > 4;
+      if (negate)
+        ++i;
+      for (; i < n - 2; ++i) {
+        unsigned char from = spec[i];
+        unsigned char to = from;
+        if (i + 2 < n - 2 && spec[i + 1] == '-') {
+          to = spec[i + 2];
+          i += 2;
+        }
+        if (to < from)
+          throw std::logic_error("invalid closure type");
+        for (unsigned c = from; c <= to; ++c)
+          chars.set(c);
+      }
+      if (negate)
+        chars.flip();
+    }
+
+    bool operator==(closure_spec const &o) const {
+      return spec == o.spec;
+    }
+
+    // whether the (unescaped) segment matches, its converted value if typed
+    bool match(char const *text, std::size_t length, boost::any &value) const {
+      switch (kind) {
+      case ANY:
+        return true;
+      case INT64: {
+        bool const minus = length > 0 && *text == '-';
+        boost::uint64_t x;
+        if (!parse(text + minus, text + length, x))
+          return false;
+        boost::uint64_t const max = std::numeric_limits<boost::int64_t>::max();
+        if (x > max + minus)
+          return false;
+        value = minus && x ? -boost::int64_t(x - 1) - 1 : boost::int64_t(x);
+        return true;
+      }
+      case UINT64: {
+        boost::uint64_t x;
+        if (!parse(text, text + length, x))
+          return false;
+        value = x;
+        return true;
+      }
+      case CHARS:
+        if (length == 0)
+          return empty_ok;
+        for (std::size_t i = 0; i < length; ++i)
+          if (!chars.test((unsigned char) text[i]))
+            return false;
+        return true;
+      }
+      return false;
+    }
+
+  private:
+    static bool parse(char const *p, char const *end, boost::uint64_t &out) {
+      if (p == end)
+        return false;
+      boost::uint64_t const max = std::numeric_limits<boost::uint64_t>::max();
+      boost::uint64_t x = 0;
+      for (; p != end; ++p) {
+        if (*p < '0' || *p > '9')
+          return false;
+        unsigned const digit = *p - '0';
+        if (x > (max - digit) / 10)
+          return false;
+        x = x * 10 + digit;
+      }
+      out = x;
+      return true;
+    }
+
+    enum { ANY, INT64, UINT64, CHARS } kind;
+    bool empty_ok;
+    std::bitset<256> chars;
+    std::string spec;
+  };
+}
+
 class context::impl {
 public:
-  typedef boost::unordered_map<
-      std::string, keyword_type,
-      rest::utils::string_ihash,
-      rest::utils::string_iequals
-    > keyword_type_map_type;
-
   struct path_resolver_node {
     enum type_t { root, closure, literal };
 
     type_t type;
     std::string data;
+    closure_spec spec; // of closures
     bool ellipsis;
 
     context *context_;
@@ -81,48 +278,93 @@ public:
     }
   };
 
-  keyword_type_map_type predeclared_keywords;
+  keyword_layout declared_keywords;
   path_resolver_node root;
 
   path_resolver_node *make_bindable(std::string const &spec);
+
+  // The bindings flattened: nodes and their literal children (sorted by
+  // length and text, for binary search) in contiguous arrays, the literals
+  // in one string. Nested contexts become part of the same arrays.
+  struct compiled_node {
+    std::size_t first_edge;
+    std::size_t edge_count;
+    int closure; // the child matching any other segment, -1 if none
+    int next;    // the root of the nested context to go on in, -1 if none
+    bool is_closure;
+    bool ellipsis;
+    path_resolver_node const *source;
+    context *owner;
+  };
+
+  struct compiled_edge {
+    std::size_t offset;
+    std::size_t length;
+    int child;
+  };
+
+  struct compiled_router {
+    std::vector<compiled_node> nodes;
+    std::vector<compiled_edge> edges;
+    std::string literals;
+    unsigned long generation;
+
+    int find(compiled_node const &node, char const *text, std::size_t length)
+      const;
+  };
+
+  boost::scoped_ptr<compiled_router> router;
+
+  typedef std::map<context *, int> compiled_roots;
+
+  static int compile_context(
+    compiled_router &, context *, compiled_roots &);
+  static int compile_node(
+    compiled_router &, path_resolver_node const &, context *,
+    compiled_roots &);
+
+  void find_compiled(
+    char const *, char const *,
+    det::any_path &,
+    det::responder_base *&,
+    context *&,
+    keywords &) const;
 };
 
 context::context() : p(new impl) {
 }
 
-context::~context() { }
+context::~context() {
+  ++route_generation;
+}
 
-void context::declare_keyword(std::string const &keyword, keyword_type type) {
-  bool x =
-    p->predeclared_keywords.insert(std::make_pair(keyword, type)).second;
-  if (!x)
-    throw std::logic_error("keyword already declared");
+keyword_slot context::declare_keyword(
+  std::string const &keyword, keyword_type type)
+{
+  keyword_slot slot = p->declared_keywords.add(keyword, type);
+  ++route_generation;
+  return slot;
 }
 
 keyword_type context::get_keyword_type(std::string const &keyword) const {
-  impl::keyword_type_map_type::iterator it =
-    p->predeclared_keywords.find(keyword);
-  if (it == p->predeclared_keywords.end())
+  int slot = p->declared_keywords.find(keyword);
+  if (slot < 0)
     return NONE;
-  return it->second;
+  return p->declared_keywords.type(slot);
 }
 
 void context::enum_keywords(
   keyword_type type,
   boost::function<void (std::string const &)> const &callback) const
 {
-  for (impl::keyword_type_map_type::iterator it = p->predeclared_keywords.begin();
-      it != p->predeclared_keywords.end();
-      ++it)
-    if (type == NONE || it->second == type)
-      callback(it->first);
+  keyword_layout const &declared = p->declared_keywords;
+  for (std::size_t slot = 0; slot < declared.size(); ++slot)
+    if (type == NONE || declared.type(slot) == type)
+      callback(declared.name(slot));
 }
 
 void context::prepare_keywords(keywords &kw) const {
-  for (impl::keyword_type_map_type::iterator it = p->predeclared_keywords.begin();
-      it != p->predeclared_keywords.end();
-      ++it)
-    kw.declare(it->first, it->second);
+  kw.prepare(p->declared_keywords);
 }
 
 #ifndef NDEBUG
@@ -144,6 +386,8 @@ void context::do_bind(
   det::any_path const &associated)
 {
   CHECK_PATH_LEN(path);
+  ++bind_generation;
+  ++route_generation;
   impl::path_resolver_node *current = p->make_bindable(path);
   current->responder_ = &responder_;
   current->associated_path_id = associated;
@@ -155,6 +399,8 @@ void context::do_bind(
   det::any_path const &associated)
 {
   CHECK_PATH_LEN(path);
+  ++bind_generation;
+  ++route_generation;
   impl::path_resolver_node *current = p->make_bindable(path);
   current->context_ = &context_;
   current->associated_path_id = associated;
@@ -168,6 +414,63 @@ void context::find_responder(
   det::responder_base *&out_responder,
   context *&out_context,
   keywords &out_keywords)
+{
+  route_cache_t &cache = route_cache();
+  if (cache.budget() == 0) {
+    resolve(path, path_id, out_responder, out_context, out_keywords);
+    return;
+  }
+
+  if (route_cache_generation != route_generation) {
+    cache.clear();
+    route_cache_generation = route_generation;
+  }
+
+  route_key key(this, path);
+  cached_route const *x = cache.find(key);
+  if (x) {
+    ++route_cache_hits;
+    path_id = x->path_id;
+    out_responder = x->responder;
+    out_context = x->local;
+    out_context->prepare_keywords(out_keywords);
+    out_keywords.merge(*x->kw);
+    return;
+  }
+
+  ++route_cache_misses;
+  resolve(path, path_id, out_responder, out_context, out_keywords);
+  // unknown paths are not cached, so probing them cannot evict the others
+  if (!out_responder)
+    return;
+
+  cached_route route;
+  route.path_id = path_id;
+  route.responder = out_responder;
+  route.local = out_context;
+  route.kw.reset(new keywords);
+  route.kw->merge(out_keywords);
+  cache.insert(key, route, 1);
+}
+
+void context::set_route_cache_size(std::size_t entries) {
+  route_cache().set_budget(entries);
+}
+
+context::route_cache_statistics context::route_cache_stats() {
+  route_cache_statistics stats;
+  stats.hits = route_cache_hits;
+  stats.misses = route_cache_misses;
+  stats.size = route_cache().size();
+  return stats;
+}
+
+void context::resolve(
+  std::string const &path,
+  det::any_path &path_id,
+  det::responder_base *&out_responder,
+  context *&out_context,
+  keywords &out_keywords)
 {
   out_responder = 0;
 
@@ -177,9 +480,16 @@ void context::find_responder(
   iterator end = path.end();
   iterator middle = std::find(start, end, '?');
 
-  typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
+  // bound to since compiled (here or in a nested context)
+  if (p->router && p->router->generation != bind_generation)
+    compile();
 
-  {
+  if (p->router) {
+    p->find_compiled(
+      path.data(), path.data() + (middle - start),
+      path_id, out_responder, out_context, out_keywords);
+  } else {
+    typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
     boost::char_separator<char> sep("/", "=", boost::keep_empty_tokens);
     tokenizer tokens(start, middle, sep);
 
@@ -218,8 +528,13 @@ void context::do_find_responder(
     if (!current)
       return;
     if (current->type == impl::path_resolver_node::closure) {
+      boost::any value;
+      if (!current->spec.match(text.data(), text.size(), value))
+        return;
       out_keywords.declare(current->data, NORMAL);
       out_keywords.set(current->data, text);
+      if (!value.empty())
+        out_keywords.set_value(current->data, value);
     } else if (!current->ellipsis) {
       last = text;
     }
@@ -267,11 +582,21 @@ context::impl::make_bindable(std::string const &path) {
         throw std::logic_error("invalid closure");
       if (it->find('{', 1) != tokenizer::value_type::npos)
         throw std::logic_error("invalid closure");
-      if (!current->unconditional_child)
+      std::string::size_type colon = it->find(':');
+      if (colon == std::string::npos)
+        colon = it->length() - 1;
+      closure_spec spec(
+        colon + 1 < it->length() ? it->substr(colon + 1, it->length() - colon - 2)
+                                 : std::string());
+      if (!current->unconditional_child) {
         current->unconditional_child.reset(new path_resolver_node);
+        current->unconditional_child->spec = spec;
+      } else if (!(current->unconditional_child->spec == spec)) {
+        throw std::logic_error("closure type differs from an earlier binding");
+      }
       current = current->unconditional_child.get();
       current->type = path_resolver_node::closure;
-      current->data.assign(it->begin() + 1, it->end() - 1);
+      current->data.assign(it->begin() + 1, it->begin() + colon);
     } else { // literal
       if (it->find_first_of("{}") != tokenizer::value_type::npos)
         throw std::logic_error("only full closures are allowed");
@@ -290,8 +615,184 @@ context::impl::make_bindable(std::string const &path) {
   return current;
 }
 
+void context::impl::find_compiled(
+  char const *begin, char const *end,
+  det::any_path &path_id,
+  det::responder_base *&out_responder,
+  context *&out_context,
+  keywords &out_keywords) const
+{
+  compiled_router const &r = *router;
+
+  path_segments it(begin, end);
+  while (it.valid && it.first == it.last)
+    ++it;
+
+  compiled_node const *current = &r.nodes[0];
+
+  for (;;) {
+    out_context = current->owner;
+
+    compiled_node const *last = 0;
+    char buffer[256];
+    std::string unescaped;
+
+    for (; !current->ellipsis && it.valid; ++it) {
+      char const *text = it.first;
+      std::size_t length = it.last - it.first;
+      // as uri::unescape would, but on the stack for usual lengths
+      if (std::memchr(text, '%', length)) {
+        if (length <= sizeof(buffer)) {
+          length = uri::unescape(text, text + length, buffer, false);
+          text = buffer;
+        } else {
+          unescaped = uri::unescape(std::string(text, length), false);
+          text = unescaped.data();
+          length = unescaped.size();
+        }
+      }
+
+      int child = r.find(*current, text, length);
+      if (child < 0)
+        return;
+      current = &r.nodes[child];
+      if (current->is_closure) {
+        boost::any value;
+        if (!current->source->spec.match(text, length, value))
+          return;
+        std::string const &name = current->source->data;
+        out_keywords.declare(name, NORMAL);
+        out_keywords.set(name, std::string(text, length));
+        if (!value.empty())
+          out_keywords.set_value(name, value);
+      } else if (!current->ellipsis) {
+        last = current;
+      }
+    }
+
+    path_resolver_node const &node = *current->source;
+    if (node.responder_) {
+      if (!node.associated_path_id.empty())
+        path_id = node.associated_path_id;
+      else if (node.ellipsis)
+        path_id = det::any_path(std::string(it.valid ? it.first : end, end));
+      else
+        path_id = det::any_path(last ? last->source->data : std::string());
+      out_responder = node.responder_;
+      return;
+    }
+
+    if (current->next < 0)
+      return;
+    current = &r.nodes[current->next];
+  }
+}
+
+int context::impl::compiled_router::find(
+  compiled_node const &node, char const *text, std::size_t length) const
+{
+  std::size_t lo = node.first_edge;
+  std::size_t hi = node.first_edge + node.edge_count;
+  while (lo < hi) {
+    std::size_t mid = lo + (hi - lo) / 2;
+    compiled_edge const &e = edges[mid];
+    int cmp;
+    if (e.length != length)
+      cmp = e.length < length ? -1 : 1;
+    else
+      cmp = std::memcmp(literals.data() + e.offset, text, length);
+    if (cmp == 0)
+      return e.child;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return node.closure;
+}
+
+namespace {
+  template<class Node>
+  bool literal_less(Node const *a, Node const *b) {
+    if (a->data.size() != b->data.size())
+      return a->data.size() < b->data.size();
+    return a->data < b->data;
+  }
+}
+
+int context::impl::compile_context(
+  compiled_router &r, context *ctx, compiled_roots &roots)
+{
+  compiled_roots::iterator it = roots.find(ctx);
+  if (it != roots.end())
+    return it->second;
+  // known before its bindings are, a context may be nested in itself
+  roots.insert(std::make_pair(ctx, int(r.nodes.size())));
+  return compile_node(r, ctx->p->root, ctx, roots);
+}
+
+int context::impl::compile_node(
+  compiled_router &r, path_resolver_node const &node, context *owner,
+  compiled_roots &roots)
+{
+  int const index = r.nodes.size();
+  {
+    compiled_node x;
+    x.first_edge = r.edges.size();
+    x.edge_count = node.conditional_children.size();
+    x.closure = -1;
+    x.next = -1;
+    x.is_closure = node.type == path_resolver_node::closure;
+    x.ellipsis = node.ellipsis;
+    x.source = &node;
+    x.owner = owner;
+    r.nodes.push_back(x);
+  }
+
+  std::vector<path_resolver_node const *> children(
+    node.conditional_children.begin(), node.conditional_children.end());
+  std::sort(children.begin(), children.end(),
+            &literal_less<path_resolver_node>);
+
+  std::size_t const first = r.edges.size();
+  for (std::size_t i = 0; i < children.size(); ++i) {
+    compiled_edge e;
+    e.offset = r.literals.size();
+    e.length = children[i]->data.size();
+    e.child = -1;
+    r.literals += children[i]->data;
+    r.edges.push_back(e);
+  }
+
+  for (std::size_t i = 0; i < children.size(); ++i) {
+    int child = compile_node(r, *children[i], owner, roots);
+    r.edges[first + i].child = child;
+  }
+
+  if (node.unconditional_child) {
+    int child = compile_node(r, *node.unconditional_child, owner, roots);
+    r.nodes[index].closure = child;
+  }
+
+  if (node.context_) {
+    int next = compile_context(r, node.context_, roots);
+    r.nodes[index].next = next;
+  }
+
+  return index;
+}
+
+void context::compile() {
+  boost::scoped_ptr<impl::compiled_router> r(new impl::compiled_router);
+  impl::compiled_roots roots;
+  impl::compile_context(*r, this, roots);
+  r->generation = bind_generation;
+  p->router.swap(r);
+}
+
 void context::attach(server &srv) {
   p->root.attach(srv);
+  compile();
 }
 
 // Local Variables: **
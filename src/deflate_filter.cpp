@@ -0,0 +1,95 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/deflate_filter.hpp"
+#include <zlib.h>
+#include <cstring>
+#include <new>
+
+using rest::utils::deflate_filter;
+
+class deflate_filter::impl {
+public:
+  impl(format fmt, int level, int window_bits, int mem_level)
+    : fmt(fmt),
+      level(level < 0 ? Z_DEFAULT_COMPRESSION : level),
+      // zlib refuses a window of 2^8 for raw streams
+      window_bits(window_bits < 0 ? MAX_WBITS : window_bits < 9 ? 9 : window_bits),
+      mem_level(mem_level < 0 ? 8 : mem_level),
+      initialized(false)
+  {
+    std::memset(&stream, 0, sizeof(stream));
+  }
+
+  ~impl() {
+    end();
+  }
+
+  void init() {
+    int bits = window_bits;
+    switch (fmt) {
+    case RAW: bits = -bits; break;
+    case GZIP: bits += 16; break;
+    case ZLIB: break;
+    }
+    if (deflateInit2(&stream, level, Z_DEFLATED, bits, mem_level,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      throw std::bad_alloc();
+    initialized = true;
+  }
+
+  void end() {
+    if (initialized)
+      deflateEnd(&stream);
+    initialized = false;
+  }
+
+  format fmt;
+  int level;
+  int window_bits;
+  int mem_level;
+
+  bool initialized;
+  z_stream stream;
+  char buffer[4096];
+};
+
+deflate_filter::deflate_filter(
+    format fmt, int level, int window_bits, int mem_level,
+    std::size_t flush_size)
+  : flush_size(flush_size),
+    pending(0),
+    p(new impl(fmt, level, window_bits, mem_level))
+{}
+
+bool deflate_filter::deflate(
+    char const *&in, std::size_t &in_len,
+    char *&out, std::size_t &out_len, mode m)
+{
+  if (!p->initialized)
+    p->init();
+
+  z_stream &z = p->stream;
+  z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+  z.avail_in = uInt(in_len);
+  z.next_out = reinterpret_cast<Bytef *>(p->buffer);
+  z.avail_out = sizeof(p->buffer);
+
+  int flush = m == FINISH ? Z_FINISH : m == SYNC ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+  int ret = ::deflate(&z, flush);
+
+  in = reinterpret_cast<char const *>(z.next_in);
+  in_len = z.avail_in;
+  out = p->buffer;
+  out_len = sizeof(p->buffer) - z.avail_out;
+
+  if (ret == Z_STREAM_END)
+    return true;
+  if (ret != Z_OK && ret != Z_BUF_ERROR)
+    throw std::ios_base::failure("deflate error");
+  // zlib may still hold output if it filled the whole buffer
+  return in_len == 0 && z.avail_out != 0 && m != FINISH;
+}
+
+void deflate_filter::reset() {
+  p->end();
+  pending = 0;
+}
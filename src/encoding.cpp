@@ -1,8 +1,36 @@
 // vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
 #include <rest/encoding.hpp>
 #include <rest/encodings/identity.hpp>
+#include <rest/config.hpp>
 
 using rest::encoding;
+using rest::compression;
+
+void compression::merge(compression const &defaults) {
+  if (level < 0)
+    level = defaults.level;
+  if (window_bits < 0)
+    window_bits = defaults.window_bits;
+  if (mem_level < 0)
+    mem_level = defaults.mem_level;
+  if (flush_size < 0)
+    flush_size = defaults.flush_size;
+}
+
+compression const &compression::configured() {
+  static compression x;
+  static bool loaded = false;
+  if (!loaded) {
+    utils::property_tree &tree = config::get().tree();
+    x.level = utils::get(tree, -1, "general", "compression", "level");
+    x.window_bits =
+      utils::get(tree, -1, "general", "compression", "window_bits");
+    x.mem_level = utils::get(tree, -1, "general", "compression", "mem_level");
+    x.flush_size = utils::get(tree, 0, "general", "compression", "flush_size");
+    loaded = true;
+  }
+  return x;
+}
 
 std::string const &encoding::type_name() {
   static std::string x("encoding");
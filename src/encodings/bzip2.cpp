@@ -20,5 +20,13 @@ void bzip2::add_reader(input_chain &x) {
 }
 
 void bzip2::add_writer(output_chain &x) {
-  x.push(io::bzip2_compressor());
+  add_writer(x, compression::configured());
+}
+
+// the level selects the block size, bzip2 cannot flush early
+void bzip2::add_writer(output_chain &x, compression const &c) {
+  int block_size = io::bzip2::default_block_size;
+  if (c.level > 0)
+    block_size = c.level;
+  x.push(io::bzip2_compressor(io::bzip2_params(block_size)));
 }
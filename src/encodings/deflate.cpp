@@ -1,5 +1,6 @@
 // vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
 #include <rest/encodings/deflate.hpp>
+#include <rest/utils/deflate_filter.hpp>
 #include <boost/iostreams/filter/zlib.hpp>
 
 using rest::encodings::deflate;
@@ -26,7 +27,10 @@ void deflate::add_reader(input_chain &x) {
 }
 
 void deflate::add_writer(output_chain &x) {
-  io::zlib_params z;
-  z.noheader = true;
-  x.push(io::zlib_compressor(z));
+  add_writer(x, compression::configured());
+}
+
+void deflate::add_writer(output_chain &x, compression const &c) {
+  x.push(utils::deflate_filter(utils::deflate_filter::RAW,
+    c.level, c.window_bits, c.mem_level, c.flush_size < 0 ? 0 : c.flush_size));
 }
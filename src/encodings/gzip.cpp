@@ -1,5 +1,6 @@
 // vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
 #include <rest/encodings/gzip.hpp>
+#include <rest/utils/deflate_filter.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 
 using rest::encodings::gzip;
@@ -20,5 +21,10 @@ void gzip::add_reader(input_chain &x) {
 }
 
 void gzip::add_writer(output_chain &x) {
-  x.push(io::gzip_compressor());
+  add_writer(x, compression::configured());
+}
+
+void gzip::add_writer(output_chain &x, compression const &c) {
+  x.push(utils::deflate_filter(utils::deflate_filter::GZIP,
+    c.level, c.window_bits, c.mem_level, c.flush_size < 0 ? 0 : c.flush_size));
 }
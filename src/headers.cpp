@@ -1,6 +1,7 @@
 // vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
 #include <rest/headers.hpp>
 #include <rest/utils/http.hpp>
+#include <rest/utils/request_parser.hpp>
 #include <rest/utils/string.hpp>
 #include <rest/config.hpp>
 #include <boost/none.hpp>
@@ -17,6 +18,88 @@ public:
           header_map;
 
   header_map data;
+
+  // request head and its fields not moved into `data' yet
+  std::string raw;
+  std::vector<utils::http::header_field> raw_fields;
+
+  bool find_raw(std::string const &name, std::string &value) const {
+    bool found = false;
+    for (std::vector<utils::http::header_field>::const_iterator it =
+          raw_fields.begin();
+        it != raw_fields.end();
+        ++it)
+    {
+      if (it->name.length != name.size())
+        continue;
+      char const *field_name = raw.data() + it->name.offset;
+      if (!std::equal(name.begin(), name.end(), field_name,
+            utils::string_iequals()))
+        continue;
+      if (!value.empty())
+        value += ", ";
+      if (it->folded) {
+        value += utils::http::field_value(raw.data(), *it);
+      } else {
+        // field_value without the temporary
+        char const *begin = raw.data() + it->value.offset;
+        char const *end = begin + it->value.length;
+        while (end != begin && utils::http::isspht(end[-1]))
+          --end;
+        value.append(begin, end);
+      }
+      found = true;
+    }
+    return found;
+  }
+
+  bool same_name(std::size_t i, std::size_t j) const {
+    utils::http::span const &a = raw_fields[i].name;
+    utils::http::span const &b = raw_fields[j].name;
+    return a.length == b.length
+      && std::equal(raw.data() + a.offset, raw.data() + a.offset + a.length,
+                    raw.data() + b.offset, utils::string_iequals());
+  }
+
+  // enumerates like the materialized fields, without building the map
+  void for_each_raw(header_callback const &cb) const {
+    for (std::size_t i = 0; i < raw_fields.size(); ++i) {
+      std::size_t j = 0;
+      while (j < i && !same_name(i, j))
+        ++j;
+      if (j < i)
+        continue; // merged into the first occurrence
+
+      std::string name = raw_fields[i].name.str(raw.data());
+      boost::algorithm::to_lower(name);
+
+      std::string value;
+      find_raw(name, value);
+      cb(name, value);
+    }
+  }
+
+  void materialize() {
+    if (raw_fields.empty())
+      return;
+
+    for (std::vector<utils::http::header_field>::const_iterator it =
+          raw_fields.begin();
+        it != raw_fields.end();
+        ++it)
+    {
+      std::string name = it->name.str(raw.data());
+      boost::algorithm::to_lower(name);
+
+      std::string &value = data[name];
+      if (!value.empty())
+        value += ", ";
+      value += utils::http::field_value(raw.data(), *it);
+    }
+
+    std::vector<utils::http::header_field>().swap(raw_fields);
+    std::string().swap(raw);
+  }
 };
 
 headers::headers() : p(new impl) {
@@ -41,10 +124,26 @@ void headers::read_headers(std::streambuf &buf) {
   std::size_t count =
     utils::get(tree, 64, "general", "limits", "max_header_count");
 
+  p->materialize();
   utils::http::read_headers(buf, p->data, max_name, max_value, count);
 }
 
+void headers::read_headers(
+    char const *data, utils::http::request_parser const &parser)
+{
+  p->materialize();
+  p->raw.assign(data, parser.consumed());
+  p->raw_fields = parser.fields();
+}
+
 boost::optional<std::string> headers::get_header(std::string const &name) const{
+  if (!p->raw_fields.empty()) {
+    std::string value;
+    if (p->find_raw(name, value))
+      return value;
+    return boost::none;
+  }
+
   impl::header_map::iterator it = p->data.find(name);
   if (it == p->data.end())
     return boost::none;
@@ -53,6 +152,13 @@ boost::optional<std::string> headers::get_header(std::string const &name) const{
 }
 
 std::string headers::get_header(std::string const &n, std::string const &d)const{
+  if (!p->raw_fields.empty()) {
+    std::string value;
+    if (p->find_raw(n, value))
+      return value;
+    return d;
+  }
+
   impl::header_map::iterator it = p->data.find(n);
   if (it == p->data.end())
     return d;
@@ -60,11 +166,29 @@ std::string headers::get_header(std::string const &n, std::string const &d)const
     return it->second;
 }
 
+bool headers::find_header(std::string const &n, std::string &value) const {
+  value.clear();
+  if (!p->raw_fields.empty())
+    return p->find_raw(n, value);
+
+  impl::header_map::iterator it = p->data.find(n);
+  if (it == p->data.end())
+    return false;
+  value.assign(it->second);
+  return true;
+}
+
 void headers::erase_header(std::string const &name) {
+  p->materialize();
   p->data.erase(name);
 }
 
 void headers::for_each_header(header_callback const &cb) const {
+  if (!p->raw_fields.empty()) {
+    p->for_each_raw(cb);
+    return;
+  }
+
   for (impl::header_map::iterator it = p->data.begin();
       it != p->data.end();
       ++it)
@@ -72,12 +196,14 @@ void headers::for_each_header(header_callback const &cb) const {
 }
 
 void headers::set_header(std::string const &name, std::string const &value) {
+  p->materialize();
   p->data[name] = value;
 }
 
 void headers::add_header_part(
     std::string const &name, std::string const &value, bool special_asterisk)
 {
+  p->materialize();
   impl::header_map::iterator it = p->data.find(name);
   if (it == p->data.end() || it->second.empty()) {
     set_header(name, value);
@@ -88,11 +214,16 @@ void headers::add_header_part(
 }
 
 void headers::write_headers(std::streambuf &out) const {
+  p->materialize();
   for (impl::header_map::const_iterator it = p->data.begin();
       it != p->data.end();
       ++it)
-    if (!it->second.empty())
-      utils::write_string(out, it->first + ": " + it->second + "\r\n");
+    if (!it->second.empty()) {
+      utils::write_string(out, it->first);
+      out.sputn(": ", 2);
+      utils::write_string(out, it->second);
+      out.sputn("\r\n", 2);
+    }
 }
 
 
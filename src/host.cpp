@@ -10,6 +10,8 @@
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/key_extractors.hpp>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
 
 using namespace rest;
 
@@ -26,6 +28,8 @@ public:
 
   boost::function<void (response &)> response_preparer;
 
+  rest::compression compression;
+
   impl(std::string const &name) : name(name) {}
 
   ~impl() {
@@ -85,6 +89,14 @@ void host::set_response_preparer(boost::function<void (response &)> const &f) {
 void host::prepare_response(response &r) const {
   if (p->response_preparer)
     p->response_preparer(r);
+
+  compression c(r.get_compression());
+  c.merge(p->compression);
+  r.set_compression(c);
+}
+
+void host::set_compression(compression const &c) {
+  p->compression = c;
 }
 
 typedef
@@ -98,44 +110,149 @@ typedef
   >
   hosts_cont_t;
 
+namespace {
+  // host names are compared in ASCII lowercase
+  inline char fold(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+  }
+
+  // FNV-1a over the characters from the last to the first, so the hashes of
+  // all suffixes of a name come out of one pass over it
+  std::size_t const HASH_SEED = 2166136261u;
+
+  inline std::size_t hash_step(std::size_t h, char c) {
+    return (h ^ (unsigned char) fold(c)) * 16777619u;
+  }
+
+  std::size_t const MAX_LABELS = 128; // more than DNS names can have
+}
+
 class host_container::impl {
 public:
   hosts_cont_t hosts;
+
+  // The host names lowercased, with "*." and a trailing dot removed, in an
+  // open addressing table at most half full. A host named "example.com"
+  // also serves the names below it unless there is one for "*.example.com",
+  // which only serves those; "" serves everything else.
+  struct slot {
+    std::size_t hash;
+    std::string name;
+    host *exact;
+    host *wildcard;
+
+    slot() : hash(0), exact(0), wildcard(0) {}
+
+    bool used() const { return exact || wildcard; }
+  };
+
+  std::vector<slot> table;
+
+  void rebuild() {
+    std::size_t size = 8;
+    while (size < 2 * hosts.size())
+      size *= 2;
+    std::vector<slot>(size).swap(table);
+
+    for (hosts_cont_t::iterator it = hosts.begin(); it != hosts.end(); ++it) {
+      std::string name = it->get().get_host();
+      bool const wildcard = name == "*" || name.compare(0, 2, "*.") == 0;
+      name.erase(0, wildcard ? std::min(name.size(), std::size_t(2)) : 0);
+      if (!name.empty() && name[name.size() - 1] == '.')
+        name.erase(name.size() - 1);
+      std::transform(name.begin(), name.end(), name.begin(), fold);
+
+      std::size_t h = HASH_SEED;
+      for (std::size_t i = name.size(); i-- > 0;)
+        h = hash_step(h, name[i]);
+
+      std::size_t i = find(name.data(), name.size(), h);
+      if (i == table.size()) {
+        for (i = h & (table.size() - 1); table[i].used();)
+          i = (i + 1) & (table.size() - 1);
+        table[i].hash = h;
+        table[i].name = name;
+      }
+      host *&target = wildcard ? table[i].wildcard : table[i].exact;
+      if (target)
+        throw std::logic_error("cannot serve two hosts with same name");
+      target = &it->get();
+    }
+  }
+
+  // the index of the slot for `name' with hash `h', table.size() if none
+  std::size_t find(char const *name, std::size_t length, std::size_t h) const {
+    std::size_t const mask = table.size() - 1;
+    for (std::size_t i = h & mask; table[i].used(); i = (i + 1) & mask) {
+      slot const &x = table[i];
+      if (x.hash != h || x.name.size() != length)
+        continue;
+      std::size_t j = 0;
+      while (j < length && fold(name[j]) == x.name[j])
+        ++j;
+      if (j == length)
+        return i;
+    }
+    return table.size();
+  }
 };
 
-host_container::host_container() : p(new impl) {}
+host_container::host_container() : p(new impl) {
+  p->rebuild();
+}
+
 host_container::~host_container() {}
 
 void host_container::add_host(host &h) {
   if (!p->hosts.insert(boost::ref(h)).second)
     throw std::logic_error("cannot serve two hosts with same name");
+  try {
+    p->rebuild();
+  } catch (...) {
+    p->hosts.erase(h.get_host());
+    p->rebuild();
+    throw;
+  }
 }
 
-host const *host_container::get_host(std::string const &name) const {
-  std::string::const_iterator begin = name.begin();
-  std::string::const_iterator end = name.end();
-  std::string::const_iterator delim = std::find(begin, end, ':');
-
-  std::string the_host(begin, delim);
+host const *host_container::get_host(std::string const &header) const {
+  // the name without port, "[...]" for IPv6 addresses
+  char const *name = header.data();
+  std::size_t length = header.size();
+  bool const literal = length > 0 && name[0] == '[';
+  char const *delim = static_cast<char const *>(
+    std::memchr(name, literal ? ']' : ':', length));
+  if (delim)
+    length = delim - name + literal;
+  if (length > 0 && name[length - 1] == '.')
+    --length;
 
-  hosts_cont_t::const_iterator it = p->hosts.find(the_host);
-  while(it == p->hosts.end() &&
-        !the_host.empty())
-  {
-    std::string::const_iterator begin = the_host.begin();
-    std::string::const_iterator end = the_host.end();
-    std::string::const_iterator delim = std::find(begin, end, '.');
-
-    if (delim == end)
-      the_host.clear();
-    else
-      the_host.assign(++delim, end);
+  // the suffixes of the name at label boundaries, shortest first
+  std::size_t starts[MAX_LABELS + 1];
+  std::size_t hashes[MAX_LABELS + 1];
+  std::size_t n = 0;
+  std::size_t h = HASH_SEED;
+  starts[n] = length;
+  hashes[n++] = h;
+  for (std::size_t i = length; i-- > 0 && n <= MAX_LABELS;) {
+    h = hash_step(h, name[i]);
+    if (i == 0 || name[i - 1] == '.') {
+      starts[n] = i;
+      hashes[n++] = h;
+    }
+  }
 
-    it = p->hosts.find(the_host);
+  while (n-- > 0) {
+    std::size_t i = p->find(name + starts[n], length - starts[n], hashes[n]);
+    if (i == p->table.size())
+      continue;
+    impl::slot const &x = p->table[i];
+    if (starts[n] > 0 && x.wildcard)
+      return x.wildcard;
+    if (x.exact)
+      return x.exact;
   }
-  if(it == p->hosts.end())
-    return 0x0;
-  return it->get_pointer();
+  return 0;
 }
 
 void host_container::attach(server &srv) {
@@ -0,0 +1,461 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/hpack.hpp"
+#include <boost/cstdint.hpp>
+#include <deque>
+
+namespace hpack = rest::utils::hpack;
+using hpack::header;
+using hpack::header_list;
+
+namespace {
+  // RFC 7541, appendix A
+  char const * const STATIC_TABLE[][2] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+  };
+
+  std::size_t const STATIC_SIZE =
+    sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+  // RFC 7541, appendix B: code and length in bits of every byte and EOS
+  struct huffman_code {
+    boost::uint32_t code;
+    unsigned char bits;
+  };
+
+  huffman_code const HUFFMAN[257] = {
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+    { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+    { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+    { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+    { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+    { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+    { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+    { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+    { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+    { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+    { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+    { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+    { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+    { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+    { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+    { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+    { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+    { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+    { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+    { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+    { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+    { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+    { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+    { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+    { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+    { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+    { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+    { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+    { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+    { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+    { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+    { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+    { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+    { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+    { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+    { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+    { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+    { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+    { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+    { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+    { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+    { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+    { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+    { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+    { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+    { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+    { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+    { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+    { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+    { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+    { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+    { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+    { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+    { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+    { 0x3fffffff, 30 }
+  };
+
+  int const EOS = 256;
+  int const MAX_BITS = 30;
+
+  // canonical decoding: the codes of each length are consecutive in the
+  // order of their symbols
+  class huffman_decoding {
+  public:
+    huffman_decoding() {
+      for (int bits = 0; bits <= MAX_BITS; ++bits)
+        count[bits] = 0;
+      for (int sym = 0; sym <= EOS; ++sym)
+        ++count[HUFFMAN[sym].bits];
+
+      int index[MAX_BITS + 2];
+      index[0] = 0;
+      count[0] = 0;
+      boost::uint32_t code = 0;
+      for (int bits = 1; bits <= MAX_BITS; ++bits) {
+        code = (code + count[bits - 1]) << 1;
+        first[bits] = code;
+        index[bits] = index[bits - 1] + count[bits - 1];
+        offset[bits] = index[bits];
+      }
+      for (int sym = 0; sym <= EOS; ++sym)
+        symbols[index[HUFFMAN[sym].bits]++] = sym;
+    }
+
+    // the symbol of `code' if it is a code of `bits' bits, -1 otherwise
+    int symbol(boost::uint32_t code, int bits) const {
+      if (code - first[bits] < boost::uint32_t(count[bits]))
+        return symbols[offset[bits] + code - first[bits]];
+      return -1;
+    }
+
+  private:
+    int count[MAX_BITS + 1];
+    boost::uint32_t first[MAX_BITS + 1];
+    int offset[MAX_BITS + 1];
+    int symbols[EOS + 1];
+  };
+
+  huffman_decoding const &decoding() {
+    static huffman_decoding x;
+    return x;
+  }
+
+  std::size_t entry_size(header const &h) {
+    return h.first.size() + h.second.size() + 32;
+  }
+
+  // integers with an n-bit prefix (RFC 7541, 5.1)
+  boost::uint32_t read_integer(
+      unsigned char const *&it, unsigned char const *end, int prefix)
+  {
+    if (it == end)
+      throw hpack::error("truncated integer");
+    boost::uint32_t const mask = (1 << prefix) - 1;
+    boost::uint32_t value = *it++ & mask;
+    if (value < mask)
+      return value;
+    for (int shift = 0; ; shift += 7) {
+      if (it == end)
+        throw hpack::error("truncated integer");
+      if (shift > 21)
+        throw hpack::error("integer too large");
+      unsigned char c = *it++;
+      value += boost::uint32_t(c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return value;
+    }
+  }
+
+  void write_integer(
+      std::string &out, unsigned char first, int prefix, boost::uint32_t value)
+  {
+    boost::uint32_t const mask = (1 << prefix) - 1;
+    if (value < mask) {
+      out += char(first | value);
+      return;
+    }
+    out += char(first | mask);
+    value -= mask;
+    while (value >= 0x80) {
+      out += char((value & 0x7f) | 0x80);
+      value >>= 7;
+    }
+    out += char(value);
+  }
+
+  std::string read_string(unsigned char const *&it, unsigned char const *end) {
+    if (it == end)
+      throw hpack::error("truncated string");
+    bool const huffman = *it & 0x80;
+    boost::uint32_t length = read_integer(it, end, 7);
+    if (boost::uint32_t(end - it) < length)
+      throw hpack::error("truncated string");
+    std::string out;
+    if (huffman)
+      hpack::huffman_decode(reinterpret_cast<char const *>(it), length, out);
+    else
+      out.assign(reinterpret_cast<char const *>(it), length);
+    it += length;
+    return out;
+  }
+
+  void write_string(std::string &out, std::string const &s) {
+    std::size_t const huffman = hpack::huffman_length(s);
+    if (huffman < s.size()) {
+      write_integer(out, 0x80, 7, huffman);
+      hpack::huffman_encode(s, out);
+    } else {
+      write_integer(out, 0, 7, s.size());
+      out += s;
+    }
+  }
+}
+
+std::size_t hpack::huffman_length(std::string const &in) {
+  std::size_t bits = 0;
+  for (std::string::const_iterator it = in.begin(); it != in.end(); ++it)
+    bits += HUFFMAN[static_cast<unsigned char>(*it)].bits;
+  return (bits + 7) / 8;
+}
+
+void hpack::huffman_encode(std::string const &in, std::string &out) {
+  boost::uint64_t acc = 0;
+  int bits = 0;
+  for (std::string::const_iterator it = in.begin(); it != in.end(); ++it) {
+    huffman_code const &c = HUFFMAN[static_cast<unsigned char>(*it)];
+    acc = (acc << c.bits) | c.code;
+    bits += c.bits;
+    while (bits >= 8) {
+      bits -= 8;
+      out += char(acc >> bits);
+    }
+  }
+  // padded with the most significant bits of EOS
+  if (bits > 0)
+    out += char((acc << (8 - bits)) | (0xff >> bits));
+}
+
+void hpack::huffman_decode(
+    char const *data, std::size_t length, std::string &out)
+{
+  huffman_decoding const &d = decoding();
+  boost::uint32_t code = 0;
+  int bits = 0;
+  bool ones = true; // the pending bits are all set (EOS padding)
+
+  for (std::size_t i = 0; i < length; ++i) {
+    unsigned char const c = data[i];
+    for (int b = 7; b >= 0; --b) {
+      int const bit = (c >> b) & 1;
+      code = (code << 1) | bit;
+      ones = ones && bit;
+      ++bits;
+      int const sym = d.symbol(code, bits);
+      if (sym == EOS)
+        throw error("EOS in huffman string");
+      if (sym >= 0) {
+        out += char(sym);
+        code = 0;
+        bits = 0;
+        ones = true;
+      } else if (bits >= MAX_BITS) {
+        throw error("invalid huffman code");
+      }
+    }
+  }
+
+  if (bits > 7 || !ones)
+    throw error("invalid huffman padding");
+}
+
+class hpack::decoder::impl {
+public:
+  impl(std::size_t max_table_size, std::size_t max_list_size)
+    : max_settings(max_table_size),
+      max_size(max_table_size),
+      size(0),
+      max_list_size(max_list_size)
+  {}
+
+  std::size_t const max_settings;
+  std::size_t max_size;
+  std::size_t size;
+  std::size_t const max_list_size;
+  std::deque<header> table; // newest first
+
+  header lookup(boost::uint32_t index) const {
+    if (index == 0)
+      throw error("index 0");
+    if (index <= STATIC_SIZE)
+      return header(STATIC_TABLE[index - 1][0], STATIC_TABLE[index - 1][1]);
+    index -= STATIC_SIZE + 1;
+    if (index >= table.size())
+      throw error("index beyond the table");
+    return table[index];
+  }
+
+  void evict() {
+    while (size > max_size) {
+      size -= entry_size(table.back());
+      table.pop_back();
+    }
+  }
+
+  void add(header const &h) {
+    std::size_t const s = entry_size(h);
+    if (s > max_size) {
+      // empties the table
+      table.clear();
+      size = 0;
+      return;
+    }
+    size += s;
+    table.push_front(h);
+    evict();
+  }
+};
+
+hpack::decoder::decoder(std::size_t max_table_size, std::size_t max_list_size)
+  : p(new impl(max_table_size, max_list_size))
+{}
+
+hpack::decoder::~decoder() {}
+
+std::size_t hpack::decoder::table_size() const {
+  return p->size;
+}
+
+void hpack::decoder::decode(
+    char const *data, std::size_t length, header_list &out)
+{
+  unsigned char const *it = reinterpret_cast<unsigned char const *>(data);
+  unsigned char const *end = it + length;
+  std::size_t list_size = 0;
+  bool headers_seen = false;
+
+  while (it != end) {
+    unsigned char const c = *it;
+    header h;
+
+    if (c & 0x80) {
+      // indexed
+      h = p->lookup(read_integer(it, end, 7));
+    } else if ((c & 0xe0) == 0x20) {
+      // dynamic table size update, only at the start of a block
+      if (headers_seen)
+        throw error("table size update after headers");
+      boost::uint32_t size = read_integer(it, end, 5);
+      if (size > p->max_settings)
+        throw error("table size above the limit");
+      p->max_size = size;
+      p->evict();
+      continue;
+    } else {
+      // literal: with incremental indexing (01), without indexing (0000) or
+      // never indexed (0001)
+      bool const indexing = (c & 0xc0) == 0x40;
+      boost::uint32_t index = read_integer(it, end, indexing ? 6 : 4);
+      if (index)
+        h.first = p->lookup(index).first;
+      else
+        h.first = read_string(it, end);
+      h.second = read_string(it, end);
+      if (indexing)
+        p->add(h);
+    }
+
+    headers_seen = true;
+    list_size += entry_size(h);
+    if (list_size > p->max_list_size)
+      throw error("header list too large");
+    out.push_back(h);
+  }
+}
+
+hpack::encoder::encoder() {}
+
+hpack::encoder::~encoder() {}
+
+void hpack::encoder::encode(header_list const &headers, std::string &out) {
+  for (header_list::const_iterator it = headers.begin();
+      it != headers.end();
+      ++it)
+  {
+    std::size_t name_index = 0;
+    std::size_t index = 0;
+    for (std::size_t i = 0; i < STATIC_SIZE && !index; ++i) {
+      if (it->first != STATIC_TABLE[i][0])
+        continue;
+      if (!name_index)
+        name_index = i + 1;
+      if (it->second == STATIC_TABLE[i][1])
+        index = i + 1;
+    }
+
+    if (index) {
+      write_integer(out, 0x80, 7, index);
+    } else {
+      // literal without indexing
+      write_integer(out, 0, 4, name_index);
+      if (!name_index)
+        write_string(out, it->first);
+      write_string(out, it->second);
+    }
+  }
+}
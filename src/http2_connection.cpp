@@ -0,0 +1,1167 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/http2_connection.hpp"
+#include "rest/http_connection.hpp"
+#include "rest/config.hpp"
+#include "rest/logger.hpp"
+#include "rest/headers.hpp"
+#include "rest/utils/hpack.hpp"
+#include "rest/utils/input_buffer.hpp"
+#include "rest/utils/socket_device.hpp"
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+using namespace rest;
+namespace hpack = rest::utils::hpack;
+namespace algo = boost::algorithm;
+namespace io = boost::iostreams;
+
+namespace {
+  char const PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+  std::size_t const PREFACE_SIZE = sizeof(PREFACE) - 1;
+
+  enum frame_type {
+    DATA_FRAME,
+    HEADERS_FRAME,
+    PRIORITY_FRAME,
+    RST_STREAM_FRAME,
+    SETTINGS_FRAME,
+    PUSH_PROMISE_FRAME,
+    PING_FRAME,
+    GOAWAY_FRAME,
+    WINDOW_UPDATE_FRAME,
+    CONTINUATION_FRAME
+  };
+
+  enum frame_flags {
+    END_STREAM = 0x1,
+    ACK = 0x1,
+    END_HEADERS = 0x4,
+    PADDED = 0x8,
+    PRIORITY = 0x20
+  };
+
+  enum error_code {
+    NO_ERROR,
+    PROTOCOL_ERROR,
+    INTERNAL_ERROR,
+    FLOW_CONTROL_ERROR,
+    SETTINGS_TIMEOUT,
+    STREAM_CLOSED,
+    FRAME_SIZE_ERROR,
+    REFUSED_STREAM,
+    CANCEL,
+    COMPRESSION_ERROR,
+    CONNECT_ERROR,
+    ENHANCE_YOUR_CALM
+  };
+
+  enum setting {
+    HEADER_TABLE_SIZE = 1,
+    ENABLE_PUSH,
+    MAX_CONCURRENT_STREAMS,
+    INITIAL_WINDOW_SIZE,
+    MAX_FRAME_SIZE,
+    MAX_HEADER_LIST_SIZE
+  };
+
+  std::size_t const FRAME_HEADER_SIZE = 9;
+  // the frame size we accept, the default of SETTINGS_MAX_FRAME_SIZE
+  std::size_t const MAX_FRAME = 16384;
+  boost::int64_t const DEFAULT_WINDOW = 65535;
+  boost::int64_t const MAX_WINDOW = 0x7fffffff;
+  std::size_t const MAX_HEADER_LIST = 65536;
+  // output is written once this much is collected
+  std::size_t const FLUSH_SIZE = 65536;
+
+  // the connection fails with GOAWAY, a stream with RST_STREAM
+  struct connection_error {
+    connection_error(boost::uint32_t code) : code(code) {}
+    boost::uint32_t code;
+  };
+
+  struct stream_error {
+    stream_error(boost::uint32_t code) : code(code) {}
+    boost::uint32_t code;
+  };
+
+  // the client went away
+  struct connection_closed {};
+
+  boost::uint32_t read32(unsigned char const *p) {
+    return (boost::uint32_t(p[0]) << 24) | (boost::uint32_t(p[1]) << 16)
+      | (boost::uint32_t(p[2]) << 8) | boost::uint32_t(p[3]);
+  }
+
+  void write32(std::string &out, boost::uint32_t x) {
+    out += char(x >> 24);
+    out += char(x >> 16);
+    out += char(x >> 8);
+    out += char(x);
+  }
+
+  void frame_header(std::string &out, int type, int flags,
+                    boost::uint32_t id, std::size_t length)
+  {
+    out += char(length >> 16);
+    out += char(length >> 8);
+    out += char(length);
+    out += char(type);
+    out += char(flags);
+    write32(out, id);
+  }
+
+  void frame(std::string &out, int type, int flags, boost::uint32_t id,
+             char const *payload, std::size_t length)
+  {
+    frame_header(out, type, flags, id, length);
+    out.append(payload, length);
+  }
+
+  void frame(std::string &out, int type, int flags, boost::uint32_t id,
+             std::string const &payload = std::string())
+  {
+    frame(out, type, flags, id, payload.data(), payload.size());
+  }
+
+  struct stream {
+    stream()
+      : remote_closed(false), served(false), too_large(false),
+        headers_sent(false), end_sent(false), enc(0), memory(0),
+        memory_left(0), file(-1), file_offset(0), file_left(0),
+        buffer_sent(0), producing(false), send_window(DEFAULT_WINDOW),
+        parent(0), weight(16), bytes_sent(0)
+    {}
+
+    // the request
+    hpack::header_list headers;
+    std::string body;
+    bool remote_closed; // END_STREAM received
+    bool served;
+    bool too_large;
+
+    // the response
+    hpack::header_list response_headers;
+    bool headers_sent;
+    bool end_sent;
+
+    // The entity goes out straight from the response as the windows allow:
+    // from its string, from its file, or else from `buffer', which
+    // print_entity() fills while it runs (`producing').
+    boost::shared_ptr<response> resp;
+    encoding *enc;
+    char const *memory;
+    std::size_t memory_left;
+    int file;
+    boost::int64_t file_offset;
+    boost::int64_t file_left;
+    std::string buffer;
+    std::size_t buffer_sent;
+    bool producing;
+
+    boost::int64_t send_window;
+
+    // priority
+    boost::uint32_t parent;
+    unsigned weight;
+    boost::uint64_t bytes_sent;
+
+    // entity bytes there to be sent
+    boost::uint64_t ready() const {
+      return memory_left + boost::uint64_t(file_left)
+        + (buffer.size() - buffer_sent);
+    }
+
+    bool pending() const {
+      return headers_sent && ready() > 0;
+    }
+  };
+
+  typedef std::map<boost::uint32_t, stream> stream_map;
+
+  bool connection_specific(std::string const &name) {
+    return name == "connection" || name == "keep-alive"
+      || name == "proxy-connection" || name == "transfer-encoding"
+      || name == "upgrade";
+  }
+
+  bool valid_name(std::string const &name) {
+    if (name.empty())
+      return false;
+    for (std::string::size_type i = 0; i < name.size(); ++i) {
+      unsigned char c = name[i];
+      if (c <= 0x20 || c >= 0x7f || (c >= 'A' && c <= 'Z'))
+        return false;
+      if (c == ':' && i > 0)
+        return false;
+    }
+    return true;
+  }
+
+  bool valid_value(std::string const &value) {
+    return value.find_first_of(std::string("\r\n\0", 3)) == std::string::npos;
+  }
+}
+
+class http2_connection::impl {
+public:
+  impl(
+      host_container const &hosts,
+      network::address const &addr,
+      std::string const &servername,
+      logger *log
+  )
+    : log(log),
+      servername(servername),
+      http1(hosts, addr, servername, log),
+      conn(0),
+      socket(0),
+      decoder(4096, MAX_HEADER_LIST),
+      last_stream(0),
+      continuation(0),
+      continuation_end_stream(false),
+      continuation_error(0),
+      producing(0),
+      failure(-1),
+      closed(false),
+      settings_seen(false),
+      goaway(false),
+      send_window(DEFAULT_WINDOW),
+      initial_window(DEFAULT_WINDOW),
+      max_frame(MAX_FRAME),
+      max_streams(utils::get(config::get().tree(), std::size_t(100),
+                             "general", "http2", "max_concurrent_streams")),
+      max_entity(utils::get(config::get().tree(), std::size_t(1048576),
+                            "general", "http2", "max_entity_size"))
+  {}
+
+  logger *log;
+  std::string const &servername;
+
+  // serves the requests of all streams
+  http_connection http1;
+
+  utils::input_buffer *conn;
+  std::string out;
+
+  // the plain socket below conn, if any (for sendfile)
+  utils::socket_device *socket;
+
+  hpack::decoder decoder;
+  hpack::encoder encoder;
+
+  stream_map streams;
+  boost::uint32_t last_stream;
+
+  // the header block being continued, and the stream error to raise once
+  // it is decoded
+  boost::uint32_t continuation;
+  std::string header_block;
+  bool continuation_end_stream;
+  boost::uint32_t continuation_error;
+
+  // the stream whose entity print_entity() is writing (frames are read and
+  // sent meanwhile); what ended the connection then, raised once it returns
+  boost::uint32_t producing;
+  long failure;
+  bool closed;
+
+  bool settings_seen;
+  bool goaway;
+
+  boost::int64_t send_window;
+  boost::int64_t initial_window;
+  std::size_t max_frame;
+
+  std::size_t const max_streams;
+  std::size_t const max_entity;
+
+  void serve();
+  void flush();
+
+  bool frame_complete() const;
+  void handle_frame();
+  void handle_data(stream_map::iterator s, int flags,
+                   unsigned char const *payload, std::size_t length);
+  void handle_headers(boost::uint32_t id, int flags,
+                      unsigned char const *payload, std::size_t length);
+  void end_headers(boost::uint32_t id, bool end_stream);
+  boost::uint32_t handle_priority(stream &s, boost::uint32_t id,
+                                  unsigned char const *payload);
+  void handle_settings(int flags, unsigned char const *payload,
+                       std::size_t length);
+  void window_update(boost::uint32_t id, unsigned char const *payload);
+
+  void reset_stream(boost::uint32_t id, boost::uint32_t code);
+
+  void serve_streams();
+  void serve_stream(boost::uint32_t id, stream &s);
+  bool make_request(stream &s, std::string &method, std::string &path,
+                    headers &h);
+  void response_headers(stream &s);
+  void produce(boost::uint32_t id, stream &s);
+  void produced(boost::uint32_t id, char const *data, std::size_t length);
+  void catch_up(boost::uint32_t id);
+  void send_frames();
+  void data_frame(boost::uint32_t id, stream &s, std::size_t length);
+
+  // where print_entity() writes the entity of a stream to
+  class entity_sink {
+  public:
+    typedef char char_type;
+    typedef io::sink_tag category;
+
+    entity_sink(impl *conn, boost::uint32_t id) : conn(conn), id(id) {}
+
+    std::streamsize write(char const *data, std::streamsize length) {
+      conn->produced(id, data, std::size_t(length));
+      return length;
+    }
+
+  private:
+    impl *conn;
+    boost::uint32_t id;
+  };
+};
+
+http2_connection::http2_connection(
+    host_container const &hosts,
+    rest::network::address const &addr,
+    std::string const &servername,
+    logger *log)
+: p(new impl(hosts, addr, servername, log))
+{}
+
+http2_connection::~http2_connection() {}
+
+bool http2_connection::preface(utils::input_buffer &conn) {
+  for (;;) {
+    std::size_t n = std::min(conn.size(), PREFACE_SIZE);
+    if (std::memcmp(conn.data(), PREFACE, n) != 0)
+      return false;
+    if (n == PREFACE_SIZE)
+      return true;
+    if (!conn.fill())
+      return false;
+  }
+}
+
+void http2_connection::serve(
+    utils::input_buffer &conn, utils::socket_device *socket)
+{
+  p->conn = &conn;
+  p->socket = socket;
+  conn.consume(PREFACE_SIZE);
+
+  p->log->log(logger::info, "http2-connection");
+  p->log->flush();
+
+  p->serve();
+}
+
+void http2_connection::impl::serve() {
+  std::string settings;
+  settings += char(0);
+  settings += char(MAX_CONCURRENT_STREAMS);
+  write32(settings, max_streams);
+  settings += char(0);
+  settings += char(MAX_HEADER_LIST_SIZE);
+  write32(settings, MAX_HEADER_LIST);
+  frame(out, SETTINGS_FRAME, 0, 0, settings);
+
+  try {
+    for (;;) {
+      while (frame_complete())
+        handle_frame();
+
+      serve_streams();
+      send_frames();
+      flush();
+
+      if (goaway && streams.empty())
+        break;
+      if (!conn->fill())
+        break;
+    }
+  }
+  catch (connection_closed &) {
+  }
+  catch (connection_error &e) {
+    log->log(logger::notice, "http2-error", e.code);
+    log->flush();
+    std::string payload;
+    write32(payload, last_stream);
+    write32(payload, e.code);
+    frame(out, GOAWAY_FRAME, 0, 0, payload);
+    flush();
+  }
+}
+
+void http2_connection::impl::flush() {
+  if (out.empty())
+    return;
+  conn->sputn(out.data(), out.size());
+  conn->pubsync();
+  out.clear();
+}
+
+bool http2_connection::impl::frame_complete() const {
+  if (conn->size() < FRAME_HEADER_SIZE)
+    return false;
+  unsigned char const *d =
+    reinterpret_cast<unsigned char const *>(conn->data());
+  std::size_t length = (d[0] << 16) | (d[1] << 8) | d[2];
+  if (length > MAX_FRAME)
+    throw connection_error(FRAME_SIZE_ERROR);
+  return conn->size() >= FRAME_HEADER_SIZE + length;
+}
+
+void http2_connection::impl::handle_frame() {
+  unsigned char const *d =
+    reinterpret_cast<unsigned char const *>(conn->data());
+  std::size_t const length = (d[0] << 16) | (d[1] << 8) | d[2];
+  int const type = d[3];
+  int const flags = d[4];
+  boost::uint32_t const id = read32(d + 5) & 0x7fffffff;
+  unsigned char const *payload = d + FRAME_HEADER_SIZE;
+
+  if (!settings_seen && (type != SETTINGS_FRAME || (flags & ACK)))
+    throw connection_error(PROTOCOL_ERROR);
+  settings_seen = true;
+
+  if (continuation && (type != CONTINUATION_FRAME || id != continuation))
+    throw connection_error(PROTOCOL_ERROR);
+
+  stream_map::iterator s = streams.find(id);
+  bool const idle = id > last_stream;
+
+  try {
+    switch (type) {
+    case DATA_FRAME:
+      if (id == 0 || idle)
+        throw connection_error(PROTOCOL_ERROR);
+      handle_data(s, flags, payload, length);
+      break;
+
+    case HEADERS_FRAME:
+      if (id == 0 || id % 2 == 0)
+        throw connection_error(PROTOCOL_ERROR);
+      handle_headers(id, flags, payload, length);
+      break;
+
+    case CONTINUATION_FRAME:
+      if (!continuation)
+        throw connection_error(PROTOCOL_ERROR);
+      header_block.append(reinterpret_cast<char const *>(payload), length);
+      if (header_block.size() > 2 * MAX_HEADER_LIST)
+        throw connection_error(ENHANCE_YOUR_CALM);
+      if (flags & END_HEADERS) {
+        continuation = 0;
+        end_headers(id, continuation_end_stream);
+        if (continuation_error)
+          throw stream_error(continuation_error);
+      }
+      break;
+
+    case PRIORITY_FRAME:
+      if (id == 0)
+        throw connection_error(PROTOCOL_ERROR);
+      if (length != 5)
+        throw stream_error(FRAME_SIZE_ERROR);
+      // streams not open (yet) keep the default
+      if (s != streams.end()) {
+        if (boost::uint32_t code = handle_priority(s->second, id, payload))
+          throw stream_error(code);
+      }
+      break;
+
+    case RST_STREAM_FRAME:
+      if (id == 0 || idle)
+        throw connection_error(PROTOCOL_ERROR);
+      if (length != 4)
+        throw connection_error(FRAME_SIZE_ERROR);
+      if (s != streams.end())
+        streams.erase(s);
+      break;
+
+    case SETTINGS_FRAME:
+      if (id != 0)
+        throw connection_error(PROTOCOL_ERROR);
+      handle_settings(flags, payload, length);
+      break;
+
+    case PUSH_PROMISE_FRAME:
+      throw connection_error(PROTOCOL_ERROR);
+
+    case PING_FRAME:
+      if (id != 0)
+        throw connection_error(PROTOCOL_ERROR);
+      if (length != 8)
+        throw connection_error(FRAME_SIZE_ERROR);
+      if (!(flags & ACK))
+        frame(out, PING_FRAME, ACK, 0,
+              reinterpret_cast<char const *>(payload), length);
+      break;
+
+    case GOAWAY_FRAME:
+      if (id != 0)
+        throw connection_error(PROTOCOL_ERROR);
+      if (length < 8)
+        throw connection_error(FRAME_SIZE_ERROR);
+      goaway = true;
+      break;
+
+    case WINDOW_UPDATE_FRAME:
+      if (length != 4)
+        throw connection_error(FRAME_SIZE_ERROR);
+      if (id != 0 && idle)
+        throw connection_error(PROTOCOL_ERROR);
+      window_update(id, payload);
+      break;
+
+    default:
+      // extensions we do not know are ignored
+      break;
+    }
+  }
+  catch (stream_error &e) {
+    reset_stream(id, e.code);
+  }
+
+  conn->consume(FRAME_HEADER_SIZE + length);
+}
+
+void http2_connection::impl::handle_data(
+    stream_map::iterator s, int flags,
+    unsigned char const *payload, std::size_t length)
+{
+  // the whole frame counts, padding included; what we take is granted again
+  // right away, the entity size is limited separately
+  if (length > 0) {
+    std::string increment;
+    write32(increment, length);
+    frame(out, WINDOW_UPDATE_FRAME, 0, 0, increment);
+    if (s != streams.end() && !s->second.remote_closed &&
+        !(flags & END_STREAM))
+      frame(out, WINDOW_UPDATE_FRAME, 0, s->first, increment);
+  }
+
+  // a stream we closed already (or reset)
+  if (s == streams.end())
+    return;
+
+  stream &st = s->second;
+  if (st.remote_closed)
+    throw stream_error(STREAM_CLOSED);
+
+  std::size_t pad = 0;
+  if (flags & PADDED) {
+    if (length < 1)
+      throw connection_error(PROTOCOL_ERROR);
+    pad = payload[0] + 1;
+    if (pad > length)
+      throw connection_error(PROTOCOL_ERROR);
+  }
+  std::size_t const skip = (flags & PADDED) ? 1 : 0;
+  std::size_t const size = length - pad;
+
+  if (st.body.size() + size > max_entity)
+    st.too_large = true;
+  else if (!st.too_large)
+    st.body.append(reinterpret_cast<char const *>(payload) + skip, size);
+
+  if (flags & END_STREAM)
+    st.remote_closed = true;
+}
+
+void http2_connection::impl::handle_headers(
+    boost::uint32_t id, int flags,
+    unsigned char const *payload, std::size_t length)
+{
+  std::size_t begin = 0;
+  std::size_t end = length;
+
+  if (flags & PADDED) {
+    if (length < 1)
+      throw connection_error(PROTOCOL_ERROR);
+    begin = 1;
+    if (std::size_t(payload[0]) > length - begin)
+      throw connection_error(PROTOCOL_ERROR);
+    end -= payload[0];
+  }
+
+  unsigned char const *priority = 0;
+  if (flags & PRIORITY) {
+    if (end - begin < 5)
+      throw connection_error(FRAME_SIZE_ERROR);
+    priority = payload + begin;
+    begin += 5;
+  }
+
+  header_block.assign(reinterpret_cast<char const *>(payload) + begin,
+                      end - begin);
+
+  stream_map::iterator s = streams.find(id);
+  if (s == streams.end() && id > last_stream && !goaway &&
+      streams.size() < max_streams)
+  {
+    s = streams.insert(std::make_pair(id, stream())).first;
+    s->second.send_window = initial_window;
+  }
+  if (id > last_stream)
+    last_stream = id;
+
+  // a bad priority resets the stream, but only after the header block is
+  // decoded: the decoder's table is shared by all streams
+  boost::uint32_t error = 0;
+  if (s != streams.end() && priority)
+    error = handle_priority(s->second, id, priority);
+
+  if (flags & END_HEADERS) {
+    end_headers(id, flags & END_STREAM);
+    if (error)
+      throw stream_error(error);
+  } else {
+    continuation = id;
+    continuation_end_stream = flags & END_STREAM;
+    continuation_error = error;
+  }
+}
+
+void http2_connection::impl::end_headers(boost::uint32_t id, bool end_stream) {
+  // decoded even for streams we refuse, the table is shared
+  hpack::header_list headers;
+  try {
+    decoder.decode(header_block.data(), header_block.size(), headers);
+  }
+  catch (hpack::error &) {
+    throw connection_error(COMPRESSION_ERROR);
+  }
+  std::string().swap(header_block);
+
+  stream_map::iterator s = streams.find(id);
+  if (s == streams.end()) {
+    if (goaway)
+      return;
+    // a new stream beyond the limit, or a closed one
+    if (id == last_stream && streams.size() >= max_streams)
+      throw stream_error(REFUSED_STREAM);
+    throw connection_error(STREAM_CLOSED);
+  }
+
+  stream &st = s->second;
+  if (st.remote_closed)
+    throw connection_error(STREAM_CLOSED);
+
+  if (st.headers.empty()) {
+    st.headers.swap(headers);
+    if (st.headers.empty())
+      throw stream_error(PROTOCOL_ERROR);
+  } else if (!end_stream) {
+    // trailers end the stream
+    throw stream_error(PROTOCOL_ERROR);
+  }
+
+  if (end_stream)
+    st.remote_closed = true;
+}
+
+// the stream error code for a bad priority, 0 if it is taken
+boost::uint32_t http2_connection::impl::handle_priority(
+    stream &s, boost::uint32_t id, unsigned char const *payload)
+{
+  boost::uint32_t const parent = read32(payload) & 0x7fffffff;
+  if (parent == id)
+    return PROTOCOL_ERROR;
+  s.parent = parent;
+  s.weight = unsigned(payload[4]) + 1;
+  return 0;
+}
+
+void http2_connection::impl::handle_settings(
+    int flags, unsigned char const *payload, std::size_t length)
+{
+  if (flags & ACK) {
+    if (length != 0)
+      throw connection_error(FRAME_SIZE_ERROR);
+    return;
+  }
+
+  if (length % 6 != 0)
+    throw connection_error(FRAME_SIZE_ERROR);
+
+  for (std::size_t i = 0; i < length; i += 6) {
+    unsigned const id = (payload[i] << 8) | payload[i + 1];
+    boost::uint32_t const value = read32(payload + i + 2);
+
+    switch (id) {
+    case ENABLE_PUSH:
+      if (value > 1)
+        throw connection_error(PROTOCOL_ERROR);
+      break;
+
+    case INITIAL_WINDOW_SIZE:
+      {
+        if (value > MAX_WINDOW)
+          throw connection_error(FLOW_CONTROL_ERROR);
+        boost::int64_t const delta = boost::int64_t(value) - initial_window;
+        for (stream_map::iterator it = streams.begin();
+            it != streams.end();
+            ++it)
+        {
+          it->second.send_window += delta;
+          if (it->second.send_window > MAX_WINDOW)
+            throw connection_error(FLOW_CONTROL_ERROR);
+        }
+        initial_window = value;
+      }
+      break;
+
+    case MAX_FRAME_SIZE:
+      if (value < 16384 || value > 16777215)
+        throw connection_error(PROTOCOL_ERROR);
+      max_frame = value;
+      break;
+
+    default:
+      // our encoder never indexes, so the table size does not matter;
+      // we do not push
+      break;
+    }
+  }
+
+  frame(out, SETTINGS_FRAME, ACK, 0);
+}
+
+void http2_connection::impl::window_update(
+    boost::uint32_t id, unsigned char const *payload)
+{
+  boost::uint32_t const increment = read32(payload) & 0x7fffffff;
+
+  if (id == 0) {
+    if (increment == 0)
+      throw connection_error(PROTOCOL_ERROR);
+    send_window += increment;
+    if (send_window > MAX_WINDOW)
+      throw connection_error(FLOW_CONTROL_ERROR);
+    return;
+  }
+
+  stream_map::iterator s = streams.find(id);
+  if (s == streams.end())
+    return;
+  if (increment == 0)
+    throw stream_error(PROTOCOL_ERROR);
+  s->second.send_window += increment;
+  if (s->second.send_window > MAX_WINDOW)
+    throw stream_error(FLOW_CONTROL_ERROR);
+}
+
+void http2_connection::impl::reset_stream(
+    boost::uint32_t id, boost::uint32_t code)
+{
+  std::string payload;
+  write32(payload, code);
+  frame(out, RST_STREAM_FRAME, 0, id, payload);
+  streams.erase(id);
+}
+
+void http2_connection::impl::serve_streams() {
+  // by id: serving a stream reads frames while its entity is written, which
+  // may open and close others
+  boost::uint32_t id = 0;
+  for (;;) {
+    stream_map::iterator it = streams.upper_bound(id);
+    if (it == streams.end())
+      break;
+    id = it->first;
+    stream &s = it->second;
+    if (s.served || !(s.remote_closed || s.too_large))
+      continue;
+    try {
+      serve_stream(id, s);
+    }
+    catch (stream_error &e) {
+      reset_stream(id, e.code);
+    }
+  }
+}
+
+void http2_connection::impl::serve_stream(boost::uint32_t id, stream &s) {
+  s.served = true;
+
+  if (s.too_large) {
+    s.response_headers.push_back(hpack::header(":status", "413"));
+    s.response_headers.push_back(hpack::header("server", servername));
+    return;
+  }
+
+  std::string method, path;
+  headers h;
+  if (!make_request(s, method, path, h))
+    throw stream_error(PROTOCOL_ERROR);
+  hpack::header_list().swap(s.headers);
+
+  s.resp.reset(new response(response::empty_tag()));
+  try {
+    http1.serve(method, path, h, s.body, s.enc).move(*s.resp);
+  }
+  catch (std::exception &e) {
+    log->log(logger::err, "unexpected-exception", e.what());
+    log->flush();
+    throw stream_error(INTERNAL_ERROR);
+  }
+  std::string().swap(s.body);
+
+  response_headers(s);
+
+  if (!s.enc) {
+    s.resp.reset();
+    return;
+  }
+
+  response &r = *s.resp;
+  // a 206 entity is cut to the ranges by print_entity()
+  if (r.get_code() != 206) {
+    if (std::string const *data = r.get_string(s.enc)) {
+      s.memory = data->data();
+      s.memory_left = data->size();
+      return;
+    }
+    boost::int64_t const length = r.length(s.enc);
+    if (length >= 0 && r.get_file(s.enc, s.file, s.file_offset)) {
+      s.file_left = length;
+      return;
+    }
+  }
+
+  produce(id, s);
+}
+
+// the request of a stream, false if it is malformed
+bool http2_connection::impl::make_request(
+    stream &s, std::string &method, std::string &path, headers &h)
+{
+  std::string scheme, authority, cookies;
+  bool regular = false;
+  bool has_length = false;
+  boost::uint64_t length = 0;
+
+  for (hpack::header_list::const_iterator it = s.headers.begin();
+      it != s.headers.end();
+      ++it)
+  {
+    std::string const &name = it->first;
+    std::string const &value = it->second;
+    if (!valid_name(name) || !valid_value(value))
+      return false;
+
+    if (name[0] == ':') {
+      std::string *field = 0;
+      if (name == ":method")
+        field = &method;
+      else if (name == ":scheme")
+        field = &scheme;
+      else if (name == ":path")
+        field = &path;
+      else if (name == ":authority")
+        field = &authority;
+      if (regular || !field || !field->empty() || value.empty())
+        return false;
+      *field = value;
+      continue;
+    }
+
+    regular = true;
+    if (connection_specific(name))
+      return false;
+    if (name == "te") {
+      if (value != "trailers")
+        return false;
+    } else if (name == "cookie") {
+      // may be split up for better compression (RFC 7540, 8.1.2.5)
+      if (!cookies.empty())
+        cookies += "; ";
+      cookies += value;
+    } else if (name == "content-length") {
+      try {
+        length = boost::lexical_cast<boost::uint64_t>(value);
+      }
+      catch (boost::bad_lexical_cast &) {
+        return false;
+      }
+      has_length = true;
+    } else if (name != "expect") {
+      // 100-continue is pointless, the entity is read completely anyway
+      h.add_header_part(name, value, false);
+    }
+  }
+
+  if (method.empty())
+    return false;
+  if (method == "CONNECT") {
+    if (authority.empty() || !scheme.empty() || !path.empty())
+      return false;
+    path = authority;
+  } else if (scheme.empty() || path.empty()) {
+    return false;
+  }
+  if (has_length && length != s.body.size())
+    return false;
+
+  if (!authority.empty())
+    h.set_header("host", authority);
+  if (!cookies.empty())
+    h.set_header("cookie", cookies);
+  if (has_length || !s.body.empty())
+    h.set_header("content-length", s.body.size());
+  return true;
+}
+
+// :status and the header fields of the response, but those which only
+// concern HTTP/1.x connections
+void http2_connection::impl::response_headers(stream &s) {
+  response &r = *s.resp;
+  int const code = r.get_code();
+  s.response_headers.push_back(hpack::header(
+    ":status", boost::lexical_cast<std::string>(code == -1 ? 200 : code)));
+
+  // rendered as for HTTP/1.1 to get the cookies along
+  std::string head;
+  {
+    io::stream<io::back_insert_device<std::string> > out(head);
+    r.print_headers(out);
+  }
+
+  std::string::size_type pos = 0;
+  for (;;) {
+    std::string::size_type const next = head.find("\r\n", pos);
+    if (next == std::string::npos || next == pos)
+      break;
+    std::string::size_type const colon = head.find(':', pos);
+    if (colon != std::string::npos && colon < next) {
+      std::string name = algo::to_lower_copy(head.substr(pos, colon - pos));
+      if (!connection_specific(name))
+        s.response_headers.push_back(hpack::header(name,
+          algo::trim_copy(head.substr(colon + 1, next - colon - 1))));
+    }
+    pos = next + 2;
+  }
+}
+
+// Writes the entity with print_entity(). Whenever FLUSH_SIZE of it has
+// piled up, it is sent on as far as the windows allow, reading frames
+// (window updates) while that is nothing, so that memory stays bounded.
+void http2_connection::impl::produce(boost::uint32_t id, stream &s) {
+  // the stream may be reset meanwhile
+  boost::shared_ptr<response> resp = s.resp;
+  encoding *enc = s.enc;
+
+  s.producing = true;
+  producing = id;
+  {
+    io::stream<entity_sink> out(entity_sink(this, id));
+    http1.print_entity(*resp, enc, *out.rdbuf());
+    io::flush(out);
+  }
+  producing = 0;
+
+  if (closed)
+    throw connection_closed();
+  if (failure >= 0)
+    throw connection_error(boost::uint32_t(failure));
+
+  stream_map::iterator it = streams.find(id);
+  if (it != streams.end())
+    it->second.producing = false;
+}
+
+void http2_connection::impl::produced(
+    boost::uint32_t id, char const *data, std::size_t length)
+{
+  stream_map::iterator s = streams.find(id);
+  if (s == streams.end() || closed || failure >= 0)
+    return; // discarded
+  s->second.buffer.append(data, length);
+  if (s->second.ready() >= FLUSH_SIZE)
+    catch_up(id);
+}
+
+void http2_connection::impl::catch_up(boost::uint32_t id) {
+  try {
+    for (;;) {
+      send_frames();
+      flush();
+
+      stream_map::iterator s = streams.find(id);
+      if (s == streams.end() || s->second.ready() < FLUSH_SIZE)
+        return;
+
+      if (!conn->fill())
+        throw connection_closed();
+      while (frame_complete())
+        handle_frame();
+    }
+  }
+  catch (connection_closed &) {
+    closed = true;
+  }
+  catch (connection_error &e) {
+    failure = e.code;
+  }
+}
+
+void http2_connection::impl::send_frames() {
+  for (stream_map::iterator it = streams.begin(); it != streams.end(); ++it) {
+    stream &s = it->second;
+    if (!s.served || s.headers_sent)
+      continue;
+
+    std::string block;
+    encoder.encode(s.response_headers, block);
+    hpack::header_list().swap(s.response_headers);
+    s.headers_sent = true;
+
+    int flags = 0;
+    if (!s.producing && s.ready() == 0) {
+      flags = END_STREAM;
+      s.end_sent = true;
+    }
+    std::size_t n = std::min(block.size(), max_frame);
+    frame(out, HEADERS_FRAME,
+          flags | (n == block.size() ? END_HEADERS : 0),
+          it->first, block.data(), n);
+    for (std::size_t i = n; i < block.size(); i += n) {
+      n = std::min(block.size() - i, max_frame);
+      frame(out, CONTINUATION_FRAME,
+            i + n == block.size() ? END_HEADERS : 0,
+            it->first, block.data() + i, n);
+    }
+  }
+
+  // DATA frames in turn as the windows allow: a stream only if its parent
+  // cannot go on, among those the one that got least for its weight
+  while (send_window > 0) {
+    stream_map::iterator best = streams.end();
+    for (int pass = 0; pass < 2 && best == streams.end(); ++pass) {
+      for (stream_map::iterator it = streams.begin();
+          it != streams.end();
+          ++it)
+      {
+        stream &s = it->second;
+        if (!s.pending() || s.send_window <= 0)
+          continue;
+        if (pass == 0 && s.parent) {
+          // the second pass ignores dependencies (cycles)
+          stream_map::iterator parent = streams.find(s.parent);
+          if (parent != streams.end() && parent->second.pending() &&
+              parent->second.send_window > 0)
+            continue;
+        }
+        if (best == streams.end() ||
+            s.bytes_sent * best->second.weight <
+              best->second.bytes_sent * s.weight)
+          best = it;
+      }
+    }
+    if (best == streams.end())
+      break;
+
+    stream &s = best->second;
+    boost::uint64_t n = s.ready();
+    n = std::min(n, boost::uint64_t(max_frame));
+    n = std::min(n, boost::uint64_t(s.send_window));
+    n = std::min(n, boost::uint64_t(send_window));
+    data_frame(best->first, s, std::size_t(n));
+    s.bytes_sent += n;
+    s.send_window -= n;
+    send_window -= n;
+
+    if (out.size() >= FLUSH_SIZE)
+      flush();
+  }
+
+  for (stream_map::iterator it = streams.begin(); it != streams.end(); ) {
+    stream &s = it->second;
+    // all of an entity print_entity() produced was sent before it returned
+    if (s.headers_sent && !s.end_sent && !s.producing && s.ready() == 0) {
+      frame(out, DATA_FRAME, END_STREAM, it->first);
+      s.end_sent = true;
+    }
+    if (s.end_sent) {
+      // answered before the request was complete (413)
+      if (!s.remote_closed) {
+        std::string payload;
+        write32(payload, NO_ERROR);
+        frame(out, RST_STREAM_FRAME, 0, it->first, payload);
+      }
+      streams.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// a DATA frame of `length' bytes from where the entity of `s' is
+void http2_connection::impl::data_frame(
+    boost::uint32_t id, stream &s, std::size_t length)
+{
+  bool const last = !s.producing && s.ready() == length;
+  int const flags = last ? END_STREAM : 0;
+
+  if (s.memory_left) {
+    frame(out, DATA_FRAME, flags, id, s.memory, length);
+    s.memory += length;
+    s.memory_left -= length;
+  } else if (s.file_left) {
+    frame_header(out, DATA_FRAME, flags, id, length);
+    if (socket) {
+      flush();
+      if (socket->send_file(s.file, s.file_offset, length) < 0)
+        throw connection_closed();
+    } else {
+      std::size_t const at = out.size();
+      out.resize(at + length);
+      for (std::size_t got = 0; got < length; ) {
+        ssize_t n = ::pread(s.file, &out[at + got], length - got,
+                            s.file_offset + got);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          throw connection_error(INTERNAL_ERROR); // the frame is promised
+        got += n;
+      }
+    }
+    s.file_offset += length;
+    s.file_left -= length;
+  } else {
+    frame(out, DATA_FRAME, flags, id, s.buffer.data() + s.buffer_sent, length);
+    s.buffer_sent += length;
+    if (s.buffer_sent == s.buffer.size()) {
+      s.buffer.clear();
+      s.buffer_sent = 0;
+    } else if (s.buffer_sent >= FLUSH_SIZE) {
+      s.buffer.erase(0, s.buffer_sent);
+      s.buffer_sent = 0;
+    }
+  }
+
+  if (last) {
+    s.end_sent = true;
+    s.resp.reset();
+  }
+}
+
+// Local Variables: **
+// mode: C++ **
+// coding: utf-8 **
+// c-electric-flag: nil **
+// End: **
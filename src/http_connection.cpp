@@ -1,5 +1,6 @@
 // vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
 #include "rest/http_connection.hpp"
+#include "rest/http2_connection.hpp"
 #include "rest/config.hpp"
 #include "rest/headers.hpp"
 #include "rest/host.hpp"
@@ -8,43 +9,350 @@
 #include "rest/request.hpp"
 #include "rest/encoding.hpp"
 #include "rest/logger.hpp"
+#include "rest/scheme.hpp"
+#include "rest/utils/exceptions.hpp"
 #include "rest/utils/http.hpp"
+#include "rest/utils/request_parser.hpp"
+#include "rest/utils/input_buffer.hpp"
 #include "rest/utils/uri.hpp"
 #include "rest/utils/chunked_filter.hpp"
 #include "rest/utils/length_filter.hpp"
-#include "rest/utils/no_flush_writer.hpp"
+#include "rest/utils/socket_device.hpp"
+#include "rest/utils/string.hpp"
+#include "rest/utils/lru_cache.hpp"
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/stream_buffer.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/format.hpp>
+#include <boost/noncopyable.hpp>
 #include <map>
+#include <deque>
 #include <sstream>
 #include <bitset>
 #include <memory>
 #include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <sys/uio.h>
+#include <unistd.h>
 
 using namespace rest;
 namespace det = rest::detail;
 namespace algo = boost::algorithm;
 namespace io = boost::iostreams;
 
+namespace {
+  // compressed entities by host, URI, ETag and encoding
+  typedef utils::lru_cache<std::string, std::string> encoding_cache_t;
+
+  encoding_cache_t &encoding_cache() {
+    static encoding_cache_t cache(
+      utils::get(config::get().tree(), std::size_t(4194304),
+                 "general", "compression", "cache_size"));
+    return cache;
+  }
+
+  // Responses of public resources as returned by their responder, by host,
+  // URI and the request headers named in their Vary header. For a resource
+  // with a Vary header an entry without response lists the header names.
+  struct cached_response {
+    response resp;
+    std::vector<std::string> vary;
+    time_t expires;
+    time_t last_modified;
+    std::string etag;
+  };
+
+  typedef boost::shared_ptr<cached_response> cached_response_ptr;
+  typedef utils::lru_cache<std::string, cached_response_ptr> response_cache_t;
+
+  // the budget is set by the server
+  response_cache_t &response_cache() {
+    static response_cache_t cache(0);
+    return cache;
+  }
+
+  // responses to pipelined requests are collected up to this size before
+  // they are written
+  std::size_t const PIPELINE_FLUSH_SIZE = 65536;
+
+  // a response written in several pieces leaves in full segments only
+  class cork_guard : boost::noncopyable {
+  public:
+    cork_guard(utils::socket_device *socket) : socket(socket) {
+      if (socket)
+        socket->cork(true);
+    }
+
+    ~cork_guard() {
+      if (socket)
+        socket->cork(false);
+    }
+
+  private:
+    utils::socket_device *socket;
+  };
+
+  // Writes the response to the connection. Flushes from the entity (the
+  // sync points of compressing encodings, streamed entities ending) go all
+  // the way to the client, past the socket's stream buffer and the cork.
+  class entity_writer {
+  public:
+    typedef char char_type;
+
+    struct category
+      :
+        io::sink_tag,
+        io::flushable_tag
+    {};
+
+    entity_writer(std::streambuf *buf, utils::socket_device *socket)
+      : buf(buf), socket(socket) {}
+
+    std::streamsize write(char const *data, std::streamsize length) {
+      return io::write(*buf, data, length);
+    }
+
+    bool flush() {
+      bool ok = buf->pubsync() == 0;
+      if (socket) {
+        socket->cork(false);
+        socket->cork(true);
+      }
+      return ok;
+    }
+
+  private:
+    std::streambuf *buf;
+    utils::socket_device *socket;
+  };
+
+  // The bottom of the connection stream of an event-driven connection:
+  // nothing is read through it (advance() fetches the input), the output is
+  // queued until the socket takes it. Parts of files are queued as such.
+  class output_queue : public std::streambuf, boost::noncopyable {
+  public:
+    output_queue() : sent(0), text_size(0) {}
+
+    ~output_queue() {
+      for (std::size_t i = 0; i < segments.size(); ++i)
+        if (segments[i].fd >= 0)
+          ::close(segments[i].fd);
+    }
+
+    bool empty() const { return segments.empty(); }
+
+    // the bytes of text queued, files not counted
+    std::size_t size() const { return text_size; }
+
+    void append(char const *data, std::size_t length) {
+      if (length == 0)
+        return;
+      if (segments.empty() || segments.back().fd >= 0)
+        segments.push_back(segment());
+      segments.back().text.append(data, length);
+      text_size += length;
+    }
+
+    void append(std::string const &text) {
+      append(text.data(), text.size());
+    }
+
+    // `length' bytes of the file `fd' from `offset'; fd is duplicated, the
+    // response owning it is gone before it is sent
+    void append_file(int fd, boost::int64_t offset, boost::int64_t length) {
+      segment s;
+      s.fd = ::dup(fd);
+      if (s.fd < 0)
+        throw utils::errno_error("dup");
+      s.offset = offset;
+      s.length = length;
+      segments.push_back(s);
+    }
+
+    // Writes as far as the socket takes it, false if the rest has to wait.
+    // Throws remote_close if the client went away.
+    bool write(scheme &schm, int connfd, std::streambuf &conn) {
+      while (!segments.empty()) {
+        segment &s = segments.front();
+        if (s.fd < 0) {
+          std::streamsize n = schm.write(
+            connfd, conn, s.text.data() + sent, s.text.size() - sent);
+          if (!transferred(n))
+            return false;
+          sent += n;
+          if (sent == s.text.size()) {
+            text_size -= s.text.size();
+            sent = 0;
+            segments.pop_front();
+          }
+        } else {
+          boost::int64_t n =
+            schm.send_file(connfd, conn, s.fd, s.offset, s.length);
+          if (n < 0 && errno == ENOSYS) {
+            read_file();
+            continue;
+          }
+          if (!transferred(n))
+            return false;
+          s.offset += n;
+          s.length -= n;
+          if (s.length == 0)
+            pop_file();
+        }
+      }
+      return true;
+    }
+
+  protected:
+    int_type overflow(int_type c) {
+      if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        char x = traits_type::to_char_type(c);
+        append(&x, 1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(char const *data, std::streamsize length) {
+      append(data, std::size_t(length));
+      return length;
+    }
+
+  private:
+    struct segment {
+      segment() : fd(-1), offset(0), length(0) {}
+
+      std::string text;
+      int fd; // -1 for text
+      boost::int64_t offset;
+      boost::int64_t length;
+    };
+
+    static bool transferred(boost::int64_t n) {
+      if (n > 0)
+        return true;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return false;
+      throw utils::http::remote_close();
+    }
+
+    // a piece of the file in front goes on as text (for connections which
+    // cannot send files by themselves)
+    void read_file() {
+      segment &s = segments.front();
+      segment piece;
+      piece.text.resize(std::size_t(std::min(s.length, boost::int64_t(65536))));
+      ssize_t n;
+      do {
+        n = ::pread(s.fd, &piece.text[0], piece.text.size(), s.offset);
+      } while (n < 0 && errno == EINTR);
+      if (n <= 0)
+        throw utils::errno_error("pread");
+      piece.text.resize(n);
+      s.offset += n;
+      s.length -= n;
+      if (s.length == 0)
+        pop_file();
+      text_size += piece.text.size();
+      segments.push_front(piece);
+    }
+
+    void pop_file() {
+      ::close(segments.front().fd);
+      segments.pop_front();
+    }
+
+    std::deque<segment> segments;
+    std::size_t sent; // of the text in front
+    std::size_t text_size;
+  };
+
+  // Where the chunked entity starting at `pos' of data ends, its trailer
+  // included; npos if it is not complete yet, `pos' moved past the chunks
+  // which are. Bad framing ends it right away, reading it fails then.
+  std::size_t chunked_end(char const *data, std::size_t size, std::size_t &pos)
+  {
+    for (;;) {
+      char const *nl = static_cast<char const *>(
+        std::memchr(data + pos, '\n', size - pos));
+      if (!nl)
+        return std::string::npos;
+      std::size_t const line_end = nl - data + 1;
+
+      boost::uint64_t length = 0;
+      std::size_t digits = 0;
+      for (std::size_t i = pos; i < line_end; ++i, ++digits) {
+        boost::tuple<bool, int> value = utils::hex2int(data[i]);
+        if (!value.get<0>())
+          break;
+        if (digits == 15)
+          return pos;
+        length = length * 0x10 + value.get<1>();
+      }
+      if (digits == 0)
+        return pos;
+
+      if (length == 0) {
+        // the trailer, up to the empty line
+        std::size_t line = line_end;
+        for (;;) {
+          nl = static_cast<char const *>(
+            std::memchr(data + line, '\n', size - line));
+          if (!nl)
+            return std::string::npos;
+          std::size_t const next = nl - data + 1;
+          if (next - line <= 2)
+            return next;
+          line = next;
+        }
+      }
+
+      // the data and its line end
+      if (length + 2 > size - line_end)
+        return std::string::npos;
+      pos = line_end + std::size_t(length) + 2;
+    }
+  }
+}
+
 class http_connection::impl {
 public:
   logger *log;
 
   host_container const &hosts;
 
-  std::auto_ptr<std::streambuf> conn;
+  std::auto_ptr<utils::input_buffer> conn;
+
+  // the plain socket below conn, if any (for sendfile)
+  utils::socket_device *socket;
+
+  // responses held back while further requests are waiting in conn
+  std::string pending_output;
 
   std::string const &servername;
   rest::utils::property_tree &tree;
 
   bool open_flag;
 
+  // nothing was served on conn yet (it may start with the HTTP/2 preface)
+  bool first_request;
+
+  // the last Host header looked up and what it resolved to; host_header is
+  // the buffer to read the next one into
+  std::string host_header;
+  std::string memo_header;
+  host const *memo_host;
+  bool memo_valid;
+
   enum {
     NO_ENTITY,
     HTTP_1_0_COMPAT,
+    HTTP_1_0_KEEP_ALIVE,
     X_NO_FLAG
   };
   typedef std::bitset<X_NO_FLAG> state_flags;
@@ -54,9 +362,46 @@ public:
 
   request request_;
 
+  // those of the request being handled, their storage reused by the next
+  keywords kw;
+
+  utils::http::request_parser parser;
+
   typedef std::vector<std::pair<boost::int64_t, boost::int64_t> > ranges_t;
   ranges_t ranges;
 
+  // the request entity as passed to the keywords, kept until the rest of it
+  // is drained after the response; entity_framing is the index of the
+  // length_filter or chunked_filter reading it from conn
+  encoding::input_chain entity_chain;
+  std::auto_ptr<std::istream> entity;
+  int entity_framing;
+  bool entity_chunked;
+  boost::uint64_t max_unread_entity;
+
+  // the entity of a request given to serve_direct(), which reads nothing
+  // from conn
+  std::string const *direct_entity;
+
+  // Event-driven connections: the scheme does the transfers on the stream
+  // `transport', conn reads what they fetched and writes to `output'.
+  scheme *schm;
+  int connfd;
+  std::auto_ptr<std::streambuf> transport;
+  output_queue *output;
+  bool set_up;
+  bool input_closed;
+
+  // what request_buffered() found out about the next request so far: where
+  // it ends in conn (0: its head is not complete yet, npos: the end of its
+  // chunked entity is not found yet), the end of its chunks found complete
+  std::size_t request_end;
+  std::size_t chunks_end;
+  bool expect_continue;
+  bool continued;
+  bool entity_too_large;
+  boost::uint64_t max_buffered_entity;
+
   impl(
       host_container const &hosts,
       network::address const &addr,
@@ -65,26 +410,97 @@ public:
   )
     : log(log),
       hosts(hosts),
+      socket(0),
       servername(servername),
       tree(config::get().tree()),
       open_flag(true),
-      request_(addr)
-  { }
+      first_request(false),
+      memo_host(0),
+      memo_valid(false),
+      request_(addr),
+      parser(
+        method_name_length,
+        utils::get(tree, 1023, "general", "limits", "max_uri_length"),
+        sizeof("HTTP/1.1") - 1 + 5, // 5 additional chars for higher versions
+        utils::get(tree, 63, "general", "limits", "max_header_name_length"),
+        utils::get(tree, 1023, "general", "limits", "max_header_value_length"),
+        utils::get(tree, 64, "general", "limits", "max_header_count")),
+      entity_framing(-1),
+      entity_chunked(false),
+      max_unread_entity(utils::get(tree, boost::uint64_t(65536),
+                                   "general", "limits", "max_unread_entity")),
+      direct_entity(0),
+      schm(0),
+      connfd(-1),
+      output(0),
+      set_up(false),
+      input_closed(false),
+      request_end(0),
+      chunks_end(0),
+      expect_continue(false),
+      continued(false),
+      entity_too_large(false),
+      max_buffered_entity(utils::get(tree, boost::uint64_t(1048576),
+                                     "general", "limits", "max_buffered_entity"))
+  {
+  }
 
   void reset();
 
   void serve();
+  void serve_request();
+  bool serve_http2();
+  response serve_direct(std::string const &method, std::string uri,
+                        headers const &h, std::string const &entity,
+                        encoding *&enc);
+  void finish_response(response &resp);
 
   int set_header_options();
 
   response handle_request();
+
+  // starts the keys of the process-wide caches with the host the request
+  // was resolved to: host names are not unique across host containers
+  void host_key(std::string &key) const;
+  std::string cache_key(std::string const &uri,
+                        std::vector<std::string> const &vary);
+  cached_response_ptr find_cached(std::string const &uri, time_t now);
+  void store_cached(
+    std::string const &uri,
+    det::responder_base *responder,
+    response const &resp,
+    time_t now,
+    time_t expires,
+    time_t last_modified,
+    std::string const &etag);
   void read_request(std::string&method, std::string&uri, std::string&version);
   host const *get_host();
 
   int handle_entity(keywords &kw, det::responder_base *resp);
+  void drain_entity();
+  void close_entity();
+
+  void open(std::auto_ptr<std::streambuf> conn);
+  void open(std::auto_ptr<std::streambuf> conn, scheme &schm, int connfd);
+
+  http_connection::event_state advance();
+  bool request_buffered();
+  void frame_request();
+  void serve_buffered();
+  void next_request();
+  bool read_input();
+
+  void use_encoding_cache(response &resp);
 
   void send(response r, bool entity);
   void send(response r);
+  encoding *entity_headers(response &r, bool entity);
+  bool send_direct(response &r, encoding *enc, bool may_chunk,
+                   std::string &head, bool defer);
+  void flush_output();
+  bool head_buffered() const;
+  bool send_file(response &r, encoding *enc, bool may_chunk,
+                 std::string &head);
 
   int handle_modification_tags(time_t, std::string const&, std::string const&);
 
@@ -183,12 +599,94 @@ http_connection::http_connection(
 http_connection::~http_connection() { }
 
 void http_connection::serve(std::auto_ptr<std::streambuf> conn) {
-  p->conn.reset(conn.release());
+  p->open(conn);
 
   p->serve();
 }
 
+void http_connection::open(
+    std::auto_ptr<std::streambuf> conn, scheme &schm, int connfd)
+{
+  p->open(conn, schm, connfd);
+}
+
+void http_connection::impl::open(std::auto_ptr<std::streambuf> buf) {
+  typedef io::stream_buffer<utils::socket_device> socket_buffer;
+
+  socket_buffer *sb = dynamic_cast<socket_buffer *>(buf.get());
+  socket = sb ? &**sb : 0;
+  conn.reset(new utils::input_buffer(buf));
+  first_request = true;
+}
+
+void http_connection::impl::open(
+    std::auto_ptr<std::streambuf> buf, scheme &s, int fd)
+{
+  schm = &s;
+  connfd = fd;
+  transport = buf;
+  output = new output_queue;
+  conn.reset(new utils::input_buffer(std::auto_ptr<std::streambuf>(output)));
+  next_request();
+}
+
+bool http_connection::request_started() const {
+  if (!p->conn.get())
+    return false;
+  if (!p->set_up)
+    return true;
+  // leftover line ends between requests do not count
+  char const *data = p->conn->data();
+  for (std::size_t i = 0; i < p->conn->size(); ++i)
+    if (data[i] != '\r' && data[i] != '\n')
+      return true;
+  return false;
+}
+
+http_connection::event_state http_connection::advance() {
+  if (!p->conn.get())
+    return CLOSED;
+
+  event_state state;
+  try {
+    state = p->advance();
+  }
+  catch (utils::http::remote_close&) {
+    state = CLOSED;
+  }
+  catch (...) {
+    p->conn.reset();
+    throw;
+  }
+
+  if (state == CLOSED)
+    p->conn.reset();
+  return state;
+}
+
+void http_connection::set_response_cache_size(std::size_t bytes) {
+  response_cache().set_budget(bytes);
+}
+
+response http_connection::serve(
+    std::string const &method,
+    std::string const &uri,
+    headers const &h,
+    std::string const &entity,
+    encoding *&enc)
+{
+  return p->serve_direct(method, uri, h, entity, enc);
+}
+
+void http_connection::print_entity(
+    response const &r, encoding *enc, std::streambuf &out)
+{
+  r.print_entity(out, enc, false, p->ranges);
+}
+
 void http_connection::impl::reset() {
+  close_entity();
+  direct_entity = 0;
   flags.reset();
   encodings.clear();
   ranges_t().swap(ranges);
@@ -196,31 +694,246 @@ void http_connection::impl::reset() {
 
 void http_connection::impl::serve() {
   try {
-    while (open_flag) {
-      reset();
+    if (!serve_http2())
+      while (open_flag)
+        serve_request();
+  }
+  catch (utils::http::remote_close&) {
+  }
+  catch (...) {
+    flush_output();
+    conn.reset();
+    throw;
+  }
+
+  flush_output();
+  conn.reset();
+}
+
+// a connection starting with the HTTP/2 preface is served as such until it
+// closes; only serve() does that, advance() would block its worker
+bool http_connection::impl::serve_http2() {
+  if (!first_request)
+    return false;
+  first_request = false;
+  if (!http2_connection::preface(*conn))
+    return false;
+
+  http2_connection(hosts, request_.get_client_address(), servername, log)
+    .serve(*conn, socket);
+  open_flag = false;
+  return true;
+}
+
+void http_connection::impl::serve_request() {
+  reset();
+
+  response resp(handle_request());
+  finish_response(resp);
+
+  send(resp);
+
+  drain_entity();
+}
 
-      response resp(handle_request());
+response http_connection::impl::serve_direct(
+    std::string const &method,
+    std::string uri,
+    headers const &h,
+    std::string const &entity,
+    encoding *&enc)
+{
+  reset();
+
+  log->log(logger::info, "new-request");
+  log->log(logger::info, "method", method);
+  log->log(logger::info, "uri", uri);
+  log->flush();
+
+  request_.set_method(method);
+  utils::uri::make_basename(uri);
+  request_.set_uri(uri);
+  request_.get_headers() = h;
+  direct_entity = &entity;
+
+  response resp(handle_request());
+  finish_response(resp);
+  close_entity();
 
-      check_ranges(resp);
+  enc = entity_headers(resp, !flags.test(NO_ENTITY));
 
-      host const &h = request_.get_host();
-      if (resp.is_nil())
-        h.make_standard_response(resp);
-      h.prepare_response(resp);
+  int code = resp.get_code();
+  log->log(logger::notice, "http-response-code", code == -1 ? 200 : code);
+  log->flush();
+
+  return resp;
+}
 
-      request_.clear();
+// Goes on with an event-driven connection: serves what arrived completely
+// and writes the responses, then reads more, until the socket is not ready.
+http_connection::event_state http_connection::impl::advance() {
+  if (!set_up) {
+    bool want_write = false;
+    if (!schm->handshake(connfd, *transport, want_write))
+      return want_write ? WANT_WRITE : WANT_READ;
+    set_up = true;
+  }
 
-      send(resp);
+  for (;;) {
+    // the responses to pipelined requests are collected up to a point
+    while (open_flag && output->size() < PIPELINE_FLUSH_SIZE &&
+           request_buffered())
+      serve_buffered();
+
+    if (!output->write(*schm, connfd, *transport))
+      return WANT_WRITE;
+    if (!open_flag)
+      return CLOSED;
+    if (request_buffered())
+      continue;
+    if (input_closed)
+      return CLOSED;
+    if (!read_input())
+      return WANT_READ;
+  }
+}
+
+// Whether the next request can be served without waiting for the client:
+// its head and entity are in conn, or it is bad already. The judgement is
+// resumed where it stopped as more input arrives. Sends 100 Continue if the
+// client waits for it.
+bool http_connection::impl::request_buffered() {
+  char const *data = conn->data();
+  std::size_t const size = conn->size();
+
+  if (request_end == 0) {
+    try {
+      for (;;) {
+        std::size_t const parsed = parser.consumed();
+        if (parser.parse(data, size) == utils::http::request_parser::DONE)
+          break;
+        if (parser.consumed() == parsed)
+          return false;
+      }
     }
+    catch (utils::http::bad_format&) {
+      return true;
+    }
+    frame_request();
   }
-  catch (utils::http::remote_close&) {
+
+  if (request_end == std::string::npos) {
+    request_end = chunked_end(data, size, chunks_end);
+    if (request_end == std::string::npos &&
+        size - parser.consumed() > max_buffered_entity)
+    {
+      entity_too_large = true;
+      request_end = parser.consumed();
+    }
   }
-  catch (...) {
-    conn.reset();
-    throw;
+
+  if (size >= request_end)
+    return true;
+
+  if (expect_continue && !continued) {
+    output->append("HTTP/1.1 100 Continue\r\n\r\n");
+    continued = true;
   }
+  return false;
+}
 
-  conn.reset();
+// where the entity of the request whose head the parser read ends
+void http_connection::impl::frame_request() {
+  char const *data = conn->data();
+  std::size_t const head = parser.consumed();
+
+  boost::optional<std::string> content_length;
+  bool chunked = false;
+  utils::http::request_parser::fields_t const &fields = parser.fields();
+  for (std::size_t i = 0; i < fields.size(); ++i) {
+    utils::http::span const &name = fields[i].name;
+    char const *n = data + name.offset;
+    if (algo::iequals(std::make_pair(n, n + name.length), "Content-Length")) {
+      content_length = utils::http::field_value(data, fields[i]);
+    } else if (algo::iequals(std::make_pair(n, n + name.length),
+                             "Transfer-Encoding"))
+    {
+      std::vector<std::string> te;
+      utils::http::parse_list(utils::http::field_value(data, fields[i]), te);
+      chunked = !te.empty() && algo::iequals(te.back(), "chunked");
+    } else if (algo::iequals(std::make_pair(n, n + name.length), "Expect")) {
+      expect_continue =
+        algo::iequals(utils::http::field_value(data, fields[i]), "100-continue")
+        && parser.version().str(data) == "HTTP/1.1";
+    }
+  }
+
+  request_end = head;
+  if (chunked) {
+    request_end = std::string::npos;
+    chunks_end = head;
+  } else if (content_length) {
+    try {
+      boost::uint64_t const length =
+        boost::lexical_cast<boost::uint64_t>(content_length.get());
+      if (length > max_buffered_entity)
+        entity_too_large = true;
+      else
+        request_end = head + std::size_t(length);
+    }
+    catch (boost::bad_lexical_cast&) {
+      // serving fails with it
+    }
+  }
+}
+
+// serves the request request_buffered() found complete
+void http_connection::impl::serve_buffered() {
+  try {
+    serve_request();
+  }
+  catch (utils::http::remote_close&) {
+    open_flag = false;
+  }
+  next_request();
+}
+
+void http_connection::impl::next_request() {
+  parser.reset();
+  request_end = 0;
+  chunks_end = 0;
+  expect_continue = false;
+  continued = false;
+  entity_too_large = false;
+}
+
+// reads once from the socket; false if it had nothing
+bool http_connection::impl::read_input() {
+  std::size_t const READ_SIZE = 16384;
+
+  std::streamsize n =
+    schm->read(connfd, *transport, conn->prepare(READ_SIZE), READ_SIZE);
+  if (n > 0)
+    conn->commit(std::size_t(n));
+  else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+    input_closed = true;
+  else
+    return false;
+  return true;
+}
+
+// what the host adds to a response, and its entity from the encoding cache
+void http_connection::impl::finish_response(response &resp) {
+  check_ranges(resp);
+
+  host const &h = request_.get_host();
+  if (resp.is_nil())
+    h.make_standard_response(resp);
+  h.prepare_response(resp);
+
+  use_encoding_cache(resp);
+
+  request_.clear();
 }
 
 response http_connection::impl::handle_request() {
@@ -234,11 +947,20 @@ response http_connection::impl::handle_request() {
   time_t last_modified = time_t(-1);
   time_t expires = time_t(-1);
   det::responder_base *responder = 0;
-  keywords kw;
   det::any_path path_id;
+  cached_response_ptr cached;
 
   try {
-    read_request(method, uri, version);
+    if (direct_entity) {
+      method = request_.get_method();
+      uri = request_.get_uri();
+    } else {
+      read_request(method, uri, version);
+    }
+
+    // event-driven connections only take entities they can buffer
+    if (entity_too_large)
+      throw 413;
 
     int ret = set_header_options();
     if (ret != 0)
@@ -258,7 +980,14 @@ response http_connection::impl::handle_request() {
 
     kw.set_request_data(request_);
 
-    if (responder) {
+    if (responder && (method == "GET" || method == "HEAD"))
+      cached = find_cached(uri, now);
+
+    if (cached) {
+      last_modified = cached->last_modified;
+      etag = cached->etag;
+      expires = cached->expires;
+    } else if (responder) {
       responder->x_set_path(path_id);
       responder->set_request(request_);
       responder->set_keywords(kw);
@@ -277,12 +1006,21 @@ response http_connection::impl::handle_request() {
           etag,
           method);
 
-    if (!mod_code) {
+    if (!mod_code && cached) {
+      cached->resp.copy(out);
+      if (method == "HEAD")
+        flags.set(NO_ENTITY);
+      else if (!out.is_nil())
+        analyze_ranges();
+    } else if (!mod_code) {
       method_handler_map::const_iterator m = method_handlers.find(method);
       if (m == method_handlers.end())
         throw 501;
       try {
         m->second(this, responder, kw).move(out);
+        if (method == "GET")
+          store_cached(
+            uri, responder, out, now, expires, last_modified, etag);
       } catch (std::exception &e) {
         response(500).move(out);
         out.set_type("text/plain");
@@ -309,6 +1047,7 @@ response http_connection::impl::handle_request() {
 
   if (responder)
     responder->reset();
+  kw.reset();
 
   out.get_headers().set_header("Date", utils::http::datetime_string(now));
   tell_allow(out, responder);
@@ -318,18 +1057,120 @@ response http_connection::impl::handle_request() {
   return out;
 }
 
+void http_connection::impl::host_key(std::string &key) const {
+  host const *h = &request_.get_host();
+  key.assign(reinterpret_cast<char const *>(&h), sizeof(h));
+}
+
+std::string http_connection::impl::cache_key(
+    std::string const &uri, std::vector<std::string> const &vary)
+{
+  std::string key;
+  host_key(key);
+  key += uri;
+  headers const &h = request_.get_headers();
+  for (std::vector<std::string>::const_iterator it = vary.begin();
+      it != vary.end();
+      ++it)
+  {
+    key += '\n';
+    key += h.get_header(*it, "");
+  }
+  return key;
+}
+
+cached_response_ptr
+http_connection::impl::find_cached(std::string const &uri, time_t now) {
+  response_cache_t &cache = response_cache();
+  if (cache.budget() == 0)
+    return cached_response_ptr();
+
+  std::string key = cache_key(uri, std::vector<std::string>());
+  cached_response_ptr const *x = cache.find(key);
+  if (x && !(*x)->vary.empty()) {
+    key = cache_key(uri, (*x)->vary);
+    x = cache.find(key);
+  }
+  if (!x)
+    return cached_response_ptr();
+
+  if ((*x)->expires <= now) {
+    cache.erase(key);
+    return cached_response_ptr();
+  }
+  return *x;
+}
+
+// Only public responses which are fresh for a while and held in memory are
+// stored.
+void http_connection::impl::store_cached(
+    std::string const &uri,
+    det::responder_base *responder,
+    response const &resp,
+    time_t now,
+    time_t expires,
+    time_t last_modified,
+    std::string const &etag)
+{
+  response_cache_t &cache = response_cache();
+  if (cache.budget() == 0 || expires == time_t(-1) || expires <= now)
+    return;
+
+  int code = resp.get_code();
+  if ((code != -1 && code != 200) || resp.has_cookies())
+    return;
+
+  if (responder->cache() &
+      (cache::private_ | cache::no_cache | cache::no_store))
+    return;
+
+  cached_response_ptr x(new cached_response);
+  if (!resp.copy(x->resp))
+    return;
+  x->expires = expires;
+  x->last_modified = last_modified;
+  x->etag = etag;
+
+  std::vector<std::string> vary;
+  boost::optional<std::string> vary_header =
+    resp.get_headers().get_header("Vary");
+  if (vary_header) {
+    utils::http::parse_list(vary_header.get(), vary, ',');
+    if (std::find(vary.begin(), vary.end(), "*") != vary.end())
+      return;
+  }
+
+  std::string key = cache_key(uri, std::vector<std::string>());
+  if (!vary.empty()) {
+    cached_response_ptr names(new cached_response);
+    names->vary = vary;
+    cache.insert(key, names, key.size() + vary_header.get().size());
+    key = cache_key(uri, vary);
+  }
+
+  // plus the headers, roughly
+  cache.insert(key, x, key.size() + resp.data_size() + 256);
+}
+
 void http_connection::impl::read_request(
     std::string &method,
     std::string &uri,
     std::string &version)
 {
-  boost::tie(method, uri, version) = utils::http::get_request_line(
-      *conn,
-      boost::make_tuple(
-        method_name_length,
-        utils::get(tree, 1023, "general", "limits", "max_uri_length"),
-        sizeof("HTTP/1.1") - 1 + 5 // 5 additional chars for higher versions
-      ));
+  // the head is parsed in place, refilling the buffer until it is complete
+  parser.reset();
+  while (parser.parse(conn->data(), conn->size())
+          == utils::http::request_parser::REQUEST_LINE)
+  {
+    // the client may wait for the responses before sending more
+    flush_output();
+    if (!conn->fill())
+      throw utils::http::remote_close();
+  }
+
+  method = parser.method().str(conn->data());
+  uri = parser.uri().str(conn->data());
+  version = parser.version().str(conn->data());
 
   log->log(logger::info, "new-request");
   log->log(logger::info, "method", method);
@@ -349,24 +1190,35 @@ void http_connection::impl::read_request(
     throw 505;
   }
 
+  while (parser.parse(conn->data(), conn->size())
+          != utils::http::request_parser::DONE)
+  {
+    flush_output();
+    if (!conn->fill())
+      throw utils::http::remote_close();
+  }
+
   headers &request_headers = request_.get_headers();
 
-  request_headers.read_headers(*conn);
+  request_headers.read_headers(conn->data(), parser);
+  conn->consume(parser.consumed());
 }
 
 host const *http_connection::impl::get_host() {
-  boost::optional<std::string> host_header =
-    request_.get_headers().get_header("Host");
-
-  if (!host_header)
+  if (!request_.get_headers().find_header("Host", host_header))
     throw utils::http::bad_format();
 
-  host const *h = hosts.get_host(host_header.get());
+  // requests on a connection mostly name the same host
+  if (!memo_valid || host_header != memo_header) {
+    memo_host = hosts.get_host(host_header);
+    memo_header.swap(host_header);
+    memo_valid = true;
+  }
 
-  if (h)
-    request_.set_host(*h);
+  if (memo_host)
+    request_.set_host(*memo_host);
 
-  return h;
+  return memo_host;
 }
 
 int http_connection::impl::handle_modification_tags(
@@ -639,11 +1491,17 @@ int http_connection::impl::set_header_options() {
         it != tokens.end();
         ++it) {
       algo::to_lower(*it);
+      if (*it == "keep-alive" && flags.test(HTTP_1_0_COMPAT))
+        flags.set(HTTP_1_0_KEEP_ALIVE);
       if (*it == "close")
         open_flag = false;
       if (flags.test(HTTP_1_0_COMPAT))
         h.erase_header(*it);
     }
+    // HTTP/1.0 connections close unless the client asks otherwise
+    if (flags.test(HTTP_1_0_KEEP_ALIVE) &&
+        std::find(tokens.begin(), tokens.end(), "close") == tokens.end())
+      open_flag = true;
   }
 
 
@@ -765,8 +1623,9 @@ void http_connection::impl::check_ranges(response &resp) {
 int http_connection::impl::handle_entity(
     keywords &kw, det::responder_base *resp)
 {
-  // close the connection after each request with an entity so that
-  // we don't have to consume everything just to get the next request
+  // the connection is only kept open if the entity can be drained after
+  // the response, that is if it was set up completely
+  bool const keep_open = open_flag;
   open_flag = false;
 
   headers &h = request_.get_headers();
@@ -779,7 +1638,7 @@ int http_connection::impl::handle_entity(
     max_size = utils::get(tree, boost::uint64_t(0),
                           "general", "limits", "max_entity_size");
 
-  encoding::input_chain input;
+  encoding::input_chain &input = entity_chain;
 
   boost::optional<std::string> content_encoding =
     h.get_header("Content-Encoding");
@@ -800,6 +1659,21 @@ int http_connection::impl::handle_entity(
     }
   }
 
+  if (direct_entity) {
+    // complete already, framed by the protocol it came with
+    if (max_size && direct_entity->size() > max_size)
+      return 413;
+    if (!resp->allow_entity(content_type))
+      return 415;
+    input.push(
+      io::array_source(direct_entity->data(), direct_entity->size()));
+    entity.reset(new io::stream<encoding::input_chain>(boost::ref(input)));
+    input_stream pstream(*entity);
+    kw.set_entity(pstream, content_type);
+    open_flag = keep_open;
+    return 0;
+  }
+
   boost::optional<std::string> transfer_encoding =
     h.get_header("Transfer-Encoding");
 
@@ -816,6 +1690,12 @@ int http_connection::impl::handle_entity(
         if (it != --te.end())
           return 400;
         chunked = true;
+        // above the chunked_filter, which must not read beyond the last
+        // chunk
+        if (max_size)
+          input.push(utils::length_filter(max_size));
+        entity_framing = input.size();
+        entity_chunked = true;
         input.push(utils::chunked_filter());
       } else {
         encoding *enc = obj_reg.find<encoding>(*it);
@@ -836,16 +1716,16 @@ int http_connection::impl::handle_entity(
     boost::uint64_t const length =
       boost::lexical_cast<boost::uint64_t>(content_length.get());
 
-    if (length == 0 && content_type.empty())
+    if (length == 0 && content_type.empty()) {
+      open_flag = keep_open;
       return 0;
+    }
 
     if (max_size && length > max_size)
       return 413;
 
+    entity_framing = input.size();
     input.push(utils::length_filter(length));
-
-  } else if (max_size) {
-    input.push(utils::length_filter(max_size));
   }
 
   if (!resp->allow_entity(content_type))
@@ -856,19 +1736,148 @@ int http_connection::impl::handle_entity(
     if (!expect.empty()) {
       if (!algo::iequals(expect, "100-continue"))
         return 417;
-      send(response(100), false);
+      // event-driven connections have the entity already
+      if (!output)
+        send(response(100), false);
     }
   }
 
   input.push(boost::ref(*conn), 0, 0);
 
-  input_stream pstream(
-    new io::stream<encoding::input_chain>(boost::ref(input)));
+  entity.reset(new io::stream<encoding::input_chain>(boost::ref(input)));
+  input_stream pstream(*entity);
   kw.set_entity(pstream, content_type);
 
+  open_flag = keep_open;
   return 0;
 }
 
+// Reads what the responder left of the entity so that the next request can
+// follow on the same connection. The connection is closed instead if more
+// than /general/limits/max_unread_entity is left or the entity is cut short
+// or malformed.
+void http_connection::impl::drain_entity() {
+  if (!entity.get())
+    return;
+
+  if (!open_flag) {
+    close_entity();
+    return;
+  }
+
+  boost::uint64_t drained = 0;
+
+  if (!entity_chunked) {
+    // the length is known: skip the rest without decoding it
+    boost::uint64_t left =
+      entity_chain.component<utils::length_filter>(entity_framing)
+        ->remaining();
+    if (left > max_unread_entity) {
+      open_flag = false;
+    } else {
+      while (left > 0) {
+        if (conn->size() == 0 && !conn->fill()) {
+          open_flag = false;
+          break;
+        }
+        std::size_t n = std::min(boost::uint64_t(conn->size()), left);
+        conn->consume(n);
+        left -= n;
+        drained += n;
+      }
+    }
+  } else {
+    char buf[4096];
+    while (*entity && drained <= max_unread_entity) {
+      entity->read(buf, sizeof(buf));
+      drained += entity->gcount();
+    }
+
+    if (drained > max_unread_entity || entity->bad() ||
+        !entity_chain.component<utils::chunked_filter>(entity_framing)
+          ->finished())
+    {
+      open_flag = false;
+    } else {
+      // the trailer, up to the empty line
+      for (;;) {
+        char const *nl = static_cast<char const *>(
+          std::memchr(conn->data(), '\n', conn->size()));
+        if (!nl) {
+          if (conn->size() > max_unread_entity || !conn->fill()) {
+            open_flag = false;
+            break;
+          }
+          continue;
+        }
+        std::size_t line = nl - conn->data() + 1;
+        conn->consume(line);
+        if (line <= 2)
+          break;
+      }
+    }
+  }
+
+  log->log(logger::info, "entity-drained", drained);
+  log->flush();
+
+  close_entity();
+}
+
+void http_connection::impl::close_entity() {
+  entity.reset();
+  entity_chain.reset();
+  entity_framing = -1;
+  entity_chunked = false;
+}
+
+// Provides the encoded entity from the cache (or encodes it once and stores
+// it there) if the response has an ETag identifying its contents.
+void http_connection::impl::use_encoding_cache(response &resp) {
+  encoding_cache_t &cache = encoding_cache();
+  if (cache.budget() == 0 || flags.test(NO_ENTITY) || !ranges.empty())
+    return;
+
+  int code = resp.get_code();
+  if (code != -1 && code != 200)
+    return;
+
+  encoding *enc = resp.choose_content_encoding(encodings, false);
+  if (enc->is_identity() || resp.has_content_encoding(enc))
+    return;
+
+  boost::optional<std::string> etag = resp.get_headers().get_header("ETag");
+  if (!etag)
+    return;
+
+  std::string key;
+  host_key(key);
+  key += request_.get_uri();
+  key += '\n';
+  key += etag.get();
+  key += '\n';
+  key += enc->name();
+
+  if (std::string const *data = cache.find(key)) {
+    resp.set_data(*data, enc);
+    return;
+  }
+
+  // only what fits into the cache anyway is encoded in memory
+  boost::int64_t length = resp.length();
+  if (length < 0 || boost::uint64_t(length) > cache.budget())
+    return;
+
+  std::string data;
+  {
+    io::stream<io::back_insert_device<std::string> > out(data);
+    resp.print_entity(*out.rdbuf(), enc, false);
+    io::flush(out);
+  }
+  cache.insert(key, data, key.size() + data.size());
+  resp.set_data(data, enc);
+}
+
 void http_connection::impl::send(response r) {
   send(r, !flags.test(NO_ENTITY));
 }
@@ -876,7 +1885,11 @@ void http_connection::impl::send(response r) {
 void http_connection::impl::send(response r, bool entity) {
   headers &h = r.get_headers();
 
-  io::stream<utils::no_flush_writer> out(conn.get());
+  // the head is rendered completely before anything is written so that it
+  // can go out together with the entity
+  std::string head;
+  head.reserve(512);
+  io::stream<io::back_insert_device<std::string> > out(head);
 
   if (flags.test(HTTP_1_0_COMPAT))
     out << "HTTP/1.0 ";
@@ -895,32 +1908,199 @@ void http_connection::impl::send(response r, bool entity) {
   if (code >= 400)
     open_flag = false;
 
-  if (!flags.test(HTTP_1_0_COMPAT) && !open_flag && code != 100)
+  bool may_chunk = !flags.test(HTTP_1_0_COMPAT);
+  encoding *enc = entity_headers(r, entity);
+
+  if (enc && (!ranges.empty() || r.chunked(enc))) {
+    if (may_chunk)
+      h.set_header("Transfer-Encoding", "chunked");
+    else
+      open_flag = false; // HTTP/1.0: the end of the entity is the close
+  }
+
+  if (flags.test(HTTP_1_0_COMPAT)) {
+    if (open_flag)
+      h.add_header_part("Connection", "keep-alive", false);
+  } else if (!open_flag && code != 100) {
     h.add_header_part("Connection", "close", false);
+  }
+
+  r.print_headers(out);
+  io::flush(out);
+
+  unsigned long writes = socket ? socket->write_calls() : 0;
 
+  // the next request is waiting already (pipelining): the response can go
+  // out together with the following ones
+  bool const defer =
+    socket && open_flag && !this->entity.get() && head_buffered();
+
+  if (!pending_output.empty()) {
+    head.insert(0, pending_output);
+    pending_output.clear();
+  }
+
+  if (!send_direct(r, enc, may_chunk, head, defer)) {
+    cork_guard cork(socket);
+    io::stream<entity_writer> out(conn.get(), socket);
+    utils::write_string(out, head);
+    if (enc)
+      r.print_entity(*out.rdbuf(), enc, may_chunk, ranges);
+    io::flush(out);
+  }
+
+  if (socket) {
+    log->log(logger::info, "http-response-writes",
+             socket->write_calls() - writes);
+    log->flush();
+  }
+}
+
+// Sets the Server header and those describing the entity. Returns the
+// encoding of the entity, 0 if there is none.
+encoding *http_connection::impl::entity_headers(response &r, bool entity) {
+  headers &h = r.get_headers();
   h.set_header("Server", servername);
+  if (!entity)
+    return 0;
+
+  encoding *enc = r.choose_content_encoding(encodings, !ranges.empty());
 
-  if (entity) {
-    bool may_chunk = !flags.test(HTTP_1_0_COMPAT);
+  if (!enc->is_identity())
+    h.set_header("Content-Encoding", enc->name());
 
-    encoding *enc = r.choose_content_encoding(encodings, !ranges.empty());
+  if (ranges.empty() && !r.chunked(enc))
+    h.set_header("Content-Length", r.length(enc));
+  return enc;
+}
+
+// Writes the head and an entity held in memory (`enc' is 0 for none) with a
+// single writev on plain connections, or keeps them in pending_output if
+// `defer' is set and the responses collected so far are small. Files are
+// sent with sendfile. Event-driven connections queue them.
+bool http_connection::impl::send_direct(
+    response &r, encoding *enc, bool may_chunk, std::string &head, bool defer)
+{
+  if (!socket && !output)
+    return false;
+
+  std::string const *data = 0;
+  if (enc) {
+    data = ranges.empty() ? r.get_string(enc) : 0;
+    if (!data)
+      return send_file(r, enc, may_chunk, head);
+  }
+
+  if (output) {
+    // goes out as the socket takes it
+    output->append(head);
+    if (data)
+      output->append(*data);
+    return true;
+  }
+
+  std::size_t const size = head.size() + (data ? data->size() : 0);
+  if (defer && size < PIPELINE_FLUSH_SIZE) {
+    pending_output.swap(head);
+    if (data)
+      pending_output += *data;
+    return true;
+  }
+
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<char *>(head.data());
+  iov[0].iov_len = head.size();
+  int count = 1;
+
+  if (data) {
+    iov[1].iov_base = const_cast<char *>(data->data());
+    iov[1].iov_len = data->size();
+    ++count;
+  }
 
+  if (socket->write(iov, count) < 0)
+    open_flag = false;
+  return true;
+}
+
+// whether the buffered input holds the complete head of another request
+// (leftover line ends between requests do not count)
+bool http_connection::impl::head_buffered() const {
+  char const *begin = conn->data();
+  char const *end = begin + conn->size();
+  while (begin != end && (*begin == '\r' || *begin == '\n'))
+    ++begin;
+  char const crlfcrlf[] = "\r\n\r\n";
+  return begin != end && std::search(begin, end, crlfcrlf, crlfcrlf + 4) != end;
+}
+
+void http_connection::impl::flush_output() {
+  if (pending_output.empty())
+    return;
+  if (socket->write(pending_output.data(), pending_output.size()) < 0)
+    open_flag = false;
+  pending_output.clear();
+}
+
+// Sends a file entity directly from the file to the socket, or queues the
+// part of the file on event-driven connections. Multiple ranges go through
+// print_entity.
+bool http_connection::impl::send_file(
+    response &r, encoding *enc, bool may_chunk, std::string &head)
+{
+  if (ranges.size() > 1)
+    return false;
+
+  int fd;
+  boost::int64_t offset;
+  if (!r.get_file(enc, fd, offset))
+    return false;
+
+  boost::int64_t length = r.length(enc);
+  bool chunk = false;
+
+  if (!ranges.empty()) {
     if (!enc->is_identity())
-      h.set_header("Content-Encoding", enc->name());
+      return false;
 
-    if (ranges.empty() && !r.chunked(enc))
-      h.set_header("Content-Length", r.length(enc));
-    else if (may_chunk)
-      h.set_header("Transfer-Encoding", "chunked");
+    std::pair<boost::int64_t, boost::int64_t> x = ranges[0];
+    if (x.first < 0)
+      x.first = 0;
+    if (x.second < 0)
+      x.second = length;
 
-    r.print_headers(out);
-    r.print_entity(*out.rdbuf(), enc, may_chunk, ranges);
-  } else {
-    r.print_headers(out);
+    offset += x.first;
+    length = x.second - x.first;
+    chunk = may_chunk;
   }
 
-  io::flush(out);
-  out->real_flush();
+  if (chunk && length > 0)
+    head += (boost::format("%1$x\r\n") % length).str();
+
+  if (output) {
+    output->append(head);
+    if (length > 0)
+      output->append_file(fd, offset, length);
+    if (chunk)
+      output->append(length > 0 ? "\r\n0\r\n\r\n" : "0\r\n\r\n");
+    return true;
+  }
+
+  cork_guard cork(socket);
+  if (socket->write(head.data(), head.size()) < 0 ||
+      (length > 0 && socket->send_file(fd, offset, length) != length))
+  {
+    open_flag = false;
+    return true;
+  }
+
+  if (chunk) {
+    std::string const trailer(length > 0 ? "\r\n0\r\n\r\n" : "0\r\n\r\n");
+    if (socket->write(trailer.data(), trailer.size()) < 0)
+      open_flag = false;
+  }
+
+  return true;
 }
 // Local Variables: **
 // mode: C++ **
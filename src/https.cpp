@@ -7,8 +7,12 @@
 #include "rest/socket_param.hpp"
 #include "rest/http_connection.hpp"
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/bind.hpp>
 #include <cassert>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
 
 using rest::https_scheme;
 
@@ -19,7 +23,14 @@ public:
   struct context {
     boost::shared_ptr<tls::x509_certificate_credentials> cred;
     boost::shared_ptr<tls::priority> prio;
+    bool http2;
   };
+
+  // `http2': whether "h2" may be offered, if configured; `blocking': for
+  // serve(), the handshake is done right away and the socket times out (the
+  // event engines keep their own timers)
+  static std::auto_ptr<std::streambuf> open(
+    int connfd, socket_param const &sock, bool http2, bool blocking);
 };
 
 https_scheme::https_scheme()
@@ -103,11 +114,39 @@ boost::any https_scheme::create_context(
                                 "tls", "priority");
 
   x.prio.reset(new tls::priority(prio.c_str()));
+
+  x.http2 = utils::get(socket_data, false, "tls", "http2");
   log->log(logger::notice, "end tls-initialisation");
 
   return boost::any(x);
 }
 
+namespace {
+  struct session_holder {
+    boost::scoped_ptr<rest::tls::session> session;
+
+    session_holder(rest::tls::session *s) : session(s) {}
+  };
+
+  // stream buffer owning its TLS session
+  class session_stream_buffer
+    : private session_holder, public rest::tls::stream_buffer
+  {
+  public:
+    session_stream_buffer(rest::tls::session *s)
+      : session_holder(s), rest::tls::stream_buffer(rest::tls::device(*s))
+    {}
+
+    rest::tls::session &get_session() {
+      return *session;
+    }
+  };
+
+  rest::tls::session &get_session(std::streambuf &conn) {
+    return static_cast<session_stream_buffer &>(conn).get_session();
+  }
+}
+
 void https_scheme::serve(
   logger *log,
   int connfd,
@@ -115,8 +154,24 @@ void https_scheme::serve(
   network::address const &addr,
   std::string const &servername)
 {
-  long timeout_rd = sock.timeout_read();
-  long timeout_wr = sock.timeout_write();
+  http_connection conn(sock.hosts(), addr, servername, log);
+  conn.serve(impl::open(connfd, sock, true, true));
+}
+
+// Event-driven connections only speak HTTP/1.1: an HTTP/2 connection is
+// served until it closes and would occupy the worker. Their socket does not
+// block, the handshake is done by handshake().
+std::auto_ptr<std::streambuf> https_scheme::open(
+  logger *, int connfd, socket_param const &sock)
+{
+  return impl::open(connfd, sock, false, false);
+}
+
+std::auto_ptr<std::streambuf> https_scheme::impl::open(
+  int connfd, socket_param const &sock, bool http2, bool blocking)
+{
+  long timeout_rd = blocking ? sock.timeout_read() : 0;
+  long timeout_wr = blocking ? sock.timeout_write() : 0;
 
   struct timeval timeout;
   timeout.tv_usec = 0;
@@ -134,11 +189,34 @@ void https_scheme::serve(
   boost::any const &scheme_specific = sock.scheme_specific();
   impl::context x = boost::any_cast<impl::context>(scheme_specific);
 
-  http_connection conn(sock.hosts(), addr, servername, log);
-  tls::session session(*x.cred, *x.prio, connfd);
-  std::auto_ptr<std::streambuf> p(new tls::stream_buffer(session));
+  return std::auto_ptr<std::streambuf>(
+    new session_stream_buffer(
+      new tls::session(
+        *x.cred, *x.prio, connfd, http2 && x.http2, blocking)));
+}
+
+bool https_scheme::handshake(int, std::streambuf &conn, bool &want_write) {
+  return get_session(conn).handshake(want_write);
+}
 
-  conn.serve(p);
+std::streamsize https_scheme::read(
+  int, std::streambuf &conn, char *buf, std::streamsize n)
+{
+  return get_session(conn).read_some(buf, n);
+}
+
+std::streamsize https_scheme::write(
+  int, std::streambuf &conn, char const *buf, std::streamsize n)
+{
+  return get_session(conn).write_some(buf, n);
+}
+
+// file data is encrypted on its way
+boost::int64_t https_scheme::send_file(
+  int, std::streambuf &, int, boost::int64_t, boost::int64_t)
+{
+  errno = ENOSYS;
+  return -1;
 }
 
 // Local Variables: **
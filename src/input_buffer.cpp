@@ -0,0 +1,102 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/input_buffer.hpp"
+#include <algorithm>
+#include <cstring>
+
+using rest::utils::input_buffer;
+
+namespace {
+  // bytes kept in front of the unread data for putback
+  std::size_t const PUTBACK = 4;
+}
+
+input_buffer::input_buffer(
+    std::auto_ptr<std::streambuf> next_, std::size_t initial_size)
+  : next(next_), buffer(std::max(initial_size, 2 * PUTBACK))
+{
+  setg(&buffer[0], &buffer[0], &buffer[0]);
+}
+
+input_buffer::~input_buffer() {
+}
+
+bool input_buffer::fill() {
+  char *end = prepare(1);
+
+  std::streamsize n = next->in_avail();
+  if (n <= 0) {
+    if (next->sgetc() == traits_type::eof())
+      return false;
+    n = std::max(next->in_avail(), std::streamsize(1));
+  }
+  n = std::min(n, std::streamsize(&buffer[0] + buffer.size() - end));
+  n = next->sgetn(end, n);
+  if (n <= 0)
+    return false;
+
+  commit(std::size_t(n));
+  return true;
+}
+
+char *input_buffer::prepare(std::size_t n) {
+  std::size_t avail = size();
+  std::size_t keep = std::min(std::size_t(gptr() - eback()), PUTBACK);
+
+  // move the unread data (and the putback area) to the front, grow if that
+  // does not leave room enough
+  if (keep + avail + n > buffer.size()) {
+    std::size_t size = 2 * buffer.size();
+    while (keep + avail + n > size)
+      size *= 2;
+    std::vector<char> grown(size);
+    std::memcpy(&grown[0], gptr() - keep, keep + avail);
+    buffer.swap(grown);
+  } else if (gptr() - keep != &buffer[0]) {
+    std::memmove(&buffer[0], gptr() - keep, keep + avail);
+  }
+  char *begin = &buffer[0];
+  setg(begin, begin + keep, begin + keep + avail);
+  return egptr();
+}
+
+void input_buffer::commit(std::size_t n) {
+  setg(eback(), gptr(), egptr() + n);
+}
+
+void input_buffer::consume(std::size_t n) {
+  gbump(int(std::min(n, size())));
+}
+
+input_buffer::int_type input_buffer::underflow() {
+  if (gptr() == egptr() && !fill())
+    return traits_type::eof();
+  return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize input_buffer::xsgetn(char_type *s, std::streamsize n) {
+  std::streamsize done = std::min(n, std::streamsize(size()));
+  std::memcpy(s, gptr(), done);
+  gbump(int(done));
+  // bypass the buffer for the rest
+  if (done < n)
+    done += next->sgetn(s + done, n - done);
+  return done;
+}
+
+std::streamsize input_buffer::showmanyc() {
+  return next->in_avail();
+}
+
+input_buffer::int_type input_buffer::overflow(int_type c) {
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  return next->sputc(traits_type::to_char_type(c));
+}
+
+std::streamsize input_buffer::xsputn(char_type const *s, std::streamsize n) {
+  return next->sputn(s, n);
+}
+
+int input_buffer::sync() {
+  return next->pubsync();
+}
@@ -13,11 +13,12 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <boost/tokenizer.hpp>
-#include <boost/bind.hpp>
 #include <stdexcept>
 #include <sstream>
 #include <map>
 #include <set>
+#include <deque>
+#include <vector>
 #include <limits>
 #include <cstdio>
 #include <cctype>
@@ -29,7 +30,8 @@ namespace io = boost::iostreams;
 
 namespace {
   struct keyword_data {
-    enum state_t { s_normal, s_prepared, s_unset = -1 };
+    // s_request: HEADER or COOKIE keyword not read from the request yet
+    enum state_t { s_normal, s_prepared, s_request, s_unset = -1 };
 
     keyword_data(keyword_type type = NORMAL)
     : type(type), state(s_unset)
@@ -61,11 +63,35 @@ namespace {
         input_stream(new std::istringstream(data)).move(stream);
     }
 
+    void clear() {
+      state = s_unset;
+      name.clear();
+      mime.clear();
+      data.clear();
+      value = boost::any();
+      stream.reset();
+      output.reset();
+    }
+
+    // takes over the state of `o', leaving it cleared
+    void take(keyword_data &o) {
+      type = o.type;
+      state = o.state;
+      name.swap(o.name);
+      mime.swap(o.mime);
+      data.swap(o.data);
+      value.swap(o.value);
+      o.stream.move(stream);
+      o.output.move(output);
+      o.clear();
+    }
+
     keyword_type type;
     state_t state;
     std::string name;
     std::string mime;
     std::string data;
+    boost::any value; // of typed closures, converted from data
     input_stream stream;
     output_stream output;
   };
@@ -91,20 +117,133 @@ namespace {
   }
 }
 
+class keyword_layout::impl {
+public:
+  typedef boost::unordered_map<
+      std::string, std::size_t,
+      rest::utils::string_ihash,
+      rest::utils::string_iequals
+    > index_t;
+
+  std::vector<std::pair<std::string, keyword_type> > slots;
+  index_t index;
+};
+
+keyword_layout::keyword_layout() : p(new impl) {}
+
+keyword_layout::~keyword_layout() {}
+
+keyword_slot keyword_layout::add(std::string const &name, keyword_type type) {
+  std::size_t const slot = p->slots.size();
+  if (!p->index.insert(std::make_pair(name, slot)).second)
+    throw std::logic_error("keyword already declared");
+  p->slots.push_back(std::make_pair(name, type));
+  return keyword_slot(name, this, slot);
+}
+
+int keyword_layout::find(std::string const &name) const {
+  impl::index_t::const_iterator it = p->index.find(name);
+  return it == p->index.end() ? -1 : int(it->second);
+}
+
+std::size_t keyword_layout::size() const {
+  return p->slots.size();
+}
+
+std::string const &keyword_layout::name(std::size_t slot) const {
+  return p->slots[slot].first;
+}
+
+keyword_type keyword_layout::type(std::size_t slot) const {
+  return p->slots[slot].second;
+}
+
 class keywords::impl {
 public:
   typedef boost::unordered_map<keyword_index, keyword_data> data_t;
 
+  // the keywords not in slots
   data_t data;
 
-  data_t::iterator find(std::string const &keyword, int index) {
+  // the keywords of `layout' at index 0, by slot
+  keyword_layout const *layout;
+  std::deque<keyword_data> slots;
+
+  // where HEADER and COOKIE keywords are read from
+  request const *req;
+  bool cookies_read;
+  std::vector<cookie> cookies;
+
+  // 0 if not declared
+  keyword_data *lookup(std::string const &keyword, int index) {
+    if (index == 0 && layout) {
+      int slot = layout->find(keyword);
+      if (slot >= 0 && std::size_t(slot) < slots.size())
+        return &slots[slot];
+    }
     data_t::iterator it = data.find(keyword_index(keyword, index));
-    if (it == data.end()) {
-      std::ostringstream x;
-      x << "invalid keyword (" << keyword << ',' << index << ')';
-      throw std::logic_error(x.str());
+    return it == data.end() ? 0 : &it->second;
+  }
+
+  keyword_data &find(std::string const &keyword, int index) {
+    keyword_data *x = lookup(keyword, index);
+    if (!x) {
+      std::ostringstream s;
+      s << "invalid keyword (" << keyword << ',' << index << ')';
+      throw std::logic_error(s.str());
+    }
+    fetch(keyword, *x);
+    return *x;
+  }
+
+  // declared as `type' if new
+  keyword_data &insert(
+      std::string const &keyword, int index, keyword_type type = NORMAL)
+  {
+    keyword_data *x = lookup(keyword, index);
+    if (x)
+      return *x;
+    return data.insert(std::make_pair(
+        keyword_index(keyword, index), keyword_data(type)
+      )).first->second;
+  }
+
+  keyword_data *slot(keyword_slot const &s) {
+    if (s.layout == layout && s.index < slots.size()) {
+      fetch(s.name, slots[s.index]);
+      return &slots[s.index];
+    }
+    return 0;
+  }
+
+  // reads a keyword pending from the request
+  void fetch(std::string const &keyword, keyword_data &x) {
+    if (x.state != keyword_data::s_request)
+      return;
+    x.state = keyword_data::s_unset;
+    if (x.type == HEADER) {
+      if (req->get_headers().find_header(keyword, x.data))
+        x.state = keyword_data::s_normal;
+      return;
+    }
+
+    if (!cookies_read) {
+      cookies_read = true;
+      std::string header;
+      if (req->get_headers().find_header("Cookie", header))
+        utils::http::parse_cookie_header(header, cookies);
+    }
+    // the last one counts
+    for (std::vector<cookie>::reverse_iterator it = cookies.rbegin();
+        it != cookies.rend();
+        ++it)
+    {
+      if (rest::utils::string_iequals()(it->name, keyword)) {
+        x.data = it->value;
+        x.state = keyword_data::s_normal;
+        break;
+      }
     }
-    return it;
   }
 
   input_stream entity;
@@ -127,7 +266,8 @@ public:
 
     element.reset(new io::filtering_istream);
 
-    element->push(utils::boundary_filter("\r\n" + boundary));
+    element->push(
+      utils::boundary_filter("\r\n" + boundary, entity->rdbuf()));
     element->push(boost::ref(*entity), 0, 0);
 
     return true;
@@ -168,26 +308,24 @@ public:
   }
 
   void prepare_element(bool read) {
-    data_t::iterator it = find_next_form(next_name);
+    keyword_data *x = find_next_form(next_name);
 
-    if (it == data.end()) {
+    if (!x) {
       element->ignore(std::numeric_limits<int>::max());
       element.reset();
       return;
     }
 
-    keyword_data &x = it->second;
-
-    x.name = next_filename;
-    x.mime = next_filetype;
-    input_stream(element.release()).move(x.stream);
-    x.state = keyword_data::s_prepared;
+    x->name = next_filename;
+    x->mime = next_filetype;
+    input_stream(element.release()).move(x->stream);
+    x->state = keyword_data::s_prepared;
 
     if (read) {
       last = 0;
-      x.read();
+      x->read();
     } else {
-      last = &x;
+      last = x;
     }
   }
 
@@ -206,42 +344,68 @@ public:
     return false;
   }
 
-  void read_until(keyword_index const &next_index, keyword_data &next_data) {
+  void read_until(std::string const &next, keyword_data &next_data) {
     if (next_data.state != keyword_data::s_unset)
       return;
-    if (!read_until(next_index.keyword))
+    if (!read_until(next))
       next_data.state = keyword_data::s_normal;
   }
 
   void unread_form() {
+    for (std::size_t i = 0; i < slots.size(); ++i)
+      if (slots[i].type == FORM_PARAMETER)
+        slots[i].state = keyword_data::s_unset;
     for (data_t::iterator it = data.begin(); it != data.end(); ++it)
       if (it->second.type == FORM_PARAMETER)
         it->second.state = keyword_data::s_unset;
   }
 
-  data_t::iterator find_next_form(std::string const &name) {
-    data_t::iterator it;
+  keyword_data *find_next_form(std::string const &name) {
+    keyword_data *x;
 
     int i = 0;
     for (;;) {
-      it = data.find(keyword_index(name, i++));
-      if (it == data.end())
-        break;
-      if (it->second.type != FORM_PARAMETER)
-        return data.end();
-      if (it->second.state == keyword_data::s_unset)
+      x = lookup(name, i++);
+      if (!x)
         break;
+      if (x->type != FORM_PARAMETER)
+        return 0;
+      if (x->state == keyword_data::s_unset)
+        return x;
     }
 
-    if (it == data.end() && i > 1)
-      it = data.insert(
+    if (i > 1)
+      x = &data.insert(
           std::make_pair(keyword_index(name, i-1), keyword_data(FORM_PARAMETER))
-        ).first;
+        ).first->second;
+
+    return x;
+  }
+
+  void merge(std::string const &keyword, int index, keyword_data const &from) {
+    if (from.state == keyword_data::s_unset)
+      return;
+    keyword_data &x = insert(keyword, index, from.type);
+    x.type = from.type;
+    x.state = from.state;
+    x.name = from.name;
+    x.mime = from.mime;
+    x.data = from.data;
+    x.value = from.value;
+  }
 
-    return it;
+  static void check_type(
+      std::string const &keyword, int index,
+      keyword_data const &x, keyword_type type)
+  {
+    if (x.type != type) {
+      std::ostringstream s;
+      s << "inconsistent keyword type (" << keyword << ',' << index << ')';
+      throw std::logic_error(s.str());
+    }
   }
 
-  impl() : last(0) {}
+  impl() : layout(0), req(0), cookies_read(false), last(0) {}
 };
 
 keywords::keywords() : p(new impl) {
@@ -250,61 +414,132 @@ keywords::keywords() : p(new impl) {
 keywords::~keywords() {
 }
 
-bool keywords::exists(std::string const &keyword, int index) const {
-  impl::data_t::iterator it = p->data.find(keyword_index(keyword, index));
-  if (it == p->data.end()) {
-    p->read_until(keyword);
-    it = p->data.find(keyword_index(keyword, index));
+void keywords::prepare(keyword_layout const &layout) {
+  if (p->layout != &layout) {
+    // values already set in the slots of another layout are kept by name,
+    // its declarations are not
+    for (std::size_t i = 0; p->layout && i < p->slots.size(); ++i) {
+      keyword_data &x = p->slots[i];
+      if (x.state == keyword_data::s_unset)
+        continue;
+      p->data.insert(std::make_pair(
+          keyword_index(p->layout->name(i), 0), keyword_data(x.type)
+        )).first->second.take(x);
+    }
+    // the storage is reused whatever the slots held, slots beyond the
+    // layout stay cleared for the next one
+    for (std::size_t i = 0; i < p->slots.size(); ++i) {
+      p->slots[i].clear();
+      if (i < layout.size())
+        p->slots[i].type = layout.type(i);
+    }
+    p->layout = &layout;
   }
-  return it != p->data.end();
+
+  for (std::size_t i = p->slots.size(); i < layout.size(); ++i)
+    p->slots.push_back(keyword_data(layout.type(i)));
+
+  // declared by name before, closures for example
+  for (impl::data_t::iterator it = p->data.begin(); it != p->data.end();) {
+    int slot = it->first.index == 0 ? layout.find(it->first.keyword) : -1;
+    if (slot < 0) {
+      ++it;
+      continue;
+    }
+    keyword_data &x = p->slots[slot];
+    impl::check_type(it->first.keyword, 0, it->second, x.type);
+    x.take(it->second);
+    it = p->data.erase(it);
+  }
+}
+
+void keywords::reset() {
+  // the layout may be gone by the next request, and must be prepared again
+  for (std::size_t i = 0; i < p->slots.size(); ++i)
+    p->slots[i].clear();
+  p->layout = 0;
+  p->data.clear();
+  p->last = 0;
+  p->element.reset();
+  p->entity.reset();
+  p->boundary.clear();
+  p->req = 0;
+  p->cookies_read = false;
+  p->cookies.clear();
+}
+
+bool keywords::exists(std::string const &keyword, int index) const {
+  if (p->lookup(keyword, index))
+    return true;
+  p->read_until(keyword);
+  return p->lookup(keyword, index);
 }
 
 std::string &keywords::access(std::string const &keyword, int index) {
-  impl::data_t::iterator it = p->find(keyword, index);
-  p->read_until(it->first, it->second);
-  it->second.read();
-  return it->second.data;
+  keyword_data &x = p->find(keyword, index);
+  p->read_until(keyword, x);
+  x.read();
+  return x.data;
+}
+
+std::string &keywords::access(keyword_slot const &slot) {
+  keyword_data *x = p->slot(slot);
+  if (!x)
+    return access(slot.get_name());
+  p->read_until(slot.get_name(), *x);
+  x->read();
+  return x->data;
 }
 
 bool keywords::is_set(std::string const &keyword, int index) const {
-  impl::data_t::iterator it = p->find(keyword, index);
-  return it->second.state != keyword_data::s_unset;
+  return p->find(keyword, index).state != keyword_data::s_unset;
+}
+
+bool keywords::is_set(keyword_slot const &slot) const {
+  keyword_data *x = p->slot(slot);
+  if (!x)
+    return is_set(slot.get_name());
+  return x->state != keyword_data::s_unset;
 }
 
 void keywords::declare(
     std::string const &keyword, int index, keyword_type type)
 {
-  impl::data_t::iterator it =
-    p->data.insert(std::make_pair(
-        keyword_index(keyword, index), keyword_type(type))
-      ).first;
-
-  if (it->second.type != type) {
-    std::ostringstream x;
-    x << "inconsistent keyword type (" << keyword << ',' << index << ')';
-    throw std::logic_error(x.str());
-  }
+  impl::check_type(keyword, index, p->insert(keyword, index, type), type);
 }
 
 keyword_type keywords::get_declared_type(
     std::string const &keyword, int index) const
 {
-  impl::data_t::iterator it = p->data.find(keyword_index(keyword, index));
-  if (it == p->data.end())
+  keyword_data *x = p->lookup(keyword, index);
+  if (!x)
     return NONE;
-  return it->second.type;
+  return x->type;
 }
 
 void keywords::set(
     std::string const &keyword, int index, std::string const &data)
 {
-  impl::data_t::iterator it = p->data.insert(std::make_pair(
-      keyword_index(keyword, index), keyword_data()
-    )).first;
+  keyword_data &x = p->insert(keyword, index);
+  x.state = keyword_data::s_normal;
+  x.data = data;
+  x.value = boost::any();
+  x.stream.reset();
+}
 
-  it->second.state = keyword_data::s_normal;
-  it->second.data = data;
-  it->second.stream.reset();
+void keywords::set_value(
+    std::string const &keyword, int index, boost::any const &value)
+{
+  p->find(keyword, index).value = value;
+}
+
+boost::any const *keywords::get_value(
+    std::string const &keyword, int index) const
+{
+  keyword_data *x = p->lookup(keyword, index);
+  if (!x || x->value.empty())
+    return 0;
+  return &x->value;
 }
 
 void keywords::set_with_type(
@@ -313,57 +548,54 @@ void keywords::set_with_type(
     int index,
     std::string const &data)
 {
-  impl::data_t::iterator it = p->data.find(keyword_index(keyword, index));
-  if (it == p->data.end())
-    return;
-  if (it->second.type != type)
+  keyword_data *x = p->lookup(keyword, index);
+  if (!x || x->type != type)
     return;
- 
-  it->second.state = keyword_data::s_normal;
-  it->second.data = data;
-  it->second.stream.reset();
+
+  x->state = keyword_data::s_normal;
+  x->data = data;
+  x->value = boost::any();
+  x->stream.reset();
 }
 
 void keywords::set_stream(
     std::string const &keyword, int index, input_stream &stream)
 {
-  impl::data_t::iterator it = p->data.insert(std::make_pair(
-      keyword_index(keyword, index), keyword_data())
-    ).first;
-
-  it->second.state = keyword_data::s_normal;
-  stream.move(it->second.stream);
-  it->second.data.clear();
+  keyword_data &x = p->insert(keyword, index);
+  x.state = keyword_data::s_normal;
+  stream.move(x.stream);
+  x.data.clear();
+  x.value = boost::any();
 }
 
 void keywords::set_name(
     std::string const &keyword, int index, std::string const &name)
 {
-  impl::data_t::iterator it = p->find(keyword, index);
-  it->second.name = name;
+  p->find(keyword, index).name = name;
 }
 
 void keywords::unset(std::string const &keyword, int index) {
-  impl::data_t::iterator it = p->find(keyword, index);
-  keyword_data &x = it->second;
-  x.state = keyword_data::s_unset;
-  x.name.clear();
-  x.mime.clear();
-  x.data.clear();
-  x.stream.reset();
-  x.output.reset();
+  p->find(keyword, index).clear();
 }
 
 std::string keywords::get_name(std::string const &keyword, int index) const {
-  impl::data_t::iterator it = p->find(keyword, index);
-  return it->second.name;
+  return p->find(keyword, index).name;
 }
 
 std::istream &keywords::read(std::string const &keyword, int index) {
-  impl::data_t::iterator it = p->find(keyword, index);
-  p->read_until(it->first, it->second);
-  it->second.write();
-  return *it->second.stream;
+  keyword_data &x = p->find(keyword, index);
+  p->read_until(keyword, x);
+  x.write();
+  return *x.stream;
+}
+
+std::istream &keywords::read(keyword_slot const &slot) {
+  keyword_data *x = p->slot(slot);
+  if (!x)
+    return read(slot.get_name());
+  p->read_until(slot.get_name(), *x);
+  x->write();
+  return *x->stream;
 }
 
 void keywords::set_entity(
@@ -384,7 +616,7 @@ void keywords::set_entity(
     // Strip preamble and first boundary
     {
       io::filtering_istream filt;
-      filt.push(utils::boundary_filter(p->boundary));
+      filt.push(utils::boundary_filter(p->boundary, p->entity->rdbuf()));
       filt.push(boost::ref(*p->entity), 0, 0);
       filt.ignore(std::numeric_limits<int>::max());
     }
@@ -398,17 +630,19 @@ void keywords::set_entity(
 
     add_uri_encoded(data);
   } else {
+    keyword_data *x = 0;
+    for (std::size_t i = 0; !x && i < p->slots.size(); ++i)
+      if (p->slots[i].type == ENTITY)
+        x = &p->slots[i];
     for (impl::data_t::iterator it = p->data.begin();
-        it != p->data.end();
+        !x && it != p->data.end();
         ++it)
-    {
-      keyword_data &x = it->second;
-      if (x.type == ENTITY) {
-        x.state = keyword_data::s_normal;
-        x.data.clear();
-        entity.move(x.stream);
-        break;
-      }
+      if (it->second.type == ENTITY)
+        x = &it->second;
+    if (x) {
+      x->state = keyword_data::s_normal;
+      x->data.clear();
+      entity.move(x->stream);
     }
     if (entity.get()) {
       entity->ignore(std::numeric_limits<int>::max());
@@ -429,42 +663,51 @@ void keywords::add_uri_encoded(std::string const &data) {
     std::string::const_iterator split = std::find(it->begin(), it->end(), '=');
     std::string key = uri::unescape(it->begin(), split, true);
 
-    impl::data_t::iterator el = p->find_next_form(key);
+    keyword_data *x = p->find_next_form(key);
 
-    if (el != p->data.end()) {
+    if (x) {
       if (split != it->end())
         ++split;
-      keyword_data &x = el->second;
-      x.state = keyword_data::s_prepared;
-      x.stream.reset();
-      x.data = uri::unescape(split, it->end(), true);
+      x->state = keyword_data::s_prepared;
+      x->stream.reset();
+      x->data = uri::unescape(split, it->end(), true);
     }
   }
 }
 
-void keywords::set_request_data(request const &req) {
-  headers const &h = req.get_headers();
-
-  h.for_each_header(
-    boost::bind(&keywords::set_with_type, this, HEADER, _1, _2));
-
-  boost::optional<std::string> cookie_ = h.get_header("Cookie");
-  if (cookie_) {
-    std::vector<cookie> cookies;
-    utils::http::parse_cookie_header(cookie_.get(), cookies);
+void keywords::merge(keywords const &other) {
+  impl &o = *other.p;
+  for (std::size_t i = 0; i < o.slots.size(); ++i) {
+    o.fetch(o.layout->name(i), o.slots[i]);
+    p->merge(o.layout->name(i), 0, o.slots[i]);
+  }
+  for (impl::data_t::iterator it = o.data.begin(); it != o.data.end(); ++it) {
+    o.fetch(it->first.keyword, it->second);
+    p->merge(it->first.keyword, it->first.index, it->second);
+  }
+}
 
-    for (std::vector<cookie>::iterator it = cookies.begin();
-        it != cookies.end();
-        ++it)
-      set_with_type(COOKIE, it->name, it->value);
+void keywords::set_request_data(request const &req) {
+  p->req = &req;
+  p->cookies_read = false;
+  p->cookies.clear();
+
+  for (std::size_t i = 0; i < p->slots.size(); ++i) {
+    keyword_data &x = p->slots[i];
+    if (x.type == HEADER || x.type == COOKIE)
+      x.state = keyword_data::s_request;
+  }
+  for (impl::data_t::iterator it = p->data.begin(); it != p->data.end(); ++it) {
+    keyword_data &x = it->second;
+    if (it->first.index == 0 && (x.type == HEADER || x.type == COOKIE))
+      x.state = keyword_data::s_request;
   }
 }
 
 void keywords::set_output(
     std::string const &keyword, int index, output_stream &stream)
 {
-  impl::data_t::iterator it = p->find(keyword, index);
-  stream.move(it->second.output);
+  stream.move(p->find(keyword, index).output);
 }
 
 void keywords::flush() {
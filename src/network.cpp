@@ -3,17 +3,32 @@
 #include <rest/socket_param.hpp>
 #include <rest/utils/exceptions.hpp>
 #include <cstddef>
+#include <cstring>
+#include <sstream>
 #include <boost/static_assert.hpp>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 
 const std::size_t MAX_IP_LEN = 41;
 
 std::string rest::network::ntoa(network::address const &a) {
+  if (a.type == local) {
+    if (a.addr.local.pid < 0)
+      return "unix";
+    std::ostringstream out;
+    out << "unix:pid=" << a.addr.local.pid << ",uid=" << a.addr.local.uid;
+    return out.str();
+  }
+
   char buf[MAX_IP_LEN] = { 0 };
   if(!::inet_ntop(a.type, &a.addr, buf, MAX_IP_LEN - 1))
     throw utils::errno_error("inet_ntop");
@@ -48,30 +63,134 @@ void rest::network::getaddrinfo(socket_param const &sock, addrinfo **res) {
                              gai_strerror(n));
 }
 
+namespace {
+  // accepted sockets are closed on exec like all others
+  int accept_cloexec(int fd, sockaddr *addr, socklen_t *len) {
+#ifdef SOCK_CLOEXEC
+    return ::accept4(fd, addr, len, SOCK_CLOEXEC);
+#else
+    int connfd = ::accept(fd, addr, len);
+    if (connfd >= 0)
+      ::fcntl(connfd, F_SETFD, FD_CLOEXEC);
+    return connfd;
+#endif
+  }
+}
+
 int rest::network::accept(socket_param const &sock, address &addr) {
-  int connfd = -1;
+  sockaddr_storage cliaddr;
+  socklen_t clilen = sizeof(cliaddr);
+  int connfd = accept_cloexec(sock.fd(), (sockaddr *) &cliaddr, &clilen);
+  if (connfd >= 0)
+    accepted(sock, connfd, (sockaddr const *) &cliaddr, addr);
+  return connfd;
+}
+
+void rest::network::accepted(
+    socket_param const &sock, int connfd, sockaddr const *from, address &addr)
+{
   switch ((addr.type = sock.socket_type())) {
   case network::ip4: {
-      sockaddr_in cliaddr;
-      socklen_t clilen = sizeof(cliaddr);
-      connfd = ::accept(sock.fd(), (sockaddr *) &cliaddr, &clilen);
-      BOOST_STATIC_ASSERT((sizeof(addr.addr.ip4) == sizeof(cliaddr.sin_addr)));
-      std::memcpy(&addr.addr.ip4, &cliaddr.sin_addr, sizeof(addr.addr.ip4));
+      sockaddr_in const *cliaddr = (sockaddr_in const *) from;
+      BOOST_STATIC_ASSERT((sizeof(addr.addr.ip4) == sizeof(cliaddr->sin_addr)));
+      std::memcpy(&addr.addr.ip4, &cliaddr->sin_addr, sizeof(addr.addr.ip4));
     }
     break;
   case network::ip6: {
-      sockaddr_in6 cliaddr;
-      socklen_t clilen = sizeof(cliaddr);
-      connfd = ::accept(sock.fd(), (sockaddr *) &cliaddr, &clilen);
-      BOOST_STATIC_ASSERT((sizeof(addr.addr.ip6) == sizeof(cliaddr.sin6_addr)));
-      std::memcpy(addr.addr.ip6, &cliaddr.sin6_addr, sizeof(addr.addr.ip6));
+      sockaddr_in6 const *cliaddr = (sockaddr_in6 const *) from;
+      BOOST_STATIC_ASSERT((sizeof(addr.addr.ip6) == sizeof(cliaddr->sin6_addr)));
+      std::memcpy(addr.addr.ip6, &cliaddr->sin6_addr, sizeof(addr.addr.ip6));
     }
     break;
+  case network::local: {
+      // the peer is hardly ever bound to a path, its credentials tell more
+      addr.addr.local.pid = -1;
+      addr.addr.local.uid = 0;
+#ifdef SO_PEERCRED
+      ucred cred;
+      socklen_t len = sizeof(cred);
+      if (::getsockopt(connfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) {
+        addr.addr.local.pid = cred.pid;
+        addr.addr.local.uid = cred.uid;
+      }
+#endif
+    }
+    return;
   };
-  return connfd;
+
+  if (sock.tcp().nodelay) {
+    int const one = 1;
+    ::setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+}
+
+namespace {
+  void set_option(int fd, int level, int name, int value, char const *what) {
+    if (::setsockopt(fd, level, name, &value, sizeof(value)) == 0)
+      return;
+    int const err = errno;
+    ::close(fd);
+    errno = err;
+    throw rest::utils::errno_error(
+        std::string("could not start server (") + what + ")");
+  }
+}
+
+namespace {
+  int create_local_listenfd(rest::socket_param &sock, int backlog) {
+    using namespace rest;
+
+    std::string const &path = sock.bind();
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+      throw std::runtime_error("could not start server (invalid unix socket path)");
+    std::memcpy(addr.sun_path, path.data(), path.size());
+
+    bool const abstract = path[0] == '@';
+    socklen_t len = sizeof(addr);
+    if (abstract) {
+#ifdef __linux__
+      addr.sun_path[0] = '\0';
+      len = offsetof(sockaddr_un, sun_path) + path.size();
+#else
+      throw std::runtime_error("could not start server (no abstract sockets)");
+#endif
+    } else {
+      // a socket left behind by an earlier run
+      struct stat st;
+      if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        ::unlink(path.c_str());
+    }
+
+    int listenfd = network::socket(AF_UNIX);
+    if (::bind(listenfd, (sockaddr *) &addr, len) == -1) {
+      ::close(listenfd);
+      throw utils::errno_error("could not start server (bind)");
+    }
+
+    if (!abstract && sock.permissions() &&
+        ::chmod(path.c_str(), sock.permissions()) == -1)
+    {
+      ::close(listenfd);
+      throw utils::errno_error("could not start server (chmod)");
+    }
+
+    if (::listen(listenfd, backlog) == -1)
+      throw utils::errno_error("could not start server (listen)");
+
+    sock.fd(listenfd);
+    return listenfd;
+  }
 }
 
-int rest::network::create_listenfd(socket_param &sock, int backlog) {
+int rest::network::create_listenfd(
+    socket_param &sock, int backlog, bool reuse_port)
+{
+  if (sock.socket_type() == local)
+    return create_local_listenfd(sock, backlog);
+
   addrinfo *res;
   getaddrinfo(sock, &res);
   addrinfo *const ressave = res;
@@ -83,6 +202,19 @@ int rest::network::create_listenfd(socket_param &sock, int backlog) {
     int const one = 1;
     ::setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
 
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+      if (::setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)))
+#else
+      errno = ENOPROTOOPT;
+#endif
+      {
+        ::close(listenfd);
+        ::freeaddrinfo(ressave);
+        throw utils::errno_error("could not start server (SO_REUSEPORT)");
+      }
+    }
+
     if(::bind(listenfd, res->ai_addr, res->ai_addrlen) == 0)
       break;
 
@@ -93,9 +225,49 @@ int rest::network::create_listenfd(socket_param &sock, int backlog) {
   if(res == 0x0)
     throw utils::errno_error("could not start server (listen)");
 
+  // inherited by the connections, the buffer sizes have to be known before
+  // the window scale is negotiated
+  tcp_options const &tcp = sock.tcp();
+  if (tcp.send_buffer > 0)
+    set_option(listenfd, SOL_SOCKET, SO_SNDBUF, tcp.send_buffer, "SO_SNDBUF");
+  if (tcp.receive_buffer > 0)
+    set_option(listenfd, SOL_SOCKET, SO_RCVBUF, tcp.receive_buffer, "SO_RCVBUF");
+
+#ifdef TCP_DEFER_ACCEPT
+  if (tcp.defer_accept > 0)
+    set_option(listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, tcp.defer_accept,
+               "TCP_DEFER_ACCEPT");
+#endif
+
+  if (tcp.fastopen > 0) {
+#ifdef TCP_FASTOPEN
+    set_option(listenfd, IPPROTO_TCP, TCP_FASTOPEN, tcp.fastopen,
+               "TCP_FASTOPEN");
+#else
+    ::close(listenfd);
+    errno = ENOPROTOOPT;
+    throw utils::errno_error("could not start server (TCP_FASTOPEN)");
+#endif
+  }
+
   if(::listen(listenfd, backlog) == -1)
     throw utils::errno_error("could not start server (listen)");
 
+#if !defined(TCP_DEFER_ACCEPT) && defined(SO_ACCEPTFILTER)
+  // accept filters can only be installed on listening sockets
+  if (tcp.defer_accept > 0) {
+    accept_filter_arg filter;
+    std::memset(&filter, 0, sizeof(filter));
+    std::strcpy(filter.af_name, "dataready");
+    if (::setsockopt(listenfd, SOL_SOCKET, SO_ACCEPTFILTER,
+                     &filter, sizeof(filter)))
+    {
+      ::close(listenfd);
+      throw utils::errno_error("could not start server (SO_ACCEPTFILTER)");
+    }
+  }
+#endif
+
   sock.fd(listenfd);
 
   return listenfd;
@@ -0,0 +1,228 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/request_parser.hpp"
+#include "rest/utils/http.hpp"
+#include "rest/utils/scan.hpp"
+#include <algorithm>
+#include <cassert>
+
+using rest::utils::http::request_parser;
+using rest::utils::http::bad_format;
+using rest::utils::http::isspht;
+
+namespace {
+  char const *find(char const *data, std::size_t begin, std::size_t end, char c) {
+    char const *p = rest::utils::scan::find(data + begin, data + end, c);
+    return p == data + end ? 0 : p;
+  }
+
+  void check_length(std::size_t length, std::size_t max_length) {
+    if (max_length != 0 && length > max_length)
+      throw bad_format();
+  }
+}
+
+std::string rest::utils::http::field_value(
+    char const *data, header_field const &field)
+{
+  char const *it = data + field.value.offset;
+  char const *end = it + field.value.length;
+
+  std::string value;
+  if (!field.folded) {
+    value.assign(it, end);
+  } else {
+    value.reserve(field.value.length);
+    while (it != end) {
+      if (*it != '\r' && *it != '\n') {
+        value += *it++;
+        continue;
+      }
+      while (it != end && (*it == '\r' || *it == '\n'))
+        ++it;
+      while (it != end && isspht(*it))
+        ++it;
+      value += ' ';
+    }
+  }
+
+  std::string::size_type n = value.size();
+  while (n > 0 && isspht(value[n - 1]))
+    --n;
+  value.erase(n);
+  return value;
+}
+
+request_parser::request_parser(
+    std::size_t max_method_length,
+    std::size_t max_uri_length,
+    std::size_t max_version_length,
+    std::size_t max_name_length,
+    std::size_t max_value_length,
+    std::size_t max_header_count)
+  : max_method_length(max_method_length),
+    max_uri_length(max_uri_length),
+    max_version_length(max_version_length),
+    max_name_length(max_name_length),
+    max_value_length(max_value_length),
+    max_header_count(max_header_count)
+{
+  reset();
+}
+
+void request_parser::reset() {
+  state_ = REQUEST_LINE;
+  pos = 0;
+  scan = 0;
+  method_ = uri_ = version_ = span();
+  fields_.clear();
+}
+
+request_parser::state_t request_parser::parse(
+    char const *data, std::size_t length)
+{
+  assert(length >= scan);
+
+  while (state_ != DONE) {
+    // a line ends with LF or CRLF, CRs are not allowed anywhere else
+    char const *nl = utils::scan::find_first_of(
+        data + scan, data + length, '\r', '\n');
+
+    if (nl == data + length) {
+      scan = length;
+      break;
+    }
+
+    if (*nl == '\r') {
+      if (nl + 1 == data + length) {
+        scan = nl - data;
+        break;
+      }
+      if (nl[1] != '\n')
+        throw bad_format();
+      ++nl;
+    }
+
+    std::size_t begin = pos;
+    std::size_t end = nl - data;
+    pos = scan = end + 1;
+
+    if (state_ == REQUEST_LINE) {
+      request_line(data, begin, end);
+      if (state_ == HEADERS)
+        return state_;
+    } else {
+      header_line(data, begin, end);
+    }
+  }
+
+  if (state_ == DONE)
+    return state_;
+
+  // don't wait for the rest of a line which is too long anyway
+  std::size_t partial = length - pos;
+  if (state_ == REQUEST_LINE) {
+    if (max_method_length && max_uri_length && max_version_length)
+      check_length(partial,
+          max_method_length + max_uri_length + max_version_length + 3);
+  } else if (partial > 0 && !isspht(data[pos])) {
+    std::size_t limit = max_name_length ? max_name_length + 1 : partial;
+    char const *colon = find(data, pos, pos + std::min(partial, limit), ':');
+    if (!colon) {
+      check_length(partial, max_name_length);
+    } else if (max_value_length) {
+      std::size_t v = colon - data + 1;
+      while (v < length && isspht(data[v]))
+        ++v;
+      check_length(length - v, max_value_length + 1);
+    }
+  }
+
+  return state_;
+}
+
+// Request-Line = Method SP Request-URI SP HTTP-Version CRLF
+void request_parser::request_line(
+    char const *data, std::size_t begin, std::size_t end)
+{
+  if (end == begin || data[end - 1] != '\r')
+    throw bad_format();
+  --end;
+
+  // empty lines before the request line are ignored
+  if (end == begin)
+    return;
+
+  char const *sp1 = find(data, begin, end, ' ');
+  if (!sp1)
+    throw bad_format();
+  std::size_t method_end = sp1 - data;
+
+  char const *sp2 = find(data, method_end + 1, end, ' ');
+  if (!sp2)
+    throw bad_format();
+  std::size_t uri_end = sp2 - data;
+
+  method_ = span(begin, method_end - begin);
+  uri_ = span(method_end + 1, uri_end - method_end - 1);
+  version_ = span(uri_end + 1, end - uri_end - 1);
+
+  if (!method_.length || !uri_.length || !version_.length)
+    throw bad_format();
+
+  check_length(method_.length, max_method_length);
+  check_length(uri_.length, max_uri_length);
+  check_length(version_.length, max_version_length);
+
+  state_ = HEADERS;
+}
+
+// message-header = field-name ":" [ field-value ]
+// see RFC 2616 chapter 4.2
+void request_parser::header_line(
+    char const *data, std::size_t begin, std::size_t end)
+{
+  std::size_t line_end = end;
+  if (line_end > begin && data[line_end - 1] == '\r')
+    --line_end;
+
+  if (line_end == begin) {
+    // the empty line has to be a CRLF
+    if (end == begin)
+      throw bad_format();
+    state_ = DONE;
+    return;
+  }
+
+  if (isspht(data[begin])) {
+    // continuation of the previous field value
+    if (fields_.empty())
+      throw bad_format();
+    header_field &field = fields_.back();
+    field.value.length = line_end - field.value.offset;
+    field.folded = true;
+    check_length(field.value.length, max_value_length);
+    return;
+  }
+
+  if (max_header_count != 0 && fields_.size() >= max_header_count)
+    throw bad_format();
+
+  char const *colon = find(data, begin, line_end, ':');
+  if (!colon)
+    throw bad_format();
+  std::size_t name_end = colon - data;
+
+  std::size_t value_begin = name_end + 1;
+  while (value_begin < line_end && isspht(data[value_begin]))
+    ++value_begin;
+
+  header_field field;
+  field.name = span(begin, name_end - begin);
+  field.value = span(value_begin, line_end - value_begin);
+  field.folded = false;
+
+  check_length(field.name.length, max_name_length);
+  check_length(field.value.length, max_value_length);
+
+  fields_.push_back(field);
+}
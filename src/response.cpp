@@ -17,6 +17,7 @@
 #include <boost/iostreams/device/array.hpp>
 #include <boost/iostreams/device/null.hpp>
 #include <boost/iostreams/restrict.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/hashed_index.hpp>
@@ -24,6 +25,9 @@
 #include <map>
 #include <algorithm>
 #include <cassert>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using rest::response;
 
@@ -69,12 +73,14 @@ struct response::impl {
   cookie_set cookies;
 
   struct data_holder {
-    enum { NIL, STRING, STREAM } type;
+    enum { NIL, STRING, STREAM, FILE } type;
     input_stream stream;
     bool seekable;
     std::string string;
     encoding *compute_from;
     boost::int64_t length;
+    int fd;
+    boost::int64_t offset;
 
     void set(std::string const &str) {
       type = STRING;
@@ -97,6 +103,29 @@ struct response::impl {
       }
     }
 
+    // a FILE is a seekable STREAM over the file as well, for all the cases
+    // it cannot be sent directly
+    void set(int fd_, boost::int64_t offset_, boost::int64_t length_) {
+      namespace io = boost::iostreams;
+
+      io::file_descriptor_source file(fd_, io::close_handle);
+      if (length_ < 0) {
+        struct stat st;
+        if (::fstat(fd_, &st) == 0)
+          length_ = st.st_size - offset_;
+        if (length_ < 0)
+          length_ = 0;
+      }
+
+      input_stream in(new io::stream<io::restriction<io::file_descriptor_source> >(
+        io::restrict(file, offset_, length_)));
+      set(in, true);
+
+      type = FILE;
+      fd = fd_;
+      offset = offset_;
+    }
+
     bool empty() const {
       switch (type) {
       case NIL:
@@ -106,6 +135,8 @@ struct response::impl {
       case STREAM:
         stream->peek();
         return !*stream;
+      case FILE:
+        return length == 0;
       }
       return true;
     }
@@ -119,7 +150,9 @@ struct response::impl {
       stream(0),
       seekable(false),
       compute_from(identity),
-      length(-1) { }
+      length(-1),
+      fd(-1),
+      offset(0) { }
 
     // ATTENTION: cctor FAKED
     data_holder(data_holder const &o)
@@ -127,7 +160,9 @@ struct response::impl {
       stream(0),
       seekable(false),
       compute_from(identity),
-      length(-1)
+      length(-1),
+      fd(-1),
+      offset(0)
     {
       (void)o;
       assert(o.type == NIL);
@@ -138,6 +173,8 @@ struct response::impl {
 
   headers headers_;
 
+  rest::compression compression;
+
   impl() : code(-1) { }
   impl(int code) : code(code) { }
   impl(std::string const &type) : code(-1), type(type) { }
@@ -193,6 +230,30 @@ void response::swap(response &o) {
   p.swap(o.p);
 }
 
+bool response::copy(response &o) const {
+  typedef std::map<encoding *, impl::data_holder, compare_encoding> data_map;
+  for (data_map::const_iterator it = p->data.begin(); it != p->data.end(); ++it)
+    if (it->second.type != impl::data_holder::NIL &&
+        it->second.type != impl::data_holder::STRING)
+      return false;
+
+  boost::scoped_ptr<impl> x(new impl(p->code, p->type));
+  x->boundary = p->boundary;
+  x->cookies = p->cookies;
+  x->headers_ = p->headers_;
+  x->compression = p->compression;
+  for (data_map::const_iterator it = p->data.begin(); it != p->data.end(); ++it)
+  {
+    impl::data_holder &d = x->data[it->first];
+    d.compute_from = it->second.compute_from;
+    if (it->second.type == impl::data_holder::STRING)
+      d.set(it->second.string);
+    d.length = it->second.length;
+  }
+  o.p.swap(x);
+  return true;
+}
+
 void response::defaults() {
   headers &h = get_headers();
 
@@ -217,6 +278,14 @@ void response::set_type(std::string const &type) {
   get_headers().set_header("Content-Type", type);
 }
 
+void response::set_compression(compression const &c) {
+  p->compression = c;
+}
+
+rest::compression const &response::get_compression() const {
+  return p->compression;
+}
+
 void response::add_cookie(cookie const &c) {
   p->cookies.erase(c.name);
   p->cookies.insert(c);
@@ -247,6 +316,62 @@ void response::set_data(
   set_data(data, seekable, x);
 }
 
+void response::set_file(
+    int fd, boost::int64_t offset, boost::int64_t length, encoding *enc)
+{
+  if (enc == 0)
+    enc = identity;
+  p->data[enc].set(fd, offset, length);
+  if (p->data[identity].type == impl::data_holder::NIL)
+    p->data[identity].compute_from = enc;
+}
+
+void response::set_file(
+    int fd, boost::int64_t offset, boost::int64_t length,
+    std::string const &enc)
+{
+  encoding *x = object_registry::get().find<encoding>(enc);
+  if (!x) {
+    ::close(fd);
+    throw invalid_encoding(enc);
+  }
+  set_file(fd, offset, length, x);
+}
+
+bool response::get_file(
+    encoding *enc, int &fd, boost::int64_t &offset) const
+{
+  if (enc == 0)
+    enc = identity;
+  impl::data_holder &d = p->data[enc];
+  if (d.type != impl::data_holder::FILE)
+    return false;
+  fd = d.fd;
+  offset = d.offset;
+  return true;
+}
+
+std::string const *response::get_string(encoding *enc) const {
+  if (enc == 0)
+    enc = identity;
+  impl::data_holder &d = p->data[enc];
+  if (d.type != impl::data_holder::STRING)
+    return 0;
+  return &d.string;
+}
+
+std::size_t response::data_size() const {
+  typedef std::map<encoding *, impl::data_holder, compare_encoding> data_map;
+  std::size_t size = 0;
+  for (data_map::const_iterator it = p->data.begin(); it != p->data.end(); ++it)
+    size += it->second.string.size();
+  return size;
+}
+
+bool response::has_cookies() const {
+  return !p->cookies.empty();
+}
+
 void response::set_data(
     std::string const &data, encoding *content_encoding)
 {
@@ -522,6 +647,7 @@ void response::print_entity(
         out2 << d.string.substr(x.first, x.second - x.first);
         break;
       case impl::data_holder::STREAM:
+      case impl::data_holder::FILE:
         io::copy(
           io::restrict(*d.stream->rdbuf(), x.first, x.second - x.first),
           out2);
@@ -560,6 +686,7 @@ void response::print_entity(
     utils::write_string(out, d.string);
     break;
   case impl::data_holder::STREAM:
+  case impl::data_holder::FILE:
     {
       std::streambuf &in = *d.stream->rdbuf();
       if (d.seekable || !may_chunk)
@@ -591,8 +718,11 @@ void response::encode(
 {
   namespace io = boost::iostreams;
 
+  compression params(p->compression);
+  params.merge(compression::configured());
+
   encoding::output_chain chain;
-  enc->add_writer(chain);
+  enc->add_writer(chain, params);
   if (may_chunk)
     chain.push(utils::chunked_filter());
   chain.push(boost::ref(out));
@@ -621,6 +751,7 @@ void response::decode(
     chain.push(io::array_source(d.string.data(), d.length));
     break;
   case impl::data_holder::STREAM:
+  case impl::data_holder::FILE:
     chain.push(boost::ref(*d.stream));
     break;
   }
@@ -0,0 +1,150 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/scan.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define REST_SCAN_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace scan = rest::utils::scan;
+
+namespace {
+  typedef char const *(*find_fn)(char const *, char const *, char, char);
+
+  char const *find_scalar(char const *p, char const *end, char a, char b) {
+    for (; p != end; ++p)
+      if (*p == a || *p == b)
+        break;
+    return p;
+  }
+
+#ifdef REST_SCAN_X86
+  __attribute__((target("sse2")))
+  char const *find_sse2(char const *p, char const *end, char a, char b) {
+    __m128i const va = _mm_set1_epi8(a);
+    __m128i const vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+      int mask = _mm_movemask_epi8(
+          _mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)));
+      if (mask)
+        return p + __builtin_ctz(mask);
+    }
+    return find_scalar(p, end, a, b);
+  }
+
+  __attribute__((target("avx2")))
+  char const *find_avx2(char const *p, char const *end, char a, char b) {
+    __m256i const va = _mm256_set1_epi8(a);
+    __m256i const vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+      unsigned mask = unsigned(_mm256_movemask_epi8(
+          _mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb))));
+      if (mask)
+        return p + __builtin_ctz(mask);
+    }
+    // not find_sse2(), mixing legacy SSE and AVX code is expensive
+    if (end - p >= 16) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+      int mask = _mm_movemask_epi8(
+          _mm_or_si128(
+            _mm_cmpeq_epi8(x, _mm256_castsi256_si128(va)),
+            _mm_cmpeq_epi8(x, _mm256_castsi256_si128(vb))));
+      if (mask)
+        return p + __builtin_ctz(mask);
+      p += 16;
+    }
+    return find_scalar(p, end, a, b);
+  }
+
+  bool has_sse2() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+      return false;
+    return edx & bit_SSE2;
+  }
+
+  bool has_avx2() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+      return false;
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+      return false;
+
+    // the OS has to save the YMM registers
+    unsigned xcr0_lo, xcr0_hi;
+    __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0_lo & 6) != 6)
+      return false;
+
+    if (__get_cpuid_max(0, 0) < 7)
+      return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return ebx & bit_AVX2;
+  }
+#endif
+
+  find_fn get(scan::implementation impl) {
+    switch (impl) {
+#ifdef REST_SCAN_X86
+    case scan::AVX2: return &find_avx2;
+    case scan::SSE2: return &find_sse2;
+#endif
+    default: return &find_scalar;
+    }
+  }
+
+  char const *find_detect(char const *, char const *, char, char);
+
+  find_fn find_impl = &find_detect;
+  scan::implementation active_impl = scan::SCALAR;
+
+  char const *find_detect(char const *p, char const *end, char a, char b) {
+    scan::use(scan::best());
+    return find_impl(p, end, a, b);
+  }
+}
+
+scan::implementation scan::best() {
+#ifdef REST_SCAN_X86
+  static implementation const x =
+    has_avx2() ? AVX2 : has_sse2() ? SSE2 : SCALAR;
+  return x;
+#else
+  return SCALAR;
+#endif
+}
+
+scan::implementation scan::active() {
+  if (find_impl == &find_detect)
+    use(best());
+  return active_impl;
+}
+
+void scan::use(implementation impl) {
+  if (impl > best())
+    impl = best();
+  active_impl = impl;
+  find_impl = get(impl);
+}
+
+char const *scan::name(implementation impl) {
+  switch (impl) {
+  case AVX2: return "avx2";
+  case SSE2: return "sse2";
+  default: return "scalar";
+  }
+}
+
+char const *scan::find(char const *begin, char const *end, char c) {
+  return find_impl(begin, end, c, c);
+}
+
+char const *scan::find_first_of(
+    char const *begin, char const *end, char a, char b)
+{
+  return find_impl(begin, end, a, b);
+}
@@ -4,6 +4,12 @@
 #include "rest/socket_param.hpp"
 #include "rest/utils/socket_device.hpp"
 #include <boost/iostreams/stream_buffer.hpp>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#ifndef APPLE
+#include <sys/sendfile.h>
+#endif
 
 using rest::scheme;
 using rest::http_scheme;
@@ -24,6 +30,56 @@ void scheme::load_standard_objects(object_registry &obj_reg) {
 
 scheme::~scheme() {}
 
+std::auto_ptr<std::streambuf> scheme::open(logger *, int, socket_param const &)
+{
+  return std::auto_ptr<std::streambuf>();
+}
+
+bool scheme::handshake(int, std::streambuf &, bool &) {
+  return true;
+}
+
+std::streamsize scheme::read(
+  int connfd, std::streambuf &, char *buf, std::streamsize n)
+{
+  ssize_t got;
+  do {
+    got = ::recv(connfd, buf, std::size_t(n), 0);
+  } while (got < 0 && errno == EINTR);
+  return got;
+}
+
+std::streamsize scheme::write(
+  int connfd, std::streambuf &, char const *buf, std::streamsize n)
+{
+  ssize_t sent;
+  do {
+    sent = ::send(connfd, buf, std::size_t(n), MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  return sent;
+}
+
+boost::int64_t scheme::send_file(
+  int connfd, std::streambuf &,
+  int fd, boost::int64_t offset, boost::int64_t length)
+{
+#ifndef APPLE
+  off_t off = offset;
+  ssize_t sent;
+  do {
+    sent = ::sendfile(connfd, fd, &off, std::size_t(length));
+  } while (sent < 0 && errno == EINTR);
+  return sent;
+#else
+  (void)connfd;
+  (void)fd;
+  (void)offset;
+  (void)length;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 
 std::string const &http_scheme::name() const {
   static std::string x("http");
@@ -41,12 +97,23 @@ void http_scheme::serve(
 {
   namespace io = boost::iostreams;
 
-  http_connection conn(sock.hosts(), addr, servername, log);
   utils::socket_device dev(connfd, sock.timeout_read(), sock.timeout_write());
-  std::auto_ptr<std::streambuf> p(
+  std::auto_ptr<std::streambuf> buf(
     new io::stream_buffer<utils::socket_device>(dev));
 
-  conn.serve(p);
+  http_connection conn(sock.hosts(), addr, servername, log);
+  conn.serve(buf);
+}
+
+// the event engines keep their own timers, the socket needs no timeouts
+std::auto_ptr<std::streambuf> http_scheme::open(
+  logger *, int connfd, socket_param const &)
+{
+  namespace io = boost::iostreams;
+
+  utils::socket_device dev(connfd, 0, 0);
+  return std::auto_ptr<std::streambuf>(
+    new io::stream_buffer<utils::socket_device>(dev));
 }
 
 boost::any http_scheme::create_context(
@@ -7,15 +7,31 @@
 #include "rest/scheme.hpp"
 #include "rest/signals.hpp"
 #include "rest/host.hpp"
+#include "rest/http_connection.hpp"
 #include "rest/utils/exceptions.hpp"
 #include "rest/utils/socket_device.hpp"
+#include "rest/utils/timer_wheel.hpp"
+#include "rest/utils/uring.hpp"
 #include <map>
 #include <set>
+#include <sstream>
+#include <ctime>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #ifdef APPLE
 #include "compat/epoll.h"
@@ -27,6 +43,258 @@ using namespace rest;
 namespace det = rest::detail;
 namespace algo = boost::algorithm;
 
+namespace {
+  double now() {
+    timeval tv;
+    ::gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+
+  utils::timer_wheel::time_type now_ms() {
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return utils::timer_wheel::time_type(ts.tv_sec) * 1000
+      + ts.tv_nsec / 1000000;
+  }
+
+  // what the user data of an io_uring completion refers to
+  enum ring_op {
+    RING_ACCEPT = 1, RING_CONNECTION, RING_INOTIFY, RING_CANCEL,
+    RING_RECEIVE, RING_SEND, RING_FILE, RING_FILE_TABLE
+  };
+
+  boost::uint64_t ring_data(ring_op op, boost::uint32_t serial,
+                            boost::uint32_t index)
+  {
+    return (boost::uint64_t(op) << 56) | (boost::uint64_t(serial) << 32)
+      | index;
+  }
+
+  // room for the peer address of an accept queued on the ring
+  struct pending_accept {
+    sockaddr_storage addr;
+    socklen_t len;
+  };
+
+  // The data path of a plain HTTP connection on the ring, in place of its
+  // scheme: transfers are queued with the connection's slot of the ring
+  // buffers and complete later, until then the connection is told to wait
+  // (EAGAIN). At most one receive and one send are in flight. Parts of files
+  // are read into the send half of the slot on the ring, the send linked
+  // to the read; the file is duplicated as the connection closes its own
+  // once it gave out the last part.
+  class ring_transport : public scheme {
+  public:
+    static std::size_t const RECEIVE_SIZE = 16384;
+    static std::size_t const SEND_SIZE = 16384;
+    static std::size_t const SLOT_SIZE = RECEIVE_SIZE + SEND_SIZE;
+
+    // `file' is the index of the connection in the registered files or -1,
+    // `slot' the connection's part of the ring buffers
+    ring_transport(scheme &plain, utils::uring &ring,
+                   int fd, int file, char *slot, bool registered,
+                   boost::uint32_t serial)
+      : plain(plain), ring(ring), fd(fd), slot(slot),
+        flags((file >= 0 ? utils::uring::FIXED_FILE : 0) |
+              (registered ? utils::uring::FIXED_BUFFER : 0)),
+        target(file >= 0 ? file : fd), serial(serial),
+        received_begin(0), received_end(0), sent_begin(0), sent_end(0),
+        receiving(false), sending_(false), reading_file(false),
+        end_of_input(false), error(0), file_copy(-1), last_part(false)
+    {}
+
+    ~ring_transport() {
+      close_file();
+    }
+
+    char *get_slot() const { return slot; }
+    bool fixed_file() const { return flags & utils::uring::FIXED_FILE; }
+    // what the file table entry is set to
+    int const *get_fd() const { return &fd; }
+
+    bool busy() const { return receiving || sending_ || reading_file; }
+    bool sending() const { return sending_ || reading_file; }
+
+    // Takes the completion of a transfer, true if the connection can go
+    // on (false while the rest of a send is on its way).
+    bool completed(ring_op op, int result) {
+      if (result == -ECANCELED && op == RING_RECEIVE) {
+        receiving = false;
+        return false;
+      }
+      if (result < 0 && !error)
+        error = -result;
+
+      switch (op) {
+      case RING_RECEIVE:
+        receiving = false;
+        if (result == 0)
+          end_of_input = true;
+        else if (result > 0) {
+          received_begin = 0;
+          received_end = std::size_t(result);
+        }
+        return true;
+      case RING_FILE:
+        // a short read cancels the send linked to it
+        reading_file = false;
+        if (last_part)
+          close_file();
+        return false;
+      default:
+        sending_ = false;
+        if (result > 0 && !error) {
+          sent_begin += std::size_t(result);
+          if (sent_begin < sent_end) {
+            send();
+            return false;
+          }
+        } else if (result == 0 && !error) {
+          error = EPIPE;
+        }
+        return true;
+      }
+    }
+
+    // cancels the transfers in flight, nothing is sent anymore
+    void cancel() {
+      if (!error)
+        error = ECANCELED;
+      if (receiving)
+        ring.cancel(data(RING_RECEIVE), ring_data(RING_CANCEL, 0, 0));
+      if (reading_file)
+        ring.cancel(data(RING_FILE), ring_data(RING_CANCEL, 0, 0));
+      if (sending_)
+        ring.cancel(data(RING_SEND), ring_data(RING_CANCEL, 0, 0));
+    }
+
+    std::string const &name() const {
+      return plain.name();
+    }
+
+    void serve(logger *log, int connfd, socket_param const &sock,
+               network::address const &addr, std::string const &servername)
+    {
+      plain.serve(log, connfd, sock, addr, servername);
+    }
+
+    boost::any create_context(logger *log,
+                              utils::property_tree const &socket_data,
+                              server &srv) const
+    {
+      return plain.create_context(log, socket_data, srv);
+    }
+
+    std::streamsize read(int, std::streambuf &, char *buf, std::streamsize n) {
+      if (received_begin < received_end) {
+        std::size_t const length =
+          std::min(std::size_t(n), received_end - received_begin);
+        std::memcpy(buf, slot + received_begin, length);
+        received_begin += length;
+        return std::streamsize(length);
+      }
+      if (error)
+        return fail(error);
+      if (end_of_input)
+        return 0;
+      if (!receiving) {
+        ring.read(target, slot, RECEIVE_SIZE, 0, flags, data(RING_RECEIVE));
+        receiving = true;
+      }
+      return fail(EAGAIN);
+    }
+
+    std::streamsize write(
+      int, std::streambuf &, char const *buf, std::streamsize n)
+    {
+      if (error)
+        return fail(error);
+      if (sending())
+        return fail(EAGAIN);
+      std::size_t const length = std::min(std::size_t(n), SEND_SIZE);
+      std::memcpy(slot + RECEIVE_SIZE, buf, length);
+      sent_begin = 0;
+      sent_end = length;
+      send();
+      return std::streamsize(length);
+    }
+
+    boost::int64_t send_file(int, std::streambuf &,
+                             int file, boost::int64_t offset,
+                             boost::int64_t length)
+    {
+      if (error)
+        return fail(error);
+      if (sending())
+        return fail(EAGAIN);
+      if (file_copy < 0) {
+        file_copy = ::dup(file);
+        if (file_copy < 0)
+          return -1;
+      }
+      std::size_t const n =
+        std::size_t(std::min(length, boost::int64_t(SEND_SIZE)));
+      last_part = boost::int64_t(n) == length;
+      // the file is no registered one
+      ring.read(file_copy, slot + RECEIVE_SIZE, n, offset,
+                (flags & utils::uring::FIXED_BUFFER) | utils::uring::LINK,
+                data(RING_FILE));
+      reading_file = true;
+      sent_begin = 0;
+      sent_end = n;
+      send();
+      return boost::int64_t(n);
+    }
+
+  private:
+    static int fail(int err) {
+      errno = err;
+      return -1;
+    }
+
+    boost::uint64_t data(ring_op op) const {
+      return ring_data(op, serial, fd);
+    }
+
+    void send() {
+      ring.write(target, slot + RECEIVE_SIZE + sent_begin,
+                 sent_end - sent_begin, 0, flags, data(RING_SEND));
+      sending_ = true;
+    }
+
+    void close_file() {
+      if (file_copy >= 0)
+        ::close(file_copy);
+      file_copy = -1;
+    }
+
+    scheme &plain;
+    utils::uring &ring;
+    int fd;
+    char *slot;
+    unsigned flags;
+    int target; // fd or index in the registered files
+    boost::uint32_t serial;
+
+    std::size_t received_begin, received_end; // unread in the slot
+    std::size_t sent_begin, sent_end; // in the send half
+    bool receiving;
+    bool sending_;
+    bool reading_file;
+    bool end_of_input;
+    int error;
+    int file_copy; // of the file whose parts are sent
+    bool last_part; // of the file is read
+  };
+
+  std::size_t const ring_transport::RECEIVE_SIZE;
+  std::size_t const ring_transport::SEND_SIZE;
+  std::size_t const ring_transport::SLOT_SIZE;
+
+  // what the file table entry of a closed connection is set to
+  int const no_file = -1;
+}
+
 class server::impl {
 public:
   server *p_ref;
@@ -35,24 +303,128 @@ public:
 
   std::vector<socket_param> socket_params;
   std::set<int> close_on_fork;
+  std::set<int> listen_fds;
 
   static int const DEFAULT_LISTENQ;
   static long const DEFAULT_TIMEOUT;
+  static int const DEFAULT_WORKERS;
   int listenq;
   long timeout_read;
   long timeout_write;
 
-  unsigned int timeout_ms;
-  std::list<boost::function<void ()> > timeout_callbacks;
+  // number of pre-forked worker processes (0: fork per connection)
+  int workers;
+  bool is_worker;
+  std::vector<pid_t> worker_pids;
+  std::vector<time_t> worker_started;
+
+  // one SO_REUSEPORT listen socket per worker and socket
+  bool reuse_port;
+  std::vector<std::vector<int> > shard_fds; // [slot][socket]
+
+  // event engine: connections stay registered with epoll between requests
+  bool event_engine;
+  int epollfd;
+
+  // the event engine on io_uring: accepts are queued on the listen sockets
+  // ahead of time, plain HTTP connections transfer on the ring (up to
+  // URING_SLOTS of them, with registered buffers and files where the kernel
+  // allows), the others get readiness from multishot polls; a wakeup takes
+  // one system call for everything
+  bool uring_engine;
+  std::vector<char> ring_buffers; // outlives the ring
+  boost::scoped_ptr<utils::uring> ring;
+  unsigned next_serial;
+  bool ring_buffers_registered;
+  unsigned ring_files; // the size of the registered file table
+  std::vector<std::size_t> free_slots;
+  // transports of closed connections waiting for their cancelled transfers
+  std::map<boost::uint32_t /*serial*/, boost::shared_ptr<ring_transport> >
+    draining;
+  unsigned long ring_connections;
+  unsigned long polled_connections;
+  static unsigned const URING_ENTRIES;
+  static std::size_t const URING_ACCEPTS;
+  static std::size_t const URING_SLOTS;
+  static unsigned const URING_MAX_FILES;
+
+  // An idle connection is closed after the read timeout of its socket, a
+  // request has to arrive completely within timeout_header however slowly
+  // it trickles in, and a response the client does not take for the write
+  // timeout is given up. The sockets do not block, http_connection::advance()
+  // goes on whenever they are ready.
+  struct event_connection {
+    socket_param const *sock;
+    boost::shared_ptr<ring_transport> transport; // (outlives conn)
+    boost::shared_ptr<http_connection> conn;
+    utils::timer_wheel::timer_id timer;
+    enum { IDLE, REQUEST, RESPONSE } waiting;
+    unsigned serial; // tells the ring's completions for a reused fd apart
+    bool polled;
+  };
+  typedef std::map<int /*fd*/, event_connection> connection_map;
+  connection_map connections;
+  long timeout_header;
+
+  // server::timeout() and the connection deadlines, in milliseconds of the
+  // monotonic clock
+  static unsigned const TIMER_RESOLUTION;
+  boost::scoped_ptr<utils::timer_wheel> timers;
 
   int inotify_fd;
   std::map<int /*wd*/, watch_callback_t> inotify_callbacks;
 
+  // connections accepted per wakeup of a listen socket, logged on SIGUSR1
+  struct accept_statistics {
+    static std::size_t const BUCKETS = 8; // 1, 2-3, 4-7, ..., 128-
+
+    unsigned long wakeups;
+    unsigned long empty;
+    unsigned long accepted;
+    unsigned long max_batch;
+    unsigned long batches[BUCKETS];
+
+    accept_statistics()
+      : wakeups(0), empty(0), accepted(0), max_batch(0)
+    {
+      std::fill(batches, batches + BUCKETS, 0);
+    }
+
+    void add(unsigned long batch);
+  };
+  accept_statistics accept_stats;
+
+  // forking per connection: at most max_handlers live connection processes
+  // (0: unlimited), beyond that new connections are either answered with 503
+  // right away or left in the listen queue
+  unsigned max_handlers;
+  bool overload_backlog;
+  long retry_after;
+  std::set<pid_t> handler_pids;
+  bool listeners_paused;
+  double paused_since;
+
+  struct handler_statistics {
+    unsigned long peak;
+    unsigned long shed;
+    unsigned long pauses;
+    double paused;     // seconds the listen queue was not served
+    double max_paused;
+
+    handler_statistics()
+      : peak(0), shed(0), pauses(0), paused(0), max_paused(0) {}
+  };
+  handler_statistics handler_stats;
+
   utils::property_tree const &config;
   logger *log;
 
   void do_close_on_fork() {
     std::for_each(close_on_fork.begin(), close_on_fork.end(), &::close);
+    for (connection_map::iterator it = connections.begin();
+        it != connections.end();
+        ++it)
+      ::close(it->first);
   }
 
   impl(utils::property_tree const &config, logger *log)
@@ -63,19 +435,87 @@ public:
           "connections", "timeout", "read")),
       timeout_write(utils::get(config, DEFAULT_TIMEOUT,
           "connections", "timeout", "write")),
-      timeout_ms(-1),
+      workers(utils::get(config, DEFAULT_WORKERS,
+          "connections", "workers")),
+      is_worker(false),
+      reuse_port(utils::get(config, 0,
+          "connections", "reuseport") != 0),
+      event_engine(utils::get(config, std::string("fork"),
+          "connections", "engine") == "event"),
+      epollfd(-1),
+      uring_engine(utils::get(config, std::string("fork"),
+          "connections", "engine") == "uring"),
+      next_serial(0),
+      ring_buffers_registered(false),
+      ring_files(0),
+      ring_connections(0),
+      polled_connections(0),
+      timeout_header(utils::get(config, DEFAULT_TIMEOUT,
+          "connections", "timeout", "header")),
+      timers(new utils::timer_wheel(now_ms(), TIMER_RESOLUTION)),
+      inotify_fd(-1),
+      max_handlers(utils::get(config, 0U,
+          "connections", "max_handlers")),
+      overload_backlog(utils::get(config, std::string("reject"),
+          "connections", "overload") == "backlog"),
+      retry_after(utils::get(config, 5L,
+          "connections", "retry_after")),
+      listeners_paused(false),
+      paused_since(0),
       config(config),
       log(log)
   {
+    if (uring_engine)
+      event_engine = true;
+
+    // inherited by the processes serving connections
+    http_connection::set_response_cache_size(utils::get(config,
+        std::size_t(0), "general", "response_cache", "size"));
+    context::set_route_cache_size(utils::get(config,
+        std::size_t(0), "general", "route_cache", "size"));
   }
 
   void configure_signals();
 
   void read_connections();
-  int initialize_sockets();
+  void initialize_sockets();
+  int create_listenfd(socket_param &sock, bool reuse_port);
+  int initialize_epoll(bool listeners, bool inotify);
+  void run(int epollfd, std::string const &servername);
+  void run_uring(std::string const &servername);
+  bool handle_signals();
+  void set_up_ring_transfers();
+  void poll_connection(int fd);
+  void transfer_completed(ring_op op, boost::uint32_t serial, int fd,
+                          int result);
+  void release_slot(ring_transport const &transport);
+  void log_uring_statistics();
+  void run_timeouts();
+  unsigned int wait_timeout() const;
   void incoming(socket_param const &sock, std::string const &severname);
+  void accepted(socket_param const &sock, int connfd,
+                rest::network::address const &addr, std::string const &name);
+  void log_accept_statistics();
+  void log_route_cache_statistics();
+  bool handlers_exhausted() const;
+  void shed(socket_param const &sock, int connfd);
+  void pause_listeners(bool pause);
+  void reap_handlers();
+  void log_handler_statistics();
   int connection(socket_param const &sock, int connfd,
                  rest::network::address const &addr, std::string const &name);
+  bool open_connection(socket_param const &sock, int connfd,
+                 rest::network::address const &addr, std::string const &name);
+  void connection_event(int fd, boost::uint32_t events);
+  void close_connection(connection_map::iterator it);
+  void expire_connection(int fd);
+
+  void supervise(int epollfd, std::string const &servername);
+  void spawn_worker(std::size_t slot, std::string const &servername);
+  int worker(std::size_t slot, std::string const &servername);
+  void reap_workers(std::string const &servername);
+  void signal_workers(int signo);
+  void stop_workers();
 
   void initialize_inotify();
   void inotify_event();
@@ -83,6 +523,12 @@ public:
 
 int const server::impl::DEFAULT_LISTENQ = 5;
 long const server::impl::DEFAULT_TIMEOUT = 10;
+int const server::impl::DEFAULT_WORKERS = 0;
+unsigned const server::impl::TIMER_RESOLUTION = 10;
+unsigned const server::impl::URING_ENTRIES = 1024;
+std::size_t const server::impl::URING_ACCEPTS = 16;
+std::size_t const server::impl::URING_SLOTS = 256;
+unsigned const server::impl::URING_MAX_FILES = 65536;
 
 sockets_container::iterator server::add_socket(socket_param const &s) {
   p->socket_params.push_back(s);
@@ -135,14 +581,6 @@ void server::impl::read_connections() {
     if ((*j)->name() == "timeout")
       continue;
 
-    std::string service = utils::get(**j, std::string(), "port");
-    if(service.empty()) {
-      service = utils::get(**j, std::string(), "service");
-      if(service.empty())
-        throw std::runtime_error("no port/service specified!");
-    }
-    algo::trim(service);
-
     std::string type_ = utils::get(**j, std::string("ipv4"), "type");
     network::socket_type_t type;
     if(algo::istarts_with(type_, "ipv4") ||
@@ -151,11 +589,32 @@ void server::impl::read_connections() {
     else if(algo::istarts_with(type_, "ipv6") ||
             algo::istarts_with(type_, "ip6"))
       type = network::ip6;
+    else if(algo::istarts_with(type_, "unix") ||
+            algo::istarts_with(type_, "local"))
+      type = network::local;
     else
       throw std::runtime_error("unkown socket type specified");
 
-    std::string bind = utils::get(**j, std::string(), "bind");
-    algo::trim(bind);
+    std::string service;
+    std::string bind;
+    if (type == network::local) {
+      // unix sockets bind to their path
+      bind = utils::get(**j, std::string(), "path");
+      algo::trim(bind);
+      if (bind.empty())
+        throw std::runtime_error("no path specified for unix socket!");
+    } else {
+      service = utils::get(**j, std::string(), "port");
+      if(service.empty()) {
+        service = utils::get(**j, std::string(), "service");
+        if(service.empty())
+          throw std::runtime_error("no port/service specified!");
+      }
+      algo::trim(service);
+
+      bind = utils::get(**j, std::string(), "bind");
+      algo::trim(bind);
+    }
 
     std::string scheme = utils::get(**j, std::string(), "scheme");
     algo::trim(scheme);
@@ -178,37 +637,96 @@ void server::impl::read_connections() {
 
     socket_params.push_back(socket_param(
       service, type, bind, scheme, timeout_read, timeout_write, scheme_specific));
+
+    network::tcp_options tcp;
+    tcp.nodelay = utils::get(**j, 0, "tcp", "nodelay") != 0;
+    tcp.defer_accept = utils::get(**j, 0, "tcp", "defer_accept");
+    tcp.fastopen = utils::get(**j, 0, "tcp", "fastopen");
+    tcp.send_buffer = utils::get(**j, 0, "tcp", "send_buffer");
+    tcp.receive_buffer = utils::get(**j, 0, "tcp", "receive_buffer");
+    socket_params.back().tcp(tcp);
+
+    std::string mode = utils::get(**j, std::string(), "permissions");
+    algo::trim(mode);
+    if (!mode.empty())
+      socket_params.back().permissions(std::strtoul(mode.c_str(), 0, 8));
   }
 }
 
-int server::impl::initialize_sockets() {
-  int epollfd = epoll::create(socket_params.size() + 1);
-  close_on_fork.insert(epollfd);
-
-  epoll_event epolle;
-  epolle.events = EPOLLIN|EPOLLERR;
+void server::impl::initialize_sockets() {
+  bool const shard = reuse_port && workers > 0;
+  if (shard)
+    shard_fds.assign(workers, std::vector<int>());
 
   for(sockets_container::iterator i = socket_params.begin();
       i != socket_params.end();
       ++i)
   {
-    int listenfd = network::create_listenfd(*i, listenq);
+    if (!shard) {
+      listen_fds.insert(create_listenfd(*i, false));
+      continue;
+    }
+
+    if (i->socket_type() == network::local) {
+      // a path can only be bound once, the workers share the socket
+      int listenfd = create_listenfd(*i, false);
+      for (int slot = 0; slot < workers; ++slot)
+        shard_fds[slot].push_back(listenfd);
+      continue;
+    }
+
+    // the kernel balances connections between the shards, every worker
+    // only watches its own one
+    for (int slot = 0; slot < workers; ++slot)
+      shard_fds[slot].push_back(create_listenfd(*i, true));
+  }
+}
 
-    int flags = ::fcntl(listenfd, F_GETFL);
-    flags |= O_NONBLOCK;
-    ::fcntl(listenfd, F_SETFL, flags);
+int server::impl::create_listenfd(socket_param &sock, bool reuse_port) {
+  int listenfd = network::create_listenfd(sock, listenq, reuse_port);
 
-    close_on_fork.insert(listenfd);
+  int flags = ::fcntl(listenfd, F_GETFL);
+  flags |= O_NONBLOCK;
+  ::fcntl(listenfd, F_SETFL, flags);
 
-    epolle.data.ptr = &*i;
-    if(::epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &epolle) == -1)
-      throw utils::errno_error("epoll_ctl (socket)");
+  close_on_fork.insert(listenfd);
+  return listenfd;
+}
+
+int server::impl::initialize_epoll(bool listeners, bool inotify) {
+  int epollfd = epoll::create(socket_params.size() + 1);
+  close_on_fork.insert(epollfd);
+
+  epoll_event epolle;
+  epolle.events = EPOLLIN|EPOLLERR;
+
+  if (listeners) {
+    for(sockets_container::iterator i = socket_params.begin();
+        i != socket_params.end();
+        ++i)
+    {
+      epoll_event listen_epolle = epolle;
+#ifdef EPOLLEXCLUSIVE
+      // workers sharing a listen socket (all of them, or the local ones
+      // when sharded): wake one of them per connection, not all of them
+      if (is_worker &&
+          (shard_fds.empty() || i->socket_type() == network::local))
+        listen_epolle.events |= EPOLLEXCLUSIVE;
+#endif
+      listen_epolle.data.fd = i->fd();
+      if(::epoll_ctl(epollfd, EPOLL_CTL_ADD, i->fd(), &listen_epolle) == -1)
+        throw utils::errno_error("epoll_ctl (socket)");
+    }
   }
 
 #ifndef APPLE
-  epolle.data.ptr = 0;
-  if (::epoll_ctl(epollfd, EPOLL_CTL_ADD, inotify_fd, &epolle) == -1)
-    throw utils::errno_error("epoll_ctl (inotify)");
+  if (inotify) {
+    epolle.data.fd = inotify_fd;
+    if (::epoll_ctl(epollfd, EPOLL_CTL_ADD, inotify_fd, &epolle) == -1)
+      throw utils::errno_error("epoll_ctl (inotify)");
+  }
+#else
+  (void)inotify;
 #endif
 
   return epollfd;
@@ -217,21 +735,103 @@ int server::impl::initialize_sockets() {
 void server::impl::incoming(socket_param const &sock,
                             std::string const &servername)
 {
-  network::address addr;
-  int connfd = network::accept(sock, addr);
-  if (connfd < 0) {
-    if (errno == EAGAIN || errno == EINTR)
-      return;
-    log->log(logger::err, "accept-failed", errno);
-    log->flush();
-    return;
+  // workers of the fork engine serve the connection before they come back,
+  // everybody else drains the listen queue
+  bool const drain = !is_worker || event_engine;
+
+  // forked children must not run the parent's signal handlers before they
+  // are set up, block everything once for the whole batch
+  sigset_t mask, oldmask;
+  if (!is_worker) {
+    sigfillset(&mask);
+    sigprocmask(SIG_BLOCK, &mask, &oldmask);
   }
 
+  unsigned long batch = 0;
+  for (;;) {
+    if (overload_backlog && handlers_exhausted()) {
+      pause_listeners(true);
+      break;
+    }
+
+    network::address addr;
+    int connfd = network::accept(sock, addr);
+    if (connfd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        log->log(logger::err, "accept-failed", errno);
+        log->flush();
+      }
+      break;
+    }
+
+    ++batch;
+    accepted(sock, connfd, addr, servername);
+
+    if (!drain)
+      break;
+  }
+
+  if (!is_worker)
+    sigprocmask(SIG_SETMASK, &oldmask, 0);
+
+  accept_stats.add(batch);
+  log->log(logger::info, "accept-batch", batch);
+  log->flush();
+}
+
+void server::impl::accepted(socket_param const &sock,
+                            int connfd,
+                            network::address const &addr,
+                            std::string const &servername)
+{
   log->next_sequence_number();
 
-  sigset_t mask, oldmask;
-  sigfillset(&mask);
-  sigprocmask(SIG_BLOCK, &mask, &oldmask);
+  if (event_engine) {
+    try {
+      log->log(logger::info, "accept-connection", network::ntoa(addr));
+      log->flush();
+
+      if (open_connection(sock, connfd, addr, servername))
+        return;
+    }
+    catch(std::exception &e) {
+      log->log(logger::err, "unexpected-exception", e.what());
+      log->flush();
+      return;
+    }
+    catch(...) {
+      log->log(logger::err, "unexpected-exception");
+      log->flush();
+      return;
+    }
+    // the scheme cannot be driven by events, serve it the classic way
+  }
+
+  if (is_worker) {
+    // pre-forked worker: serve the connection right here
+    try {
+      log->log(logger::info, "accept-connection", network::ntoa(addr));
+      log->flush();
+
+      connection(sock, connfd, addr, servername);
+    }
+    catch(std::exception &e) {
+      log->log(logger::err, "unexpected-exception", e.what());
+      log->flush();
+    }
+    catch(...) {
+      log->log(logger::err, "unexpected-exception");
+      log->flush();
+    }
+    return;
+  }
+
+  if (handlers_exhausted()) {
+    shed(sock, connfd);
+    return;
+  }
 
   pid_t pid = ::fork();
   if (pid == 0) {
@@ -258,13 +858,140 @@ void server::impl::incoming(socket_param const &sock,
     if (pid == -1) {
       log->log(logger::err, "fork-failed", errno);
       log->flush();
+    } else if (max_handlers > 0) {
+      handler_pids.insert(pid);
+      if (handler_pids.size() > handler_stats.peak)
+        handler_stats.peak = handler_pids.size();
     }
 
     close(connfd);
-    sigprocmask(SIG_SETMASK, &oldmask, 0);
   }
 }
 
+bool server::impl::handlers_exhausted() const {
+  return max_handlers > 0 && !is_worker && handler_pids.size() >= max_handlers;
+}
+
+void server::impl::shed(socket_param const &sock, int connfd) {
+  ++handler_stats.shed;
+
+  log->log(logger::notice, "connection-shed", handler_pids.size());
+  log->flush();
+
+  // TLS would need a handshake first, those clients just see the close
+  if (algo::iequals(sock.scheme(), "http")) {
+    std::ostringstream response;
+    response << "HTTP/1.1 503 Service Unavailable\r\n"
+             << "Retry-After: " << retry_after << "\r\n"
+             << "Content-Length: 0\r\n"
+             << "Connection: close\r\n\r\n";
+    std::string const &data = response.str();
+    // whatever fits into the socket buffer, never wait for the client
+    ::send(connfd, data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+
+  ::close(connfd);
+}
+
+void server::impl::pause_listeners(bool pause) {
+  if (pause == listeners_paused)
+    return;
+  listeners_paused = pause;
+
+  int const op = pause ? EPOLL_CTL_DEL : EPOLL_CTL_ADD;
+  epoll_event epolle;
+  epolle.events = EPOLLIN|EPOLLERR;
+  for(sockets_container::iterator i = socket_params.begin();
+      i != socket_params.end();
+      ++i)
+  {
+    epolle.data.fd = i->fd();
+    if (::epoll_ctl(epollfd, op, i->fd(), &epolle) == -1)
+      throw utils::errno_error("epoll_ctl (socket)");
+  }
+
+  if (pause) {
+    ++handler_stats.pauses;
+    paused_since = now();
+  } else {
+    double paused = now() - paused_since;
+    handler_stats.paused += paused;
+    if (paused > handler_stats.max_paused)
+      handler_stats.max_paused = paused;
+  }
+
+  log->log(logger::info, pause ? "listeners-paused" : "listeners-resumed",
+           handler_pids.size());
+  log->flush();
+}
+
+void server::impl::reap_handlers() {
+  int status;
+  pid_t pid;
+  while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+    handler_pids.erase(pid);
+
+  if (listeners_paused && !handlers_exhausted())
+    pause_listeners(false);
+}
+
+void server::impl::log_handler_statistics() {
+  log->log(logger::notice, "handlers-live", handler_pids.size());
+  log->log(logger::notice, "handlers-peak", handler_stats.peak);
+  log->log(logger::notice, "handlers-shed", handler_stats.shed);
+  log->log(logger::notice, "listeners-pauses", handler_stats.pauses);
+  log->log(logger::notice, "listeners-paused-ms",
+           (unsigned long)(handler_stats.paused * 1000));
+  log->log(logger::notice, "listeners-max-paused-ms",
+           (unsigned long)(handler_stats.max_paused * 1000));
+  log->flush();
+}
+
+void server::impl::accept_statistics::add(unsigned long batch) {
+  ++wakeups;
+  accepted += batch;
+  if (batch > max_batch)
+    max_batch = batch;
+
+  std::size_t bucket = 0;
+  while (bucket + 1 < BUCKETS && (2UL << bucket) <= batch)
+    ++bucket;
+  if (batch == 0)
+    ++empty;
+  else
+    ++batches[bucket];
+}
+
+void server::impl::log_accept_statistics() {
+  log->log(logger::notice, "accept-wakeups", accept_stats.wakeups);
+  log->log(logger::notice, "accept-empty-wakeups", accept_stats.empty);
+  log->log(logger::notice, "accept-connections", accept_stats.accepted);
+  log->log(logger::notice, "accept-max-batch", accept_stats.max_batch);
+  for (std::size_t i = 0; i < accept_statistics::BUCKETS; ++i) {
+    if (!accept_stats.batches[i])
+      continue;
+    std::ostringstream name;
+    name << "accept-batches-" << (1UL << i);
+    if (i + 1 < accept_statistics::BUCKETS)
+      name << '-' << (2UL << i) - 1;
+    else
+      name << "-";
+    log->log(logger::notice, name.str(), accept_stats.batches[i]);
+  }
+  log->flush();
+}
+
+// of the routes this process resolved, nothing if it did not serve any
+void server::impl::log_route_cache_statistics() {
+  context::route_cache_statistics stats = context::route_cache_stats();
+  if (stats.hits == 0 && stats.misses == 0)
+    return;
+  log->log(logger::notice, "route-cache-hits", stats.hits);
+  log->log(logger::notice, "route-cache-misses", stats.misses);
+  log->log(logger::notice, "route-cache-entries", stats.size);
+  log->flush();
+}
+
 int server::impl::connection(
     socket_param const &sock,
     int connfd,
@@ -281,6 +1008,342 @@ int server::impl::connection(
   return 0;
 }
 
+bool server::impl::open_connection(
+    socket_param const &sock,
+    int connfd,
+    network::address const &addr,
+    std::string const &servername)
+{
+  scheme *schm = object_registry::get().find<scheme>(sock.scheme());
+  if (!schm) {
+    log->log(logger::err, "unknown-scheme", sock.scheme());
+    log->flush();
+    ::close(connfd);
+    return true;
+  }
+
+  // http_scheme transfers on the socket as it is, so the ring can do that
+  // instead; its transfers wait for the socket themselves
+  bool const on_ring =
+    ring && !free_slots.empty() && dynamic_cast<http_scheme *>(schm);
+
+  int flags = 0;
+  if (!on_ring) {
+    flags = ::fcntl(connfd, F_GETFL);
+    ::fcntl(connfd, F_SETFL, flags | O_NONBLOCK);
+  }
+
+  std::auto_ptr<std::streambuf> buf(schm->open(log, connfd, sock));
+  if (!buf.get()) {
+    if (!on_ring)
+      ::fcntl(connfd, F_SETFL, flags);
+    return false;
+  }
+
+  event_connection c;
+  c.sock = &sock;
+  c.serial = ++next_serial & 0xffffff;
+  if (on_ring) {
+    int const file = connfd < int(ring_files) ? connfd : -1;
+    c.transport.reset(new ring_transport(*schm, *ring, connfd, file,
+        &ring_buffers[free_slots.back() * ring_transport::SLOT_SIZE],
+        ring_buffers_registered, c.serial));
+    free_slots.pop_back();
+    if (file >= 0)
+      ring->update_file(file, c.transport->get_fd(),
+                        ring_data(RING_FILE_TABLE, 0, 0));
+    ++ring_connections;
+  } else if (ring) {
+    ++polled_connections;
+  }
+  c.conn.reset(new http_connection(sock.hosts(), addr, servername, log));
+  if (c.transport)
+    c.conn->open(buf, *c.transport, connfd);
+  else
+    c.conn->open(buf, *schm, connfd);
+  c.timer = timers->add(now_ms() + sock.timeout_read() * 1000,
+      boost::bind(&impl::expire_connection, this, connfd));
+  c.waiting = event_connection::IDLE;
+  c.polled = false;
+
+  if (!ring) {
+    // both directions, so that a response waiting for the socket goes on
+    epoll_event epolle;
+    epolle.events = EPOLLIN|EPOLLOUT|EPOLLET;
+#ifdef EPOLLRDHUP
+    epolle.events |= EPOLLRDHUP;
+#endif
+    epolle.data.fd = connfd;
+    if (::epoll_ctl(epollfd, EPOLL_CTL_ADD, connfd, &epolle) == -1)
+      throw utils::errno_error("epoll_ctl (connection)");
+  }
+
+  connections[connfd] = c;
+
+  // the client may have been quicker than us
+  connection_event(connfd, 0);
+
+  if (ring)
+    poll_connection(connfd);
+  return true;
+}
+
+void server::impl::connection_event(int fd, boost::uint32_t events) {
+  connection_map::iterator it = connections.find(fd);
+  if (it == connections.end())
+    return;
+
+  event_connection &c = it->second;
+
+  http_connection::event_state state;
+  try {
+    state = c.conn->advance();
+  }
+  catch(std::exception &e) {
+    log->log(logger::err, "unexpected-exception", e.what());
+    log->flush();
+    close_connection(it);
+    return;
+  }
+  catch(...) {
+    log->log(logger::err, "unexpected-exception");
+    log->flush();
+    close_connection(it);
+    return;
+  }
+
+  if (state == http_connection::CLOSED && c.transport &&
+      c.transport->sending())
+  {
+    // the end of the last response is still on its way
+    c.waiting = event_connection::RESPONSE;
+    timers->reschedule(c.timer, now_ms() + c.sock->timeout_write() * 1000);
+    return;
+  }
+
+  if (state == http_connection::CLOSED || (events & (EPOLLHUP|EPOLLERR))) {
+    close_connection(it);
+    return;
+  }
+
+  if (state == http_connection::WANT_WRITE) {
+    // each bit the client takes buys time
+    c.waiting = event_connection::RESPONSE;
+    timers->reschedule(c.timer, now_ms() + c.sock->timeout_write() * 1000);
+  } else if (!c.conn->request_started()) {
+    // idle (again)
+    c.waiting = event_connection::IDLE;
+    timers->reschedule(c.timer, now_ms() + c.sock->timeout_read() * 1000);
+  } else if (c.waiting != event_connection::REQUEST) {
+    // the first piece of a request, more data doesn't buy more time
+    c.waiting = event_connection::REQUEST;
+    timers->reschedule(c.timer, now_ms() + timeout_header * 1000);
+  }
+}
+
+void server::impl::expire_connection(int fd) {
+  connection_map::iterator it = connections.find(fd);
+  if (it == connections.end())
+    return;
+
+  char const *reason = "idle-connection-closed";
+  if (it->second.waiting == event_connection::REQUEST)
+    reason = "slow-connection-closed";
+  else if (it->second.waiting == event_connection::RESPONSE)
+    reason = "slow-client-closed";
+  log->log(logger::info, reason, fd);
+  log->flush();
+  // the timer is gone already
+  it->second.timer = 0;
+  close_connection(it);
+}
+
+void server::impl::close_connection(connection_map::iterator it) {
+  if (boost::shared_ptr<ring_transport> t = it->second.transport) {
+    // the fd is closed with the connection, but its transfers go on until
+    // they are cancelled and the file table keeps the socket open
+    t->cancel();
+    if (t->fixed_file())
+      ring->update_file(it->first, &no_file, ring_data(RING_FILE_TABLE, 0, 0));
+    if (t->busy())
+      draining[it->second.serial] = t;
+    else
+      release_slot(*t);
+  } else if (ring) {
+    // closing the fd does not end the poll
+    if (it->second.polled)
+      ring->cancel_poll(
+          ring_data(RING_CONNECTION, it->second.serial, it->first),
+          ring_data(RING_CANCEL, 0, 0));
+  } else {
+    // the fd may be gone already (it belongs to the stream), so ignore errors
+    epoll_event epolle;
+    ::epoll_ctl(epollfd, EPOLL_CTL_DEL, it->first, &epolle);
+  }
+  if (it->second.timer)
+    timers->cancel(it->second.timer);
+  connections.erase(it);
+}
+
+void server::impl::supervise(int epollfd, std::string const &servername) {
+  worker_pids.assign(workers, 0);
+  worker_started.assign(workers, 0);
+
+  for (std::size_t slot = 0; slot < worker_pids.size(); ++slot)
+    spawn_worker(slot, servername);
+
+  int const EVENTS_N = 8;
+
+  for (;;) {
+    epoll_event events[EVENTS_N];
+    int nfds = epoll::wait(epollfd, events, EVENTS_N, wait_timeout());
+
+    if (sig.is_pending(SIGTERM) || sig.is_pending(SIGINT))
+      break;
+
+    if (sig.is_pending(SIGCHLD)) {
+      // all members are blocked outside of epoll_pwait, nothing is lost here
+      sig.reset_pending(SIGCHLD);
+      reap_workers(servername);
+    }
+
+    if (sig.is_pending(SIGUSR1)) {
+      // the workers do the accepting
+      sig.reset_pending(SIGUSR1);
+      signal_workers(SIGUSR1);
+    }
+
+    if (nfds > 0) {
+      inotify_event();
+
+      // watch callbacks only ran in the master, let the workers pick up
+      // the changed state
+      log->log(logger::notice, "recycle-workers");
+      log->flush();
+      signal_workers(SIGTERM);
+    }
+
+    run_timeouts();
+  }
+
+  stop_workers();
+}
+
+void server::impl::spawn_worker(
+    std::size_t slot, std::string const &servername)
+{
+  if (worker_pids[slot] > 0)
+    return;
+
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    is_worker = true;
+    _exit(worker(slot, servername));
+  }
+
+  if (pid == -1) {
+    log->log(logger::err, "fork-failed", errno);
+    log->flush();
+    p_ref->timeout(1000, boost::bind(
+        &impl::spawn_worker, this, slot, std::string(servername)));
+    return;
+  }
+
+  worker_pids[slot] = pid;
+  worker_started[slot] = std::time(0);
+
+  log->log(logger::info, "worker-started", pid);
+  log->flush();
+}
+
+int server::impl::worker(std::size_t slot, std::string const &servername) {
+  try {
+    if (!shard_fds.empty()) {
+      // the master keeps all shards open, so a respawned worker takes over
+      // the connections queued on its predecessor's socket
+      for (std::size_t i = 0; i < socket_params.size(); ++i) {
+        socket_params[i].fd(shard_fds[slot][i]);
+        listen_fds.insert(shard_fds[slot][i]);
+      }
+    }
+
+    for (std::set<int>::iterator it = close_on_fork.begin();
+        it != close_on_fork.end();
+        ++it)
+      if (listen_fds.find(*it) == listen_fds.end())
+        ::close(*it);
+    close_on_fork = listen_fds;
+    inotify_fd = -1;
+
+    sig.reset_pending();
+    timers.reset(new utils::timer_wheel(now_ms(), TIMER_RESOLUTION));
+    inotify_callbacks.clear();
+
+    int epollfd = initialize_epoll(true, false);
+    run(epollfd, servername);
+    return 0;
+  }
+  catch(std::exception &e) {
+    log->log(logger::err, "unexpected-exception", e.what());
+    log->flush();
+    return 5;
+  }
+  catch(...) {
+    log->log(logger::err, "unexpected-exception");
+    log->flush();
+    return 6;
+  }
+}
+
+void server::impl::reap_workers(std::string const &servername) {
+  int status;
+  pid_t pid;
+  while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+    std::vector<pid_t>::iterator it =
+      std::find(worker_pids.begin(), worker_pids.end(), pid);
+    if (it == worker_pids.end())
+      continue;
+
+    std::size_t slot = it - worker_pids.begin();
+    *it = 0;
+
+    log->log(logger::notice, "worker-exited", pid);
+    log->log(logger::notice, "worker-status", status);
+    log->flush();
+
+    // don't spin if the workers die right away
+    if (std::time(0) - worker_started[slot] < 1)
+      p_ref->timeout(1000, boost::bind(
+          &impl::spawn_worker, this, slot, std::string(servername)));
+    else
+      spawn_worker(slot, servername);
+  }
+}
+
+void server::impl::signal_workers(int signo) {
+  for (std::vector<pid_t>::iterator it = worker_pids.begin();
+      it != worker_pids.end();
+      ++it)
+    if (*it > 0)
+      ::kill(*it, signo);
+}
+
+void server::impl::stop_workers() {
+  signal_workers(SIGTERM);
+
+  for (std::vector<pid_t>::iterator it = worker_pids.begin();
+      it != worker_pids.end();
+      ++it)
+  {
+    if (*it <= 0)
+      continue;
+    int status;
+    while (::waitpid(*it, &status, 0) == -1 && errno == EINTR)
+      ;
+    *it = 0;
+  }
+}
+
 void server::impl::initialize_inotify() {
 #ifndef APPLE
   inotify_fd = inotify_init();
@@ -332,7 +1395,11 @@ void server::impl::inotify_event() {
 }
 
 void server::impl::configure_signals() {
-  sig.ignore(SIGCHLD);
+  // without a handler limit nobody cares for the connection processes
+  if (workers > 0 || max_handlers > 0)
+    sig.add(SIGCHLD);
+  else
+    sig.ignore(SIGCHLD);
   sig.ignore(SIGPIPE);
   sig.ignore(SIGTSTP);
   sig.ignore(SIGTTIN);
@@ -340,7 +1407,7 @@ void server::impl::configure_signals() {
   sig.ignore(SIGHUP);
   sig.add(SIGTERM);
   sig.add(SIGINT);
-  //sig.add(SIGUSR1);
+  sig.add(SIGUSR1);
   sig.block();
 }
 
@@ -379,40 +1446,287 @@ void server::serve() {
   // shouldn't require a default value (see config::config())
   assert(!servername.empty());
 
-  int epollfd = p->initialize_sockets();
+  p->initialize_sockets();
 
   process::chroot(p->log, tree);
   process::drop_privileges(p->log, tree);
 
-  int const EVENTS_N = 8;
+  if (p->workers > 0) {
+    int epollfd = p->initialize_epoll(false, true);
+    p->supervise(epollfd, servername);
+  } else {
+    int epollfd = p->initialize_epoll(true, true);
+    p->run(epollfd, servername);
+  }
+
+  p->log->log(logger::notice, "server-stopped");
+  p->log->flush();
+}
+
+void server::impl::run(int epollfd, std::string const &servername) {
+  int const EVENTS_N = 64;
+
+  this->epollfd = epollfd;
+
+  if (uring_engine) {
+    try {
+      ring.reset(new utils::uring(URING_ENTRIES));
+    }
+    catch (utils::errno_error &e) {
+      log->log(logger::warning, "uring-unavailable", e.what());
+      log->flush();
+    }
+    if (ring) {
+      run_uring(servername);
+      return;
+    }
+  }
+
+  std::map<int, socket_param *> listeners;
+  for(sockets_container::iterator i = socket_params.begin();
+      i != socket_params.end();
+      ++i)
+    listeners[i->fd()] = &*i;
 
   for (;;) {
     epoll_event events[EVENTS_N];
-    int nfds = epoll::wait(epollfd, events, EVENTS_N, p->timeout_ms);
+    int nfds = epoll::wait(epollfd, events, EVENTS_N, wait_timeout());
 
-    if (p->sig.is_pending(SIGTERM) || p->sig.is_pending(SIGINT))
+    if (!handle_signals())
       break;
 
     for(int i = 0; i < nfds; ++i) {
-      socket_param *ptr = static_cast<socket_param*>(events[i].data.ptr);
-      if (ptr) { // socket
-        p->incoming(*ptr, servername);
-      } else { // inotify
-        p->inotify_event();
-      } 
+      int fd = events[i].data.fd;
+      std::map<int, socket_param *>::iterator it = listeners.find(fd);
+      if (it != listeners.end()) { // socket
+        incoming(*it->second, servername);
+      } else if (fd == inotify_fd) { // inotify
+        inotify_event();
+      } else { // connection
+        connection_event(fd, events[i].events);
+      }
     }
 
-    p->timeout_ms = unsigned(-1);
-    for (std::list<boost::function<void ()> >::iterator it
-            = p->timeout_callbacks.begin();
-         it != p->timeout_callbacks.end();
-         ++it)
-      (*it)();
-    p->timeout_callbacks.clear();
+    run_timeouts();
   }
 
-  p->log->log(logger::notice, "server-stopped");
-  p->log->flush();
+  connections.clear();
+}
+
+// false once the server is to stop
+bool server::impl::handle_signals() {
+  if (sig.is_pending(SIGTERM) || sig.is_pending(SIGINT))
+    return false;
+
+  if (sig.is_pending(SIGUSR1)) {
+    sig.reset_pending(SIGUSR1);
+    log_accept_statistics();
+    if (max_handlers > 0)
+      log_handler_statistics();
+    log_route_cache_statistics();
+    if (ring)
+      log_uring_statistics();
+  }
+
+  if (sig.is_pending(SIGCHLD)) {
+    sig.reset_pending(SIGCHLD);
+    reap_handlers();
+  }
+
+  return true;
+}
+
+void server::impl::run_uring(std::string const &servername) {
+  int const EVENTS_N = 64;
+
+  log->log(logger::notice, "uring-engine");
+  log->flush();
+
+  set_up_ring_transfers();
+
+  // every listen socket has URING_ACCEPTS accepts queued
+  std::vector<pending_accept> accepts(socket_params.size() * URING_ACCEPTS);
+
+  // the listen sockets stay non-blocking, their file status flags are shared
+  // with the other workers; the ring waits for a connection by polling, and
+  // an accept another worker won the race for completes with EAGAIN and is
+  // queued again
+  for (std::size_t i = 0; i < accepts.size(); ++i) {
+    accepts[i].len = sizeof(accepts[i].addr);
+    ring->accept(socket_params[i / URING_ACCEPTS].fd(),
+        (sockaddr *) &accepts[i].addr, &accepts[i].len,
+        ring_data(RING_ACCEPT, 0, i));
+  }
+
+#ifndef APPLE
+  if (inotify_fd >= 0)
+    ring->poll(inotify_fd, POLLIN, ring_data(RING_INOTIFY, 0, 0));
+#endif
+
+  sigset_t empty_mask;
+  sigemptyset(&empty_mask);
+
+  std::vector<unsigned long> batch(socket_params.size());
+
+  for (;;) {
+    utils::uring::completion done[EVENTS_N];
+    int n = ring->wait(done, EVENTS_N, wait_timeout(), &empty_mask);
+
+    if (!handle_signals())
+      break;
+
+    std::fill(batch.begin(), batch.end(), 0);
+
+    for (int i = 0; i < n; ++i) {
+      boost::uint32_t const index = done[i].data & 0xffffffff;
+      int const result = done[i].result;
+
+      switch (done[i].data >> 56) {
+      case RING_ACCEPT: {
+          socket_param const &sock = socket_params[index / URING_ACCEPTS];
+          if (result >= 0) {
+            ++batch[index / URING_ACCEPTS];
+            network::address addr;
+            network::accepted(
+                sock, result, (sockaddr *) &accepts[index].addr, addr);
+            accepted(sock, result, addr, servername);
+          } else if (result != -EINTR && result != -ECONNABORTED &&
+                     result != -EAGAIN) {
+            log->log(logger::err, "accept-failed", -result);
+            log->flush();
+          }
+          accepts[index].len = sizeof(accepts[index].addr);
+          ring->accept(sock.fd(),
+              (sockaddr *) &accepts[index].addr, &accepts[index].len,
+              done[i].data);
+        }
+        break;
+      case RING_INOTIFY:
+        inotify_event();
+        if (!done[i].more)
+          ring->poll(inotify_fd, POLLIN, done[i].data);
+        break;
+      case RING_RECEIVE:
+      case RING_SEND:
+      case RING_FILE:
+        transfer_completed(ring_op(done[i].data >> 56),
+                           (done[i].data >> 32) & 0xffffff, index, result);
+        break;
+      case RING_CONNECTION: {
+          connection_map::iterator it = connections.find(index);
+          unsigned const serial = (done[i].data >> 32) & 0xffffff;
+          if (it == connections.end() || it->second.serial != serial)
+            break; // a cancelled poll of a closed connection
+          if (!done[i].more)
+            it->second.polled = false;
+          if (result > 0)
+            connection_event(index, result);
+          poll_connection(index);
+        }
+        break;
+      }
+    }
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      if (!batch[i])
+        continue;
+      accept_stats.add(batch[i]);
+      log->log(logger::info, "accept-batch", batch[i]);
+    }
+    log->flush();
+
+    run_timeouts();
+  }
+
+  connections.clear();
+}
+
+// the buffers and the file table of the connections transferring on the
+// ring, both registered if the kernel takes them
+void server::impl::set_up_ring_transfers() {
+  ring_buffers.resize(URING_SLOTS * ring_transport::SLOT_SIZE);
+  ring_buffers_registered =
+    ring->register_buffer(&ring_buffers[0], ring_buffers.size());
+  if (!ring_buffers_registered) {
+    log->log(logger::warning, "uring-buffers-unregistered", errno);
+    log->flush();
+  }
+  for (std::size_t i = URING_SLOTS; i > 0; --i)
+    free_slots.push_back(i - 1);
+
+  rlimit files;
+  unsigned count = URING_MAX_FILES;
+  if (::getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < count)
+    count = unsigned(files.rlim_cur);
+  ring_files = ring->register_files(count) ? count : 0;
+  if (!ring_files) {
+    log->log(logger::warning, "uring-files-unregistered", errno);
+    log->flush();
+  }
+}
+
+void server::impl::transfer_completed(
+    ring_op op, boost::uint32_t serial, int fd, int result)
+{
+  connection_map::iterator it = connections.find(fd);
+  if (it == connections.end() || it->second.serial != serial ||
+      !it->second.transport)
+  {
+    // of a closed connection
+    std::map<boost::uint32_t, boost::shared_ptr<ring_transport> >::iterator
+      d = draining.find(serial);
+    if (d == draining.end())
+      return;
+    d->second->completed(op, result);
+    if (!d->second->busy()) {
+      release_slot(*d->second);
+      draining.erase(d);
+    }
+    return;
+  }
+
+  if (it->second.transport->completed(op, result))
+    connection_event(fd, 0);
+}
+
+void server::impl::release_slot(ring_transport const &transport) {
+  free_slots.push_back(
+      (transport.get_slot() - &ring_buffers[0]) / ring_transport::SLOT_SIZE);
+}
+
+void server::impl::log_uring_statistics() {
+  log->log(logger::notice, "uring-enter-calls", ring->enter_calls());
+  log->log(logger::notice, "uring-ring-connections", ring_connections);
+  log->log(logger::notice, "uring-polled-connections", polled_connections);
+  log->flush();
+}
+
+// (re-)arms the poll of a connection that is still open
+void server::impl::poll_connection(int fd) {
+  connection_map::iterator it = connections.find(fd);
+  if (it == connections.end() || it->second.polled || it->second.transport)
+    return;
+  it->second.polled = true;
+  // multishot, it fires on each wakeup of the socket like EPOLLET
+  ring->poll(fd, POLLIN | POLLOUT | POLLRDHUP,
+             ring_data(RING_CONNECTION, it->second.serial, fd));
+}
+
+void server::impl::run_timeouts() {
+  timers->advance(now_ms());
+}
+
+unsigned int server::impl::wait_timeout() const {
+  utils::timer_wheel::time_type next = timers->next_expiry();
+  if (next == utils::timer_wheel::NEVER)
+    return unsigned(-1);
+  utils::timer_wheel::time_type now = now_ms();
+  if (next <= now)
+    return 0;
+  // epoll takes an int
+  if (next - now > INT_MAX)
+    return INT_MAX;
+  return unsigned(next - now);
 }
 
 int server::watch_file(
@@ -451,8 +1765,12 @@ void server::unwatch_file(int wd) {
   p->inotify_callbacks.erase(wd);
 }
 
-void server::timeout(unsigned int ms, boost::function<void ()> const &cb) {
-  if (ms < p->timeout_ms)
-    p->timeout_ms = ms;
-  p->timeout_callbacks.push_back(cb);
+server::timer_id server::timeout(
+    unsigned int ms, boost::function<void ()> const &cb)
+{
+  return p->timers->add(now_ms() + ms, cb);
+}
+
+bool server::cancel_timeout(timer_id id) {
+  return p->timers->cancel(id);
 }
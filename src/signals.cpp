@@ -56,6 +56,10 @@ void signals::reset_pending() {
   sigemptyset(&p->pending);
 }
 
+void signals::reset_pending(signal_type sig) {
+  sigdelset(&p->pending, sig);
+}
+
 bool signals::is_pending(signal_type sig) const {
   return sigismember(&p->pending, sig);
 }
@@ -2,16 +2,23 @@
 #include "rest/utils/socket_device.hpp"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <algorithm>
+#include <vector>
+#ifndef APPLE
+#include <sys/sendfile.h>
+#endif
 
 using namespace rest::utils;
 
 class socket_device::impl {
 public:
-  impl(int fd) : fd(fd) {}
+  impl(int fd) : fd(fd), writes(0) {}
   ~impl() { if (fd >= 0) close(); }
 
   void close() {
@@ -21,6 +28,7 @@ public:
   }
 
   int fd;
+  unsigned long writes;
 };
 
 socket_device::socket_device(int fd, long timeout_rd, long timeout_wr)
@@ -66,20 +74,101 @@ std::streamsize socket_device::write(char const *buf, std::streamsize length) {
   if (p->fd < 0)
     return -1;
 
+  std::streamsize const total = length;
   std::streamsize n;
   for (;;) {
     n = ::write(p->fd, buf, size_t(length));
+    ++p->writes;
     if (n == length)
       break;
-    if (n >= 0) {
+    if (n > 0) {
       buf += n;
       length -= n;
-    } else if (errno != EINTR)
+    } else if (n == 0 || errno != EINTR)
       break;
   }
   if (n <= 0) {
     p->close();
     return -1;
   }
-  return n;
+  return total;
+}
+
+boost::int64_t socket_device::send_file(
+    int fd, boost::int64_t offset, boost::int64_t length)
+{
+  if (p->fd < 0)
+    return -1;
+
+  boost::int64_t const total = length;
+  while (length > 0) {
+#ifndef APPLE
+    off_t off = offset;
+    ssize_t n = ::sendfile(p->fd, fd, &off, std::size_t(length));
+    ++p->writes;
+#else
+    off_t n = length;
+    if (::sendfile(fd, p->fd, offset, &n, 0, 0) < 0 && n == 0)
+      n = -1;
+    ++p->writes;
+#endif
+    if (n > 0) {
+      offset += n;
+      length -= n;
+    } else if (n == 0 || errno != EINTR) {
+      p->close();
+      return -1;
+    }
+  }
+  return total;
+}
+
+std::streamsize socket_device::write(struct iovec const *iov, int count) {
+  if (p->fd < 0)
+    return -1;
+
+  std::vector<struct iovec> v(iov, iov + count);
+  std::streamsize total = 0;
+  for (int i = 0; i < count; ++i)
+    total += v[i].iov_len;
+
+  std::vector<struct iovec>::iterator it = v.begin();
+  while (it != v.end()) {
+    if (it->iov_len == 0) {
+      ++it;
+      continue;
+    }
+    int n_iov = int(std::min(v.end() - it, std::ptrdiff_t(IOV_MAX)));
+    ssize_t n = ::writev(p->fd, &*it, n_iov);
+    ++p->writes;
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      p->close();
+      return -1;
+    }
+    // skip what was written, continue within a partially written buffer
+    for (; it != v.end() && std::size_t(n) >= it->iov_len; ++it)
+      n -= it->iov_len;
+    if (n > 0) {
+      it->iov_base = static_cast<char *>(it->iov_base) + n;
+      it->iov_len -= n;
+    }
+  }
+  return total;
+}
+
+void socket_device::cork(bool on) {
+  int const value = on;
+#if defined(TCP_CORK)
+  ::setsockopt(p->fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+#elif defined(TCP_NOPUSH)
+  ::setsockopt(p->fd, IPPROTO_TCP, TCP_NOPUSH, &value, sizeof(value));
+#else
+  (void)value;
+#endif
+}
+
+unsigned long socket_device::write_calls() const {
+  return p->writes;
 }
@@ -23,6 +23,7 @@ public:
     timeout_read(timeout_read),
     timeout_write(timeout_write),
     scheme_specific(scheme_specific),
+    permissions(0),
     fd(-1)
   { }
 
@@ -33,6 +34,8 @@ public:
   long timeout_read;
   long timeout_write;
   boost::any scheme_specific;
+  network::tcp_options tcp;
+  unsigned permissions;
 
   host_container hosts;
 
@@ -86,6 +89,22 @@ long socket_param::timeout_write() const {
   return p->timeout_write;
 }
 
+rest::network::tcp_options const &socket_param::tcp() const {
+  return p->tcp;
+}
+
+void socket_param::tcp(network::tcp_options const &options) {
+  p->tcp = options;
+}
+
+unsigned socket_param::permissions() const {
+  return p->permissions;
+}
+
+void socket_param::permissions(unsigned mode) {
+  p->permissions = mode;
+}
+
 boost::any const &socket_param::scheme_specific() const {
   return p->scheme_specific;
 }
@@ -0,0 +1,195 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/timer_wheel.hpp"
+#include <boost/unordered_map.hpp>
+#include <list>
+
+using rest::utils::timer_wheel;
+
+namespace {
+  int const LEVELS = 4;
+  int const BITS = 6;
+  int const SLOTS = 1 << BITS;
+  timer_wheel::time_type const MASK = SLOTS - 1;
+  // the furthest tick the top level can hold
+  timer_wheel::time_type const SPAN = timer_wheel::time_type(1) << (BITS * LEVELS);
+}
+
+timer_wheel::time_type const timer_wheel::NEVER = time_type(-1);
+
+class timer_wheel::impl {
+public:
+  typedef std::list<timer_id> slot_list;
+
+  struct timer {
+    time_type expires; // tick
+    boost::function<void ()> callback;
+    slot_list *slot;
+    slot_list::iterator pos;
+  };
+  typedef boost::unordered_map<timer_id, timer> timer_map;
+
+  impl(time_type now, unsigned resolution)
+    : resolution(resolution ? resolution : 1),
+      tick(now / this->resolution),
+      last_id(0)
+  {}
+
+  unsigned resolution;
+  time_type tick; // the next one to process
+  timer_id last_id;
+  timer_map timers;
+  slot_list wheel[LEVELS][SLOTS];
+  slot_list expiring;
+
+  time_type to_tick(time_type ms) const {
+    // rounded up: never fire early
+    return ms / resolution + (ms % resolution != 0);
+  }
+
+  void place(timer_id id, timer &t) {
+    time_type e = t.expires < tick ? tick : t.expires;
+    time_type delta = e - tick;
+    if (delta >= SPAN) {
+      // cascaded down again once the top level reaches it
+      e = tick + SPAN - 1;
+      delta = SPAN - 1;
+    }
+
+    int level = 0;
+    while (delta >= time_type(1) << (BITS * (level + 1)))
+      ++level;
+
+    slot_list &s = wheel[level][(e >> (BITS * level)) & MASK];
+    t.slot = &s;
+    t.pos = s.insert(s.end(), id);
+  }
+
+  void cascade(int level, std::size_t index) {
+    slot_list moving;
+    moving.splice(moving.end(), wheel[level][index]);
+    for (slot_list::iterator it = moving.begin(); it != moving.end(); ++it)
+      place(*it, timers.find(*it)->second);
+  }
+
+  void remove(timer &t) {
+    t.slot->erase(t.pos);
+  }
+};
+
+timer_wheel::timer_wheel(time_type now, unsigned resolution)
+  : p(new impl(now, resolution))
+{}
+
+timer_wheel::~timer_wheel() {}
+
+timer_wheel::timer_id timer_wheel::add(
+    time_type deadline, boost::function<void ()> const &callback)
+{
+  do
+    ++p->last_id;
+  while (p->last_id == 0 || p->timers.find(p->last_id) != p->timers.end());
+
+  impl::timer &t = p->timers[p->last_id];
+  t.expires = p->to_tick(deadline);
+  t.callback = callback;
+  p->place(p->last_id, t);
+  return p->last_id;
+}
+
+bool timer_wheel::cancel(timer_id id) {
+  impl::timer_map::iterator it = p->timers.find(id);
+  if (it == p->timers.end())
+    return false;
+  p->remove(it->second);
+  p->timers.erase(it);
+  return true;
+}
+
+bool timer_wheel::reschedule(timer_id id, time_type deadline) {
+  impl::timer_map::iterator it = p->timers.find(id);
+  if (it == p->timers.end())
+    return false;
+  p->remove(it->second);
+  it->second.expires = p->to_tick(deadline);
+  p->place(id, it->second);
+  return true;
+}
+
+std::size_t timer_wheel::advance(time_type now) {
+  time_type const last = now / p->resolution;
+  std::size_t run = 0;
+
+  while (p->tick <= last) {
+    if (p->timers.empty()) {
+      p->tick = last + 1;
+      break;
+    }
+
+    time_type const t = p->tick;
+    // refill the lower levels whenever they wrap around
+    for (int level = 1; level < LEVELS; ++level) {
+      if (t & ((time_type(1) << (BITS * level)) - 1))
+        break;
+      p->cascade(level, (t >> (BITS * level)) & MASK);
+    }
+
+    impl::slot_list &due = p->wheel[0][t & MASK];
+    p->expiring.splice(p->expiring.end(), due);
+    for (impl::slot_list::iterator it = p->expiring.begin();
+        it != p->expiring.end();
+        ++it)
+      p->timers.find(*it)->second.slot = &p->expiring;
+
+    ++p->tick;
+
+    // callbacks may cancel the other expiring timers
+    while (!p->expiring.empty()) {
+      impl::timer_map::iterator it = p->timers.find(p->expiring.front());
+      p->expiring.pop_front();
+      boost::function<void ()> callback;
+      callback.swap(it->second.callback);
+      p->timers.erase(it);
+      ++run;
+      callback();
+    }
+  }
+
+  return run;
+}
+
+timer_wheel::time_type timer_wheel::next_expiry() const {
+  if (p->timers.empty())
+    return NEVER;
+
+  time_type const t = p->tick;
+  time_type next = NEVER;
+
+  for (int k = 0; k < SLOTS; ++k) {
+    if (!p->wheel[0][(t + k) & MASK].empty()) {
+      next = t + k;
+      break;
+    }
+  }
+
+  // the higher levels: when their next non-empty slot is cascaded, which is
+  // no later than the deadlines in it
+  for (int level = 1; level < LEVELS; ++level) {
+    int const shift = BITS * level;
+    time_type const base = t >> shift;
+    int const first = (t & ((time_type(1) << shift) - 1)) ? 1 : 0;
+    for (int k = first; k < first + SLOTS; ++k) {
+      if (!p->wheel[level][(base + k) & MASK].empty()) {
+        time_type const cascade = (base + k) << shift;
+        if (cascade < next)
+          next = cascade;
+        break;
+      }
+    }
+  }
+
+  return next * p->resolution;
+}
+
+std::size_t timer_wheel::size() const {
+  return p->timers.size();
+}
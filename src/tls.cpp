@@ -3,6 +3,7 @@
 #include <gcrypt.h>
 #include <gnutls/gnutls.h>
 #include <cassert>
+#include <cerrno>
 #include <fstream>
 
 namespace rest { namespace tls {
@@ -203,15 +204,38 @@ namespace rest { namespace tls {
     gnutls_session_t get(session const &s) {
       return s.i_get_().session_;
     }
+
+    // the session owns the socket from the start: both are released if
+    // it cannot be set up, workers outlive failed sessions
+    struct session_guard {
+      gnutls_session_t *session;
+      int fd;
+
+      session_guard(int fd) : session(0), fd(fd) {}
+
+      ~session_guard() {
+        if(fd == -1)
+          return;
+        if(session)
+          gnutls_deinit(*session);
+        close(fd);
+      }
+
+      void dismiss() { fd = -1; }
+    };
   }
 
   session::session(x509_certificate_credentials const &cred, 
-                   priority const &prio, int fd)
+                   priority const &prio, int fd, bool http2, bool handshake)
     : p(new impl)
   {
+    p->fd = fd;
+    session_guard guard(fd);
+
     int ret = gnutls_init(&p->session_, GNUTLS_SERVER);
     if(ret != GNUTLS_E_SUCCESS)
       throw gnutls_error(ret, "session init");
+    guard.session = &p->session_;
 
     ret = gnutls_priority_set(p->session_, get(prio));
     if(ret < 0)
@@ -226,6 +250,22 @@ namespace rest { namespace tls {
      */
     gnutls_certificate_server_set_request(p->session_, GNUTLS_CERT_REQUEST);
 
+    if (http2) {
+#if GNUTLS_VERSION_NUMBER >= 0x030200
+      // the client's choice, HTTP/2 is detected by its preface later on
+      static char h2[] = "h2";
+      static char http11[] = "http/1.1";
+      gnutls_datum_t protocols[2];
+      protocols[0].data = reinterpret_cast<unsigned char *>(h2);
+      protocols[0].size = sizeof(h2) - 1;
+      protocols[1].data = reinterpret_cast<unsigned char *>(http11);
+      protocols[1].size = sizeof(http11) - 1;
+      ret = gnutls_alpn_set_protocols(p->session_, protocols, 2, 0);
+      if(ret < 0)
+        throw gnutls_error(ret, "alpn set protocols");
+#endif
+    }
+
 #ifdef ENABLE_SSL_COMPATIBILITY
     /* Set maximum compatibility mode. This is only suggested on public
      * webservers that need to trade security for compatibility
@@ -235,11 +275,12 @@ namespace rest { namespace tls {
 
     // TODO: sollte das hier gemacht werden?
     gnutls_transport_set_ptr(p->session_, (gnutls_transport_ptr_t)fd);
-    ret = gnutls_handshake(p->session_);
-    if(ret < 0) {
-      // TODO deinit
-      throw gnutls_error(ret, "handshake");
+    if(handshake) {
+      ret = gnutls_handshake(p->session_);
+      if(ret < 0)
+        throw gnutls_error(ret, "handshake");
     }
+    guard.dismiss();
   }
 
   session::~session() {
@@ -249,6 +290,57 @@ namespace rest { namespace tls {
     gnutls_deinit(p->session_);
   }
 
+  std::size_t session::pending() const {
+    return gnutls_record_check_pending(p->session_);
+  }
+
+  bool session::handshake(bool &want_write) {
+    int ret;
+    do {
+      ret = gnutls_handshake(p->session_);
+    } while(ret == GNUTLS_E_INTERRUPTED);
+    if(ret == GNUTLS_E_AGAIN) {
+      want_write = gnutls_record_get_direction(p->session_) == 1;
+      return false;
+    }
+    if(ret < 0)
+      throw gnutls_error(ret, "handshake");
+    return true;
+  }
+
+  std::streamsize session::read_some(char *buf, std::streamsize n) {
+    ssize_t res;
+    do {
+      res = gnutls_record_recv(p->session_, buf, n);
+    } while(res == GNUTLS_E_INTERRUPTED);
+    if(res == GNUTLS_E_AGAIN) {
+      errno = EAGAIN;
+      return -1;
+    }
+#ifdef GNUTLS_E_PREMATURE_TERMINATION
+    // clients mostly just close the connection
+    if(res == GNUTLS_E_PREMATURE_TERMINATION)
+      return 0;
+#endif
+    if(res < 0)
+      throw gnutls_error(res, "recv");
+    return res;
+  }
+
+  std::streamsize session::write_some(char const *buf, std::streamsize n) {
+    ssize_t res;
+    do {
+      res = gnutls_record_send(p->session_, buf, n);
+    } while(res == GNUTLS_E_INTERRUPTED);
+    if(res == GNUTLS_E_AGAIN) {
+      errno = EAGAIN;
+      return -1;
+    }
+    if(res < 0)
+      throw gnutls_error(res, "send");
+    return res;
+  }
+
   std::streamsize device::write(char_type const *buf, std::streamsize n) {
     assert(n >= 0);
     ssize_t res;
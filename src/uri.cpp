@@ -30,21 +30,31 @@ rest::utils::uri::unescape(
     std::string::const_iterator begin, std::string::const_iterator end,
     bool form)
 {
-  std::string result;
-  for (std::string::const_iterator it = begin; it != end; ++it)
+  std::string result(end - begin, '\0');
+  if (!result.empty())
+    result.resize(unescape(&*begin, &*begin + (end - begin), &result[0], form));
+  return result;
+}
+
+std::size_t
+rest::utils::uri::unescape(
+    char const *begin, char const *end, char *out, bool form)
+{
+  char *const start = out;
+  for (char const *it = begin; it != end; ++it)
     if (*it == '%' && it + 2 < end) {
       char code = from_hex(*(it + 1)) * 0x10 + from_hex(*(it + 2));
       if (code != '\0')
-        result += code;
+        *out++ = code;
       it += 2;
     }
     else if (form && *it == '+') {
-      result += ' ';
+      *out++ = ' ';
     }
     else {
-      result += *it;
+      *out++ = *it;
     }
-  return result;
+  return out - start;
 }
 
 namespace {
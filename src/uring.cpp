@@ -0,0 +1,355 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/uring.hpp"
+#include "rest/utils/exceptions.hpp"
+#include <cerrno>
+#include <cstring>
+
+#ifdef REST_HAVE_URING
+#include <linux/io_uring.h>
+#ifndef IORING_FEAT_RSRC_TAGS // headers older than 5.13
+#undef REST_HAVE_URING
+#endif
+#endif
+
+#ifdef REST_HAVE_URING
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+using rest::utils::uring;
+
+#ifdef REST_HAVE_URING
+
+namespace {
+  int io_uring_setup(unsigned entries, io_uring_params *params) {
+    return ::syscall(__NR_io_uring_setup, entries, params);
+  }
+
+  int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                     unsigned flags, void const *arg, std::size_t size)
+  {
+    return ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                     arg, size);
+  }
+
+  int io_uring_register(int fd, unsigned opcode, void const *arg,
+                        unsigned count)
+  {
+    return ::syscall(__NR_io_uring_register, fd, opcode, arg, count);
+  }
+}
+
+class uring::impl {
+public:
+  impl(unsigned entries)
+    : fd(-1), sq_ring(MAP_FAILED), cq_ring(MAP_FAILED), sqes(MAP_FAILED),
+      sq_ring_size(0), cq_ring_size(0), sqes_size(0),
+      tail(0), enters(0)
+  {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd = io_uring_setup(entries, &params);
+    if (fd < 0)
+      throw errno_error("io_uring_setup");
+
+    // timeouts and signal masks together need IORING_ENTER_EXT_ARG (5.11),
+    // multishot polls came with 5.13 which has no feature flag of its own
+    if (!(params.features & IORING_FEAT_EXT_ARG) ||
+        !(params.features & IORING_FEAT_RSRC_TAGS))
+    {
+      unmap();
+      errno = ENOSYS;
+      throw errno_error("io_uring (kernel too old)");
+    }
+
+    sq_entries = params.sq_entries;
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool const single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && cq_ring_size > sq_ring_size)
+      sq_ring_size = cq_ring_size;
+
+    sq_ring = ::mmap(0, sq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+      fail("mmap (io_uring sq)");
+
+    if (single) {
+      cq_ring = sq_ring;
+    } else {
+      cq_ring = ::mmap(0, cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq_ring == MAP_FAILED)
+        fail("mmap (io_uring cq)");
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = ::mmap(0, sqes_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+      fail("mmap (io_uring sqes)");
+
+    char *sq = static_cast<char *>(sq_ring);
+    sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    char *cq = static_cast<char *>(cq_ring);
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    tail = *sq_tail;
+  }
+
+  ~impl() {
+    unmap();
+  }
+
+  void fail(char const *what) {
+    int err = errno;
+    unmap();
+    errno = err;
+    throw errno_error(what);
+  }
+
+  void unmap() {
+    if (sqes != MAP_FAILED)
+      ::munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+      ::munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED)
+      ::munmap(sq_ring, sq_ring_size);
+    sqes = cq_ring = sq_ring = MAP_FAILED;
+    if (fd >= 0)
+      ::close(fd);
+    fd = -1;
+  }
+
+  // the next free submission entry, cleared; submits first if the queue
+  // does not have room for `n' entries (a chain is submitted together)
+  io_uring_sqe *next(unsigned n = 1) {
+    if (pending() + n > sq_entries)
+      enter(0, 0, 0);
+    unsigned const index = tail & sq_mask;
+    io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    ++tail;
+    return sqe;
+  }
+
+  // entries the kernel did not take yet
+  unsigned pending() const {
+    return tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  }
+
+  // a read or write
+  void transfer(int opcode, int fd, char const *buf, std::size_t n,
+                boost::int64_t offset, unsigned flags, boost::uint64_t data)
+  {
+    io_uring_sqe *sqe = next(flags & uring::LINK ? 2 : 1);
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<boost::uint64_t>(buf);
+    sqe->len = n;
+    sqe->off = offset;
+    if (flags & uring::FIXED_FILE)
+      sqe->flags |= IOSQE_FIXED_FILE;
+    if (flags & uring::LINK)
+      sqe->flags |= IOSQE_IO_LINK;
+    sqe->user_data = data;
+  }
+
+  int enter(unsigned min_complete, unsigned flags, void const *arg) {
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    ++enters;
+    return io_uring_enter(fd, pending(), min_complete, flags, arg,
+                          arg ? sizeof(io_uring_getevents_arg) : 0);
+  }
+
+  int fd;
+  void *sq_ring;
+  void *cq_ring;
+  void *sqes;
+  std::size_t sq_ring_size;
+  std::size_t cq_ring_size;
+  std::size_t sqes_size;
+
+  unsigned sq_entries;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned *sq_array;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe *cqes;
+
+  unsigned tail; // of the submission queue, published on enter()
+  unsigned long enters;
+};
+
+uring::uring(unsigned entries) : p(new impl(entries)) {}
+
+uring::~uring() {}
+
+bool uring::register_buffer(void *base, std::size_t size) {
+  iovec iov;
+  iov.iov_base = base;
+  iov.iov_len = size;
+  return io_uring_register(p->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+}
+
+bool uring::register_files(unsigned count) {
+  // a sparse table, update_file() fills it
+  std::vector<int> fds(count, -1);
+  return io_uring_register(p->fd, IORING_REGISTER_FILES, &fds[0], count) == 0;
+}
+
+void uring::update_file(unsigned index, int const *fd, boost::uint64_t data) {
+  io_uring_sqe *sqe = p->next();
+  sqe->opcode = IORING_OP_FILES_UPDATE;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<boost::uint64_t>(fd);
+  sqe->len = 1;
+  sqe->off = index;
+  sqe->user_data = data;
+}
+
+void uring::accept(int fd, sockaddr *addr, socklen_t *len, boost::uint64_t data) {
+  io_uring_sqe *sqe = p->next();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<boost::uint64_t>(addr);
+  sqe->addr2 = reinterpret_cast<boost::uint64_t>(len);
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = data;
+}
+
+void uring::poll(int fd, unsigned events, boost::uint64_t data) {
+  io_uring_sqe *sqe = p->next();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = data;
+}
+
+void uring::cancel_poll(boost::uint64_t target, boost::uint64_t data) {
+  io_uring_sqe *sqe = p->next();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = data;
+}
+
+void uring::read(int fd, char *buf, std::size_t n, boost::int64_t offset,
+                 unsigned flags, boost::uint64_t data)
+{
+  p->transfer(flags & FIXED_BUFFER ? IORING_OP_READ_FIXED : IORING_OP_READ,
+              fd, buf, n, offset, flags, data);
+}
+
+void uring::write(int fd, char const *buf, std::size_t n,
+                  boost::int64_t offset, unsigned flags, boost::uint64_t data)
+{
+  p->transfer(flags & FIXED_BUFFER ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+              fd, buf, n, offset, flags, data);
+}
+
+void uring::cancel(boost::uint64_t target, boost::uint64_t data) {
+  io_uring_sqe *sqe = p->next();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = data;
+}
+
+int uring::wait(completion *out, int max, unsigned ms, sigset_t const *mask) {
+  unsigned head = *p->cq_head;
+  bool const ready = head != __atomic_load_n(p->cq_tail, __ATOMIC_ACQUIRE);
+
+  __kernel_timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+
+  io_uring_getevents_arg arg;
+  std::memset(&arg, 0, sizeof(arg));
+  arg.sigmask = reinterpret_cast<boost::uint64_t>(mask);
+  arg.sigmask_sz = _NSIG / 8;
+  if (ms != unsigned(-1))
+    arg.ts = reinterpret_cast<boost::uint64_t>(&ts);
+
+  if (ready) {
+    // only submit
+    if (p->pending() && p->enter(0, 0, 0) < 0 && errno != EINTR)
+      throw errno_error("io_uring_enter");
+  } else if (p->enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg) < 0) {
+    if (errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY)
+      throw errno_error("io_uring_enter");
+  }
+
+  int n = 0;
+  unsigned const tail = __atomic_load_n(p->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail && n < max; ++head, ++n) {
+    io_uring_cqe const &cqe = p->cqes[head & p->cq_mask];
+    out[n].data = cqe.user_data;
+    out[n].result = cqe.res;
+    out[n].more = cqe.flags & IORING_CQE_F_MORE;
+  }
+  __atomic_store_n(p->cq_head, head, __ATOMIC_RELEASE);
+  return n;
+}
+
+unsigned long uring::enter_calls() const {
+  return p->enters;
+}
+
+#else
+
+class uring::impl {};
+
+uring::uring(unsigned) {
+  errno = ENOSYS;
+  throw errno_error("io_uring (not compiled in)");
+}
+
+uring::~uring() {}
+
+bool uring::register_buffer(void *, std::size_t) {
+  errno = ENOSYS;
+  return false;
+}
+
+bool uring::register_files(unsigned) {
+  errno = ENOSYS;
+  return false;
+}
+
+void uring::update_file(unsigned, int const *, boost::uint64_t) {}
+void uring::accept(int, sockaddr *, socklen_t *, boost::uint64_t) {}
+void uring::poll(int, unsigned, boost::uint64_t) {}
+void uring::cancel_poll(boost::uint64_t, boost::uint64_t) {}
+void uring::read(int, char *, std::size_t, boost::int64_t, unsigned,
+                 boost::uint64_t) {}
+void uring::write(int, char const *, std::size_t, boost::int64_t, unsigned,
+                  boost::uint64_t) {}
+void uring::cancel(boost::uint64_t, boost::uint64_t) {}
+
+int uring::wait(completion *, int, unsigned, sigset_t const *) {
+  return 0;
+}
+
+unsigned long uring::enter_calls() const {
+  return 0;
+}
+
+#endif
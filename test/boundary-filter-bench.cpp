@@ -1,10 +1,16 @@
 // vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
 #include "rest/utils/boundary_filter.hpp"
+#include "rest/utils/request_parser.hpp"
+#include "rest/utils/scan.hpp"
 #include <sstream>
 #include <fstream>
 #include <boost/ref.hpp>
 #include <boost/preprocessor/stringize.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/null.hpp>
 
 using namespace rest::utils;
 using namespace boost::iostreams;
@@ -84,6 +90,58 @@ namespace {
     std::ostringstream y;
     y << s.rdbuf();
   }
+
+  std::string upload;
+  std::string head;
+
+  void make_inputs() {
+    // a large text upload (lines of 60-odd bytes) ending with the boundary
+    std::string line =
+      "Lorem ipsum dolor sit amet, consectetur adipisici elit, sed eiusmod\r\n";
+    while (upload.size() < (8 << 20))
+      upload += line;
+    upload += "\r\n-------------------------------END!\r\n";
+
+    // a header-heavy GET
+    head = "GET /some/resource/path?with=query HTTP/1.1\r\n";
+    for (int i = 0; i < 30; ++i) {
+      std::ostringstream h;
+      h << "X-Header-Number-" << i << ": "
+        << "some value text, with a few tokens; q=0." << i << "\r\n";
+      head += h.str();
+    }
+    head += "\r\n";
+  }
+
+  // the upload read the way multipart parts used to be: through a chain
+  // with the entity stream pushed unbuffered under the filter
+  void testcase3() {
+    io::stream<io::array_source> entity(upload.data(), upload.size());
+    filtering_istream s;
+    s.push(boundary_filter("\r\n-------------------------------END!"));
+    s.push(boost::ref(entity), 0, 0);
+    io::copy(s, io::null_sink());
+  }
+
+  // the same with the filter scanning the buffer of the entity stream
+  void testcase5() {
+    io::stream<io::array_source> entity(upload.data(), upload.size());
+    filtering_istream s;
+    s.push(boundary_filter("\r\n-------------------------------END!",
+                           entity.rdbuf()));
+    s.push(boost::ref(entity), 0, 0);
+    io::copy(s, io::null_sink());
+  }
+
+  void testcase4() {
+    rest::utils::http::request_parser p;
+    for (int i = 0; i < 1000; ++i) {
+      p.reset();
+      while (p.parse(head.data(), head.size())
+              != rest::utils::http::request_parser::DONE)
+        ;
+    }
+  }
 }
 
 #define TEST(fun) \
@@ -101,4 +159,15 @@ int main() {
   TEST(testcase1nofilt)
   TEST(testcase2)
   TEST(testcase2nofilt)
+
+  // the same input with every scanning implementation the CPU supports
+  namespace scan = rest::utils::scan;
+  make_inputs();
+  for (int i = scan::SCALAR; i <= scan::best(); ++i) {
+    scan::use(scan::implementation(i));
+    std::cout << "Scanning with " << scan::name(scan::active()) << '\n';
+    TEST(testcase3) // 8MB upload through the chain
+    TEST(testcase5) // 8MB upload, scanning the entity's buffer
+    TEST(testcase4) // 1000 request heads with 30 fields
+  }
 }
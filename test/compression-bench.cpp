@@ -0,0 +1,88 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+// Throughput and ratio of the compressing encodings for all levels on
+// 8zara10.txt (run from the repository root).
+#include <rest/encoding.hpp>
+#include <rest/encodings/gzip.hpp>
+#include <rest/encodings/deflate.hpp>
+#include <rest/encodings/bzip2.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <sys/time.h>
+
+namespace io = boost::iostreams;
+
+namespace {
+  double now() {
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+
+  std::string compress(
+      rest::encoding &enc, rest::compression const &c, std::string const &in)
+  {
+    std::string out;
+    rest::encoding::output_chain chain;
+    enc.add_writer(chain, c);
+    chain.push(io::back_inserter(out));
+    io::filtering_ostream stream(chain);
+    // in pieces as io::copy passes on a streamed entity
+    for (std::size_t pos = 0; pos < in.size(); pos += 4096)
+      stream.write(in.data() + pos, std::min(in.size() - pos, std::size_t(4096)));
+    stream.reset();
+    return out;
+  }
+
+  void run(rest::encoding &enc, std::string const &in, int flush_size) {
+    for (int level = 1; level <= 9; ++level) {
+      rest::compression c;
+      c.level = level;
+      c.flush_size = flush_size;
+
+      unsigned runs = 0;
+      std::size_t size = 0;
+      double start = now();
+      double elapsed;
+      do {
+        size = compress(enc, c, in).size();
+        ++runs;
+        elapsed = now() - start;
+      } while (elapsed < 0.5);
+
+      std::cout << std::setw(8) << enc.name()
+                << "  level " << level
+                << "  flush " << std::setw(5) << flush_size
+                << std::fixed << std::setprecision(1)
+                << std::setw(9) << in.size() * runs / elapsed / 1e6 << " MB/s"
+                << std::setprecision(3)
+                << "  ratio " << double(size) / in.size() << '\n';
+    }
+  }
+}
+
+int main() {
+  std::ifstream file("8zara10.txt");
+  std::ostringstream text;
+  text << file.rdbuf();
+  std::string const in = text.str();
+  if (in.empty()) {
+    std::cerr << "8zara10.txt not found\n";
+    return 1;
+  }
+
+  rest::encodings::gzip gzip;
+  rest::encodings::deflate deflate;
+  rest::encodings::bzip2 bzip2;
+
+  std::cout << in.size() << " bytes\n";
+  run(gzip, in, 0);
+  run(deflate, in, 0);
+  // flushing after every 4k piece
+  run(gzip, in, 4096);
+  run(bzip2, in, 0);
+}
@@ -1,5 +1,10 @@
 // vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
 #include <rest/encoding.hpp>
+#include <rest/utils/deflate_filter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <zlib.h>
+#include <cstring>
 #include <testsoon.hpp>
 
 using rest::encoding;
@@ -24,3 +29,90 @@ TEST(identity) {
 }
 
 }
+
+TEST_GROUP(deflate_filter) {
+
+namespace io = boost::iostreams;
+using rest::utils::deflate_filter;
+
+std::string text() {
+  std::string x;
+  for (int i = 0; i < 20000; ++i)
+    x += char('a' + (i * i) % 26);
+  return x;
+}
+
+std::string compress(std::string const &in, deflate_filter const &filter) {
+  std::string out;
+  io::filtering_ostream stream;
+  stream.push(filter);
+  stream.push(io::back_inserter(out));
+  stream << in;
+  stream.reset();
+  return out;
+}
+
+std::string decompress(std::string const &in, int window_bits) {
+  z_stream z;
+  std::memset(&z, 0, sizeof(z));
+  inflateInit2(&z, window_bits);
+  z.next_in = (Bytef *) in.data();
+  z.avail_in = in.size();
+  std::string out;
+  char buf[4096];
+  int ret;
+  do {
+    z.next_out = (Bytef *) buf;
+    z.avail_out = sizeof(buf);
+    ret = inflate(&z, Z_SYNC_FLUSH);
+    out.append(buf, sizeof(buf) - z.avail_out);
+  } while (ret == Z_OK && z.avail_out == 0);
+  inflateEnd(&z);
+  return out;
+}
+
+XTEST((values, (int)(-1)(0)(1)(9))) {
+  std::string in = text();
+  Equals(decompress(compress(in, deflate_filter(deflate_filter::RAW, value)),
+                    -MAX_WBITS),
+         in);
+  Equals(decompress(compress(in, deflate_filter(deflate_filter::ZLIB, value)),
+                    MAX_WBITS),
+         in);
+  Equals(decompress(compress(in, deflate_filter(deflate_filter::GZIP, value)),
+                    MAX_WBITS + 16),
+         in);
+}
+
+TEST(window and memory) {
+  std::string in = text();
+  Equals(decompress(
+           compress(in, deflate_filter(deflate_filter::RAW, 6, 8, 1)),
+           -MAX_WBITS),
+         in);
+}
+
+TEST(flush) {
+  std::string out;
+  io::filtering_ostream stream;
+  stream.push(deflate_filter(deflate_filter::GZIP, -1, -1, -1, 1));
+  stream.push(io::back_inserter(out));
+
+  // everything written so far can be decompressed before the end
+  stream << "hello" << std::flush;
+  Equals(decompress(out, MAX_WBITS + 16), "hello");
+  stream << " world" << std::flush;
+  Equals(decompress(out, MAX_WBITS + 16), "hello world");
+}
+
+TEST(no flush) {
+  std::string out;
+  io::filtering_ostream stream;
+  stream.push(deflate_filter(deflate_filter::GZIP));
+  stream.push(io::back_inserter(out));
+
+  stream << "hello" << std::flush;
+  Equals(decompress(out, MAX_WBITS + 16), "");
+}
+
+}
@@ -0,0 +1,214 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+// Requests per second and latency of a running server, one connection per
+// request to stress accepting (compare /connections/engine 'event' and
+// 'uring'):
+//   engine-bench [host [port [requests [concurrency [uri [pid...]]]]]]
+// With the pids of the processes serving the connections (the workers), it
+// also counts their system calls per request. That takes the
+// raw_syscalls:sys_enter tracepoint (tracefs mounted on /sys/kernel/tracing
+// or /sys/kernel/debug/tracing) and perf_event_open(2) permission.
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+namespace {
+  double now() {
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+
+  // true if a complete response came back before the server closed
+  bool request(sockaddr_in const &addr, std::string const &req) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+      return false;
+    bool ok = false;
+    if (::connect(fd, (sockaddr const *) &addr, sizeof(addr)) == 0 &&
+        ::write(fd, req.data(), req.size()) == ssize_t(req.size()))
+    {
+      char buf[16384];
+      ssize_t n;
+      std::size_t got = 0;
+      while ((n = ::read(fd, buf, sizeof(buf))) > 0)
+        got += n;
+      ok = n == 0 && got > 0;
+    }
+    ::close(fd);
+    return ok;
+  }
+
+  // runs `n' requests and writes their latencies (negative: failed) to `out'
+  void client(sockaddr_in const &addr, std::string const &req, int n, int out) {
+    std::vector<double> latencies;
+    for (int i = 0; i < n; ++i) {
+      double start = now();
+      bool ok = request(addr, req);
+      double t = now() - start;
+      latencies.push_back(ok ? t : -t);
+    }
+    char const *data = (char const *) &latencies[0];
+    std::size_t size = latencies.size() * sizeof(double);
+    while (size > 0) {
+      ssize_t w = ::write(out, data, size);
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        break;
+      data += w;
+      size -= w;
+    }
+  }
+
+  // the id of the tracepoint entered by every system call, -1 if unknown
+  long sys_enter_id() {
+    char const *paths[] = {
+      "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+      "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
+    };
+    for (std::size_t i = 0; i < sizeof(paths) / sizeof(*paths); ++i) {
+      std::ifstream in(paths[i]);
+      long id;
+      if (in >> id)
+        return id;
+    }
+    return -1;
+  }
+
+  // counts the system calls of process `pid' from now on, -1 on failure
+  int count_syscalls(long tracepoint, pid_t pid) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.size = sizeof(attr);
+    attr.config = tracepoint;
+    return ::syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
+  }
+
+  unsigned long long counted(int fd) {
+    unsigned long long n = 0;
+    if (::read(fd, &n, sizeof(n)) != ssize_t(sizeof(n)))
+      return 0;
+    return n;
+  }
+}
+
+int main(int argc, char **argv) {
+  char const *host = argc > 1 ? argv[1] : "127.0.0.1";
+  int port = argc > 2 ? std::atoi(argv[2]) : 8080;
+  int requests = argc > 3 ? std::atoi(argv[3]) : 10000;
+  int concurrency = argc > 4 ? std::atoi(argv[4]) : 16;
+  std::string uri = argc > 5 ? argv[5] : "/";
+
+  if (requests <= 0 || concurrency <= 0 || concurrency > requests) {
+    std::cerr << "usage: engine-bench "
+                 "[host [port [requests [concurrency [uri [pid...]]]]]]\n";
+    return 1;
+  }
+
+  std::vector<int> counters;
+  if (argc > 6) {
+    long tracepoint = sys_enter_id();
+    if (tracepoint < 0) {
+      std::cerr << "raw_syscalls:sys_enter not found (is tracefs mounted?)\n";
+      return 1;
+    }
+    for (int i = 6; i < argc; ++i) {
+      int fd = count_syscalls(tracepoint, std::atoi(argv[i]));
+      if (fd < 0) {
+        std::cerr << "perf_event_open " << argv[i] << ": "
+                  << std::strerror(errno) << '\n';
+        return 1;
+      }
+      counters.push_back(fd);
+    }
+  }
+  unsigned long long syscalls_before = 0;
+  for (std::size_t i = 0; i < counters.size(); ++i)
+    syscalls_before += counted(counters[i]);
+
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (::inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    std::cerr << "not an IPv4 address: " << host << '\n';
+    return 1;
+  }
+
+  std::string req = "GET " + uri + " HTTP/1.1\r\nHost: " + host
+    + "\r\nConnection: close\r\n\r\n";
+
+  std::vector<int> pipes;
+  double start = now();
+  for (int c = 0; c < concurrency; ++c) {
+    int fds[2];
+    if (::pipe(fds) < 0) {
+      std::cerr << "pipe: " << std::strerror(errno) << '\n';
+      return 1;
+    }
+    int n = requests / concurrency + (c < requests % concurrency);
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      ::close(fds[0]);
+      client(addr, req, n, fds[1]);
+      _exit(0);
+    }
+    ::close(fds[1]);
+    pipes.push_back(fds[0]);
+  }
+
+  std::vector<double> latencies;
+  for (std::size_t c = 0; c < pipes.size(); ++c) {
+    double t;
+    while (::read(pipes[c], &t, sizeof(t)) == ssize_t(sizeof(t)))
+      latencies.push_back(t);
+    ::close(pipes[c]);
+  }
+  while (::wait(0) > 0)
+    ;
+  double elapsed = now() - start;
+
+  unsigned long long syscalls = 0;
+  for (std::size_t i = 0; i < counters.size(); ++i)
+    syscalls += counted(counters[i]);
+  syscalls -= syscalls_before;
+
+  std::size_t failed = 0;
+  for (std::size_t i = 0; i < latencies.size(); ++i) {
+    if (latencies[i] < 0) {
+      latencies[i] = -latencies[i];
+      ++failed;
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+  if (latencies.empty())
+    return 1;
+
+  std::cout << std::fixed << std::setprecision(0)
+            << latencies.size() / elapsed << " req/s, "
+            << std::setprecision(3)
+            << "p50 " << latencies[latencies.size() / 2] * 1000 << " ms, "
+            << "p99 " << latencies[latencies.size() * 99 / 100] * 1000 << " ms, "
+            << failed << " failed";
+  if (!counters.empty())
+    std::cout << ", " << std::setprecision(2)
+              << double(syscalls) / latencies.size() << " syscalls/request";
+  std::cout << '\n';
+  return failed != 0;
+}
@@ -4,6 +4,7 @@
 #include "rest/utils/boundary_filter.hpp"
 #include <testsoon.hpp>
 #include <sstream>
+#include <iterator>
 #include <boost/ref.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 
@@ -209,6 +210,36 @@ TEST() {
   Equals(x.tellg(), std::streampos(11));
 }
 
+TEST(reading the buffered input directly) {
+  std::istringstream x("a\r\nb\r\n--bound\r\nrest");
+  filtering_istream s;
+  s.push(boundary_filter("\r\n--bound", x.rdbuf()));
+  s.push(boost::ref(x), 0, 0);
+  std::ostringstream y;
+  y << s.rdbuf();
+  Equals(y.str(), "a\r\nb");
+  Equals(std::string(std::istreambuf_iterator<char>(x),
+                     std::istreambuf_iterator<char>()), "rest");
+}
+
+TEST(partial boundaries in the buffered input) {
+  std::string data;
+  for (int i = 0; data.size() < 100000; ++i) {
+    data += "some data\r\n--boun";
+    data += char('0' + i % 10);
+    data += "\r\n-";
+  }
+  std::istringstream x(data + "\r\n--bound\r\nrest");
+  filtering_istream s;
+  s.push(boundary_filter("\r\n--bound", x.rdbuf()));
+  s.push(boost::ref(x), 0, 0);
+  std::ostringstream y;
+  y << s.rdbuf();
+  Equals(y.str(), data);
+  Equals(std::string(std::istreambuf_iterator<char>(x),
+                     std::istreambuf_iterator<char>()), "rest");
+}
+
 }
 
 }
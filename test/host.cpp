@@ -0,0 +1,98 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/host.hpp"
+#include <stdexcept>
+#include <sstream>
+#include <vector>
+#include <testsoon.hpp>
+
+TEST_GROUP(host_container) {
+
+TEST(exact) {
+  rest::host a("example.com");
+  rest::host b("www.example.com");
+  rest::host_container hosts;
+  hosts.add_host(a);
+  hosts.add_host(b);
+
+  Equals(hosts.get_host("example.com"), &a);
+  Equals(hosts.get_host("www.example.com"), &b);
+  Equals(hosts.get_host("WWW.Example.COM"), &b);
+  Equals(hosts.get_host("www.example.com:8080"), &b);
+  Equals(hosts.get_host("www.example.com."), &b);
+  Equals(hosts.get_host("example.org"), (rest::host const *) 0);
+  Equals(hosts.get_host(""), (rest::host const *) 0);
+}
+
+TEST(below) {
+  rest::host a("example.com");
+  rest::host any("");
+  rest::host_container hosts;
+  hosts.add_host(a);
+  hosts.add_host(any);
+
+  Equals(hosts.get_host("a.b.example.com"), &a);
+  Equals(hosts.get_host("xexample.com"), &any);
+  Equals(hosts.get_host("com"), &any);
+  Equals(hosts.get_host(""), &any);
+}
+
+TEST(wildcard) {
+  rest::host a("example.com");
+  rest::host all("*.example.com");
+  rest::host www("www.example.com");
+  rest::host_container hosts;
+  hosts.add_host(a);
+  hosts.add_host(all);
+  hosts.add_host(www);
+
+  Equals(hosts.get_host("example.com"), &a);
+  Equals(hosts.get_host("mail.example.com"), &all);
+  Equals(hosts.get_host("a.mail.example.com:80"), &all);
+  Equals(hosts.get_host("www.example.com"), &www);
+  Equals(hosts.get_host("x.www.example.com"), &www);
+  Equals(hosts.get_host("example.org"), (rest::host const *) 0);
+}
+
+TEST(ipv6) {
+  rest::host a("[::1]");
+  rest::host_container hosts;
+  hosts.add_host(a);
+
+  Equals(hosts.get_host("[::1]:8080"), &a);
+  Equals(hosts.get_host("[::1]"), &a);
+  Equals(hosts.get_host("[::2]"), (rest::host const *) 0);
+}
+
+TEST(many) {
+  std::vector<rest::host *> all;
+  rest::host_container hosts;
+  for (int i = 0; i < 500; ++i) {
+    std::ostringstream name;
+    name << (i % 2 ? "*." : "") << "host" << i << ".example.com";
+    all.push_back(new rest::host(name.str()));
+    hosts.add_host(*all.back());
+  }
+  for (int i = 0; i < 500; ++i) {
+    std::ostringstream name;
+    name << (i % 2 ? "x." : "") << "host" << i << ".example.com";
+    Equals(hosts.get_host(name.str()), all[i]);
+  }
+  Equals(hosts.get_host("host1.example.com"), (rest::host const *) 0);
+  for (std::size_t i = 0; i < all.size(); ++i)
+    delete all[i];
+}
+
+TEST(same name) {
+  rest::host a("example.com");
+  rest::host b("Example.com");
+  rest::host_container hosts;
+  hosts.add_host(a);
+  try {
+    hosts.add_host(b);
+    Check(!"two hosts for one name");
+  } catch (std::logic_error &) {
+  }
+  Equals(hosts.get_host("example.com"), &a);
+}
+
+}
@@ -0,0 +1,221 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/hpack.hpp"
+#include <string>
+#include <testsoon.hpp>
+
+namespace hpack = rest::utils::hpack;
+
+namespace {
+  std::string unhex(char const *s) {
+    std::string out;
+    int n = -1;
+    for (; *s; ++s) {
+      int d;
+      if (*s >= '0' && *s <= '9')
+        d = *s - '0';
+      else if (*s >= 'a' && *s <= 'f')
+        d = *s - 'a' + 10;
+      else
+        continue;
+      if (n < 0) {
+        n = d;
+      } else {
+        out += char(n * 16 + d);
+        n = -1;
+      }
+    }
+    return out;
+  }
+
+  hpack::header_list decode(hpack::decoder &d, char const *hex) {
+    std::string block = unhex(hex);
+    hpack::header_list out;
+    d.decode(block.data(), block.size(), out);
+    return out;
+  }
+
+  bool fails(char const *hex) {
+    hpack::decoder d;
+    try {
+      decode(d, hex);
+    } catch (hpack::error &) {
+      return true;
+    }
+    return false;
+  }
+}
+
+TEST_GROUP(hpack) {
+
+// RFC 7541, C.3
+TEST(requests without huffman) {
+  hpack::decoder d;
+  hpack::header_list h = decode(d,
+    "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+  Equals(h.size(), 4U);
+  Equals(h[0].first, ":method");
+  Equals(h[0].second, "GET");
+  Equals(h[2].second, "/");
+  Equals(h[3].first, ":authority");
+  Equals(h[3].second, "www.example.com");
+  Equals(d.table_size(), 57U);
+
+  h = decode(d, "8286 84be 5808 6e6f 2d63 6163 6865");
+  Equals(h.size(), 5U);
+  Equals(h[3].second, "www.example.com");
+  Equals(h[4].first, "cache-control");
+  Equals(h[4].second, "no-cache");
+  Equals(d.table_size(), 110U);
+
+  h = decode(d,
+    "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65");
+  Equals(h.size(), 5U);
+  Equals(h[1].second, "https");
+  Equals(h[2].second, "/index.html");
+  Equals(h[3].second, "www.example.com");
+  Equals(h[4].first, "custom-key");
+  Equals(h[4].second, "custom-value");
+  Equals(d.table_size(), 164U);
+}
+
+// RFC 7541, C.4
+TEST(requests with huffman) {
+  hpack::decoder d;
+  hpack::header_list h = decode(d, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff");
+  Equals(h.size(), 4U);
+  Equals(h[3].second, "www.example.com");
+
+  h = decode(d, "8286 84be 5886 a8eb 1064 9cbf");
+  Equals(h.size(), 5U);
+  Equals(h[4].second, "no-cache");
+
+  h = decode(d,
+    "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf");
+  Equals(h.size(), 5U);
+  Equals(h[4].first, "custom-key");
+  Equals(h[4].second, "custom-value");
+  Equals(d.table_size(), 164U);
+}
+
+TEST(eviction) {
+  // room for one of the entries only
+  hpack::decoder d(80);
+  decode(d, "4004 6e61 6d65 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+  Equals(d.table_size(), 51U);
+  hpack::header_list h = decode(d, "4004 6e61 6d65 0576 616c 7565 be");
+  Equals(d.table_size(), 41U);
+  Equals(h[1].second, "value");
+  Check(fails("4004 6e61 6d65 0576 616c 7565 bf"));
+}
+
+TEST(table size update) {
+  hpack::decoder d;
+  decode(d, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+  Equals(d.table_size(), 57U);
+  decode(d, "20");
+  Equals(d.table_size(), 0U);
+  // above the announced maximum, after a header
+  Check(fails("3fe2 1f"));
+  Check(fails("82 20"));
+}
+
+TEST(huffman encoding) {
+  std::string out;
+  hpack::huffman_encode("www.example.com", out);
+  Equals(out, unhex("f1e3 c2e5 f23a 6ba0 ab90 f4ff"));
+  Equals(hpack::huffman_length("www.example.com"), 12U);
+
+  std::string back;
+  hpack::huffman_decode(out.data(), out.size(), back);
+  Equals(back, "www.example.com");
+}
+
+TEST(huffman all bytes) {
+  std::string in;
+  for (int i = 0; i < 256; ++i)
+    in += char(i);
+  std::string code;
+  hpack::huffman_encode(in, code);
+  std::string back;
+  hpack::huffman_decode(code.data(), code.size(), back);
+  Check(back == in);
+}
+
+TEST(invalid huffman) {
+  std::string out;
+  // padding longer than 7 bits
+  std::string s = unhex("f1e3 c2e5 f23a 6ba0 ab90 f4ff ff");
+  bool failed = false;
+  try {
+    hpack::huffman_decode(s.data(), s.size(), out);
+  } catch (hpack::error &) {
+    failed = true;
+  }
+  Check(failed);
+  // padding not made of ones: '0' is 00000, padded with zeros
+  s = unhex("00");
+  failed = false;
+  try {
+    hpack::huffman_decode(s.data(), s.size(), out);
+  } catch (hpack::error &) {
+    failed = true;
+  }
+  Check(failed);
+  // EOS
+  s = unhex("ffff fffc");
+  failed = false;
+  try {
+    hpack::huffman_decode(s.data(), s.size(), out);
+  } catch (hpack::error &) {
+    failed = true;
+  }
+  Check(failed);
+}
+
+TEST(malformed) {
+  Check(fails("80"));
+  Check(fails("ff ff ff ff ff 0f"));
+  Check(fails("bf"));
+  Check(fails("40 05 61"));
+  Check(fails("0f"));
+}
+
+TEST(header list limit) {
+  hpack::decoder d(4096, 64);
+  hpack::header_list h;
+  std::string block = unhex("4004 6e61 6d65 0576 616c 7565");
+  d.decode(block.data(), block.size(), h);
+  bool failed = false;
+  try {
+    block += block;
+    d.decode(block.data(), block.size(), h);
+  } catch (hpack::error &) {
+    failed = true;
+  }
+  Check(failed);
+}
+
+TEST(round trip) {
+  hpack::header_list in;
+  in.push_back(hpack::header(":status", "200"));
+  in.push_back(hpack::header(":status", "302"));
+  in.push_back(hpack::header("content-type", "text/html; charset=utf-8"));
+  in.push_back(hpack::header("x-custom", "\x01\xff"));
+  in.push_back(hpack::header("accept-encoding", "gzip, deflate"));
+  in.push_back(hpack::header("content-length",
+    std::string(300, 'x')));
+
+  hpack::encoder e;
+  std::string block;
+  e.encode(in, block);
+  // fully indexed
+  Equals(block[0], char(0x88));
+
+  hpack::decoder d;
+  hpack::header_list out;
+  d.decode(block.data(), block.size(), out);
+  Check(out == in);
+  Equals(d.table_size(), 0U);
+}
+
+}
@@ -0,0 +1,405 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include <rest/http_connection.hpp>
+#include <rest/host.hpp>
+#include <rest/logger.hpp>
+#include <rest/context.hpp>
+#include <rest/responder.hpp>
+#include <rest/response.hpp>
+#include <rest/keywords.hpp>
+#include <rest/input_stream.hpp>
+#include <rest/config.hpp>
+#include <rest/utils/hpack.hpp>
+#include <boost/iostreams/combine.hpp>
+#include <boost/iostreams/stream_buffer.hpp>
+#include <sstream>
+#include <vector>
+#include <iterator>
+#include <testsoon.hpp>
+
+namespace hpack = rest::utils::hpack;
+
+namespace {
+  char const PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+  struct frame {
+    int type;
+    int flags;
+    unsigned id;
+    std::string payload;
+  };
+
+  std::string make_frame(int type, int flags, unsigned id,
+                         std::string const &payload = std::string())
+  {
+    std::string out;
+    out += char(payload.size() >> 16);
+    out += char(payload.size() >> 8);
+    out += char(payload.size());
+    out += char(type);
+    out += char(flags);
+    out += char(id >> 24);
+    out += char(id >> 16);
+    out += char(id >> 8);
+    out += char(id);
+    return out + payload;
+  }
+
+  std::string headers(unsigned id, hpack::header_list const &h,
+                      bool end_stream = true)
+  {
+    std::string block;
+    hpack::encoder().encode(h, block);
+    return make_frame(1, 0x4 | (end_stream ? 0x1 : 0), id, block);
+  }
+
+  hpack::header_list get(std::string const &path) {
+    hpack::header_list h;
+    h.push_back(hpack::header(":method", "GET"));
+    h.push_back(hpack::header(":scheme", "http"));
+    h.push_back(hpack::header(":path", path));
+    h.push_back(hpack::header(":authority", "x"));
+    return h;
+  }
+
+  std::string setting(int id, unsigned value) {
+    std::string s;
+    s += char(id >> 8);
+    s += char(id);
+    s += char(value >> 24);
+    s += char(value >> 16);
+    s += char(value >> 8);
+    s += char(value);
+    return s;
+  }
+
+  std::vector<frame> frames(std::string const &out) {
+    std::vector<frame> result;
+    std::size_t pos = 0;
+    while (pos + 9 <= out.size()) {
+      unsigned char const *d =
+        reinterpret_cast<unsigned char const *>(out.data() + pos);
+      frame f;
+      std::size_t length = (d[0] << 16) | (d[1] << 8) | d[2];
+      f.type = d[3];
+      f.flags = d[4];
+      f.id = ((d[5] & 0x7f) << 24) | (d[6] << 16) | (d[7] << 8) | d[8];
+      f.payload = out.substr(pos + 9, length);
+      result.push_back(f);
+      pos += 9 + length;
+    }
+    return result;
+  }
+
+  // the first frame of `type' on stream `id'
+  frame const *find(std::vector<frame> const &f, int type, unsigned id) {
+    for (std::size_t i = 0; i < f.size(); ++i)
+      if (f[i].type == type && f[i].id == id)
+        return &f[i];
+    return 0;
+  }
+
+  std::string header(frame const *f, std::string const &name) {
+    hpack::header_list h;
+    hpack::decoder().decode(f->payload.data(), f->payload.size(), h);
+    for (std::size_t i = 0; i < h.size(); ++i)
+      if (h[i].first == name)
+        return h[i].second;
+    return "";
+  }
+
+  // all DATA on stream `id'
+  std::string data(std::vector<frame> const &f, unsigned id) {
+    std::string out;
+    for (std::size_t i = 0; i < f.size(); ++i)
+      if (f[i].type == 0 && f[i].id == id)
+        out += f[i].payload;
+    return out;
+  }
+
+  unsigned error_code(frame const *f) {
+    std::string const &p = f->payload;
+    std::size_t at = f->type == 7 ? 4 : 0;
+    return (unsigned char)p[at + 3];
+  }
+
+  rest::network::address ip4(boost::uint32_t x) {
+    rest::network::address addr;
+    addr.type = rest::network::ip4;
+    addr.addr.ip4 = x;
+    return addr;
+  }
+}
+
+TEST_GROUP(http2) {
+
+struct hello_responder : rest::responder<rest::GET> {
+  rest::response get() {
+    return rest::response("text/plain", "hello");
+  }
+};
+
+struct stream_responder : rest::responder<rest::GET> {
+  rest::response get() {
+    rest::response resp("text/plain");
+    rest::input_stream data(new std::istringstream("streamed"));
+    resp.set_data(data, false);
+    return resp;
+  }
+};
+
+// more than the windows hold, from a stream of unknown length
+struct big_responder : rest::responder<rest::GET> {
+  rest::response get() {
+    rest::response resp("text/plain");
+    rest::input_stream data(new std::istringstream(big()));
+    resp.set_data(data, false);
+    return resp;
+  }
+
+  static std::string big() {
+    std::string x(200000, '0');
+    for (std::size_t i = 0; i < x.size(); ++i)
+      x[i] += i % 10;
+    return x;
+  }
+};
+
+struct echo_responder : rest::responder<rest::POST> {
+  bool allow_entity(std::string const &) const {
+    return true;
+  }
+
+  void prepare() {
+    get_keywords().declare("body", rest::ENTITY);
+  }
+
+  rest::response post() {
+    std::istream &in = get_keywords().read("body");
+    std::string body((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+    return rest::response("text/plain", body);
+  }
+};
+
+struct group_fixture_t {
+  std::string servername;
+  rest::network::address addr;
+  hello_responder hello;
+  stream_responder stream;
+  big_responder big;
+  echo_responder echo;
+  rest::host host;
+  rest::host_container hosts;
+
+  group_fixture_t()
+  : servername("SERVERNAME"),
+    addr(ip4(0)),
+    host("")
+  {
+    host.get_context().bind("/", hello);
+    host.get_context().bind("/stream", stream);
+    host.get_context().bind("/big", big);
+    host.get_context().bind("/echo", echo);
+    hosts.add_host(host);
+  }
+
+  std::vector<frame> serve(std::string const &input) {
+    std::istringstream in(PREFACE + input);
+    std::stringstream output;
+
+    namespace io = boost::iostreams;
+
+    typedef io::combination<std::istringstream, std::stringstream> combination_type;
+    combination_type dev = io::combine(boost::ref(in), boost::ref(output));
+    std::auto_ptr<std::streambuf> p(new io::stream_buffer<combination_type>(dev));
+
+    rest::http_connection(hosts, addr, servername, new rest::null_logger)
+      .serve(p);
+    return frames(output.str());
+  }
+};
+
+GFTEST(prior knowledge) {
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + headers(1, get("/")));
+  Check(f.size() >= 4U);
+  // our SETTINGS first
+  Equals(f[0].type, 4);
+  Equals(f[0].flags, 0);
+  Check(find(f, 4, 0));
+  frame const *h = find(f, 1, 1);
+  Check(h);
+  Equals(header(h, ":status"), "200");
+  Equals(header(h, "server"), "SERVERNAME");
+  Equals(header(h, "content-type"), "text/plain");
+  Equals(header(h, "connection"), "");
+  Equals(data(f, 1), "hello");
+  Equals(f.back().type, 0);
+  Equals(f.back().flags & 0x1, 1);
+}
+
+GFTEST(multiplexed streams) {
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + headers(1, get("/")) + headers(3, get("/stream"))
+    + headers(5, get("/nothing")));
+  Equals(data(f, 1), "hello");
+  // chunked in HTTP/1.1
+  Equals(data(f, 3), "streamed");
+  Equals(header(find(f, 1, 3), "transfer-encoding"), "");
+  Equals(header(find(f, 1, 5), ":status"), "404");
+}
+
+GFTEST(request entity) {
+  hpack::header_list h = get("/echo");
+  h[0].second = "POST";
+  h.push_back(hpack::header("content-type", "text/plain"));
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + headers(1, h, false)
+    + make_frame(0, 0, 1, "abc") + make_frame(0, 0x1, 1, "def"));
+  Equals(header(find(f, 1, 1), ":status"), "200");
+  Equals(data(f, 1), "abcdef");
+  // the windows are replenished
+  Check(find(f, 8, 0));
+  Check(find(f, 8, 1));
+}
+
+GFTEST(request entity too large) {
+  rest::utils::set(rest::config::get().tree(), 4,
+                   "general", "http2", "max_entity_size");
+  hpack::header_list h = get("/echo");
+  h[0].second = "POST";
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + headers(1, h, false)
+    + make_frame(0, 0, 1, "abcdef"));
+  rest::utils::set(rest::config::get().tree(), 1048576,
+                   "general", "http2", "max_entity_size");
+  Equals(header(find(f, 1, 1), ":status"), "413");
+  Check(find(f, 3, 1));
+}
+
+GFTEST(flow control) {
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0, setting(4, 3)) + headers(1, get("/")));
+  Equals(data(f, 1), "hel");
+
+  std::string update("\0\0\0\x10", 4);
+  f = group_fixture.serve(
+    make_frame(4, 0, 0, setting(4, 3)) + headers(1, get("/"))
+    + make_frame(8, 0, 1, update));
+  Equals(data(f, 1), "hello");
+}
+
+GFTEST(large entity under flow control) {
+  // without window updates only the initial windows go out
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + headers(1, get("/big")));
+  Equals(data(f, 1), big_responder::big().substr(0, 65535));
+
+  std::string update("\0\x10\0\0", 4);
+  f = group_fixture.serve(
+    make_frame(4, 0, 0) + headers(1, get("/big"))
+    + make_frame(8, 0, 0, update) + make_frame(8, 0, 1, update));
+  Equals(data(f, 1), big_responder::big());
+  for (std::size_t i = 0; i < f.size(); ++i)
+    Check(f[i].payload.size() <= 16384U);
+  Equals(f.back().type, 0);
+  Equals(f.back().flags & 0x1, 1);
+}
+
+GFTEST(bad priority keeps the header table) {
+  // stream 1 adds a field to the table, stream 3 refers to it
+  std::string block1;
+  hpack::encoder().encode(get("/"), block1);
+  block1 += std::string("\x40\x03x-a\x01" "1");
+  std::string block3;
+  hpack::encoder().encode(get("/"), block3);
+  block3 += '\xbe';
+  // depends on itself
+  std::string priority("\0\0\0\x01\x0f", 5);
+
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + make_frame(1, 0x25, 1, priority + block1)
+    + make_frame(1, 0x5, 3, block3));
+  Check(!find(f, 7, 0));
+  Check(find(f, 3, 1));
+  Equals(error_code(find(f, 3, 1)), 1U);
+  Equals(data(f, 3), "hello");
+
+  // with the header block continued
+  f = group_fixture.serve(
+    make_frame(4, 0, 0)
+    + make_frame(1, 0x21, 1, priority + block1.substr(0, 3))
+    + make_frame(9, 0x4, 1, block1.substr(3))
+    + make_frame(1, 0x5, 3, block3));
+  Check(!find(f, 7, 0));
+  Equals(error_code(find(f, 3, 1)), 1U);
+  Equals(data(f, 3), "hello");
+}
+
+GFTEST(ping) {
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + make_frame(6, 0, 0, "12345678"));
+  frame const *ping = find(f, 6, 0);
+  Check(ping);
+  Equals(ping->flags, 1);
+  Equals(ping->payload, "12345678");
+}
+
+GFTEST(first frame not settings) {
+  std::vector<frame> f = group_fixture.serve(headers(1, get("/")));
+  frame const *goaway = find(f, 7, 0);
+  Check(goaway);
+  Equals(error_code(goaway), 1U);
+}
+
+GFTEST(compression error) {
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + make_frame(1, 0x5, 1, "\xff\xff\xff\xff\xff\x0f"));
+  frame const *goaway = find(f, 7, 0);
+  Check(goaway);
+  Equals(error_code(goaway), 9U);
+}
+
+GFTEST(frame too large) {
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + make_frame(0, 0, 1, std::string(16385, 'x')));
+  frame const *goaway = find(f, 7, 0);
+  Check(goaway);
+  Equals(error_code(goaway), 6U);
+}
+
+GFTEST(malformed request) {
+  hpack::header_list h = get("/");
+  h.push_back(hpack::header("X-Upper", "1"));
+  hpack::header_list h2 = get("/");
+  h2.push_back(hpack::header("connection", "close"));
+  hpack::header_list h3 = get("/");
+  h3.push_back(hpack::header("x-crlf", "a\r\nb"));
+  std::vector<frame> f = group_fixture.serve(
+    make_frame(4, 0, 0) + headers(1, h) + headers(3, h2) + headers(5, h3)
+    + headers(7, get("/")));
+  Check(find(f, 3, 1));
+  Check(find(f, 3, 3));
+  Check(find(f, 3, 5));
+  Equals(error_code(find(f, 3, 1)), 1U);
+  // the connection goes on
+  Equals(data(f, 7), "hello");
+}
+
+GFTEST(http 1.1 unaffected) {
+  std::istringstream in("GET / HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n");
+  std::stringstream output;
+
+  namespace io = boost::iostreams;
+
+  typedef io::combination<std::istringstream, std::stringstream> combination_type;
+  combination_type dev = io::combine(boost::ref(in), boost::ref(output));
+  std::auto_ptr<std::streambuf> p(new io::stream_buffer<combination_type>(dev));
+
+  rest::http_connection(group_fixture.hosts, group_fixture.addr,
+                        group_fixture.servername, new rest::null_logger)
+    .serve(p);
+  Check(output.str().find("HTTP/1.1 200") == 0);
+}
+
+}
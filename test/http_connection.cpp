@@ -3,8 +3,28 @@
 #include <rest/host.hpp>
 #include <rest/headers.hpp>
 #include <rest/logger.hpp>
+#include <rest/context.hpp>
+#include <rest/responder.hpp>
+#include <rest/response.hpp>
+#include <rest/input_stream.hpp>
+#include <rest/utils/socket_device.hpp>
+#include <rest/encodings/deflate.hpp>
+#include <rest/config.hpp>
+#include <rest/scheme.hpp>
 #include <boost/iostreams/combine.hpp>
+#include <boost/iostreams/stream_buffer.hpp>
 #include <sstream>
+#include <vector>
+#include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <testsoon.hpp>
 
 namespace {
@@ -14,6 +34,29 @@ namespace {
     addr.addr.ip4 = x;
     return addr;
   }
+
+  // serves `input' on a new connection to `hosts', returns the output
+  std::string serve_in_memory(
+    rest::host_container const &hosts, std::string const &input)
+  {
+    std::istringstream in(input);
+    std::stringstream output;
+
+    namespace io = boost::iostreams;
+
+    typedef io::combination<std::istringstream, std::stringstream> combination_type;
+    combination_type dev = io::combine(boost::ref(in), boost::ref(output));
+    std::auto_ptr<std::streambuf> p(new io::stream_buffer<combination_type>(dev));
+
+    rest::http_connection(hosts, ip4(0), "SERVERNAME", new rest::null_logger)
+      .serve(p);
+    return output.str();
+  }
+
+  std::string body(std::string const &response) {
+    std::string::size_type pos = response.find("\r\n\r\n");
+    return pos == std::string::npos ? "" : response.substr(pos + 4);
+  }
 }
 
 TEST_GROUP(no_hosts) {
@@ -68,3 +111,833 @@ GFTEST(bad http version) {
 }
 
 }
+
+TEST_GROUP(file_response) {
+
+struct file_responder : rest::responder<rest::GET> {
+  std::string path;
+
+  rest::response get() {
+    rest::response resp("text/plain");
+    resp.set_file(::open(path.c_str(), O_RDONLY), 10);
+    return resp;
+  }
+};
+
+struct string_responder : rest::responder<rest::GET> {
+  rest::response get() {
+    rest::response resp("application/json");
+    resp.set_data("{\"small\": true}");
+    return resp;
+  }
+};
+
+// an entity of unknown length
+struct stream_responder : rest::responder<rest::GET> {
+  rest::response get() {
+    rest::response resp("text/plain");
+    rest::input_stream data(new std::istringstream("streamed"));
+    resp.set_data(data, false);
+    return resp;
+  }
+};
+
+struct group_fixture_t {
+  std::string servername;
+  rest::network::address addr;
+  std::string content;
+  file_responder responder;
+  string_responder small;
+  stream_responder stream;
+  unsigned long writes;
+  rest::host host;
+  rest::host_container hosts;
+
+  group_fixture_t()
+  : servername("SERVERNAME"),
+    addr(ip4(0)),
+    host("")
+  {
+    for (int i = 0; i < 10000; ++i)
+      content += char('a' + i % 26);
+
+    char path[] = "/tmp/rest-file-response-XXXXXX";
+    int fd = ::mkstemp(path);
+    ::write(fd, content.data(), content.size());
+    ::close(fd);
+    responder.path = path;
+
+    host.get_context().bind("/", responder);
+    host.get_context().bind("/small", small);
+    host.get_context().bind("/stream", stream);
+    hosts.add_host(host);
+  }
+
+  ~group_fixture_t() {
+    ::unlink(responder.path.c_str());
+  }
+
+  // the same over a socket, where the file is sent with sendfile
+  std::string serve_socket(std::string const &input) {
+    int sv[2];
+    ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    ::write(sv[1], input.data(), input.size());
+    ::shutdown(sv[1], SHUT_WR);
+
+    namespace io = boost::iostreams;
+
+    rest::utils::socket_device socket(sv[0], 0, 0);
+    std::auto_ptr<std::streambuf> p(
+      new io::stream_buffer<rest::utils::socket_device>(socket));
+
+    rest::http_connection(hosts, addr, servername, new rest::null_logger)
+      .serve(p);
+    writes = socket.write_calls();
+
+    std::string output;
+    char buf[4096];
+    ssize_t n;
+    while ((n = ::read(sv[1], buf, sizeof(buf))) > 0)
+      output.append(buf, n);
+    ::close(sv[1]);
+    return output;
+  }
+
+};
+
+GFTEST(buffered) {
+  std::string out = serve_in_memory(group_fixture.hosts, 
+    "GET / HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n");
+  Check(out.find("Content-Length: 9990\r\n") != std::string::npos);
+  Equals(body(out), group_fixture.content.substr(10));
+}
+
+GFTEST(sendfile) {
+  std::string out = group_fixture.serve_socket(
+    "GET / HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n");
+  Check(out.find("Content-Length: 9990\r\n") != std::string::npos);
+  Equals(body(out), group_fixture.content.substr(10));
+}
+
+GFTEST(sendfile keep-alive) {
+  std::string request = "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+  std::string out = group_fixture.serve_socket(request + request);
+  std::string first = out.substr(0, out.find("HTTP/1.1", 1));
+  Equals(out, first + first);
+}
+
+GFTEST(sendfile range) {
+  std::string request =
+    "GET / HTTP/1.1\r\nHost: x\r\nConnection: close\r\n"
+    "Range: bytes=100-200\r\n\r\n";
+  std::string buffered = serve_in_memory(group_fixture.hosts, request);
+  std::string sent = group_fixture.serve_socket(request);
+  Check(sent.find("HTTP/1.1 206 ") == 0);
+  Equals(body(sent), body(buffered));
+}
+
+GFTEST(sendfile writes) {
+  group_fixture.serve_socket(
+    "GET / HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n");
+  Equals(group_fixture.writes, 2UL);
+}
+
+GFTEST(small response in one write) {
+  std::string out = group_fixture.serve_socket(
+    "GET /small HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n");
+  Check(out.find("HTTP/1.1 200 ") == 0);
+  Equals(body(out), "{\"small\": true}");
+  Equals(group_fixture.writes, 1UL);
+}
+
+GFTEST(small responses pipelined) {
+  std::string request = "GET /small HTTP/1.1\r\nHost: x\r\n\r\n";
+  std::string out = group_fixture.serve_socket(request + request + request);
+  Equals(group_fixture.writes, 1UL);
+}
+
+GFTEST(http 1.0 keep-alive) {
+  std::string request =
+    "GET /small HTTP/1.0\r\nHost: x\r\nConnection: keep-alive\r\n\r\n";
+  std::string out = serve_in_memory(group_fixture.hosts, request + request);
+  std::string first = out.substr(0, out.find("HTTP/1.0", 1));
+  Check(first.find("HTTP/1.0 200 ") == 0);
+  Check(first.find("Connection: keep-alive\r\n") != std::string::npos);
+  Check(out.find("HTTP/1.0 200 ", first.size()) == first.size());
+}
+
+GFTEST(http 1.0 closes by default) {
+  std::string request = "GET /small HTTP/1.0\r\nHost: x\r\n\r\n";
+  std::string out = serve_in_memory(group_fixture.hosts, request + request);
+  Equals(out.find("HTTP/1.0", 1), std::string::npos);
+  Equals(out.find("Connection:"), std::string::npos);
+}
+
+GFTEST(http 1.0 keep-alive needs a length) {
+  std::string request =
+    "GET /stream HTTP/1.0\r\nHost: x\r\nConnection: keep-alive\r\n\r\n";
+  std::string out = serve_in_memory(group_fixture.hosts, request + request);
+  Equals(out.find("HTTP/1.0", 1), std::string::npos);
+  Equals(out.find("Connection:"), std::string::npos);
+  Equals(body(out), "streamed");
+}
+
+GFTEST(100 pipelined requests in one write) {
+  std::string requests;
+  for (int i = 0; i < 100; ++i)
+    requests += "GET /small HTTP/1.1\r\nHost: x\r\n\r\n";
+  std::string out = group_fixture.serve_socket(requests);
+  Equals(group_fixture.writes, 1UL);
+
+  int responses = 0;
+  std::string::size_type pos = 0;
+  while ((pos = out.find("\r\n\r\n{\"small\": true}", pos)) != std::string::npos) {
+    ++responses;
+    ++pos;
+  }
+  Equals(responses, 100);
+}
+
+GFTEST(pipelined responses in order) {
+  std::string small = "GET /small HTTP/1.1\r\nHost: x\r\n\r\n";
+  std::string file = "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+  std::string out = group_fixture.serve_socket(small + file + small);
+  // the file flushes the first response, the last one goes out alone
+  Equals(group_fixture.writes, 3UL);
+
+  std::string::size_type first = out.find("{\"small\": true}");
+  std::string::size_type content = out.find(group_fixture.content.substr(10));
+  std::string::size_type last = out.rfind("{\"small\": true}");
+  Check(first < content);
+  Check(content < last);
+  Check(last != std::string::npos);
+}
+
+GFTEST(incomplete pipelined request flushes) {
+  // the responses must not wait for the rest of the next request
+  std::string request = "GET /small HTTP/1.1\r\nHost: x\r\n\r\n";
+  std::string out = group_fixture.serve_socket(request + request + "GET /sm");
+  Equals(group_fixture.writes, 1UL);
+  Check(out.rfind("{\"small\": true}") > out.find("{\"small\": true}"));
+}
+
+}
+
+TEST_GROUP(encoding_cache) {
+
+struct etag_responder : rest::responder<rest::GET> {
+  std::string data;
+  std::string tag;
+
+  std::string etag() const {
+    return tag;
+  }
+
+  rest::response get() {
+    return rest::response("text/plain", data);
+  }
+};
+
+struct group_fixture_t {
+  etag_responder responder;
+  rest::host host;
+  rest::host_container hosts;
+
+  group_fixture_t()
+  : host("cache")
+  {
+    if (!rest::object_registry::get().find<rest::encoding>("deflate"))
+      REST_OBJECT_ADD(rest::encodings::deflate);
+
+    host.get_context().bind("/", responder);
+    hosts.add_host(host);
+  }
+
+  std::string get() {
+    return get(hosts);
+  }
+
+  std::string get(rest::host_container const &container) {
+    std::string out = serve_in_memory(container,
+      "GET / HTTP/1.1\r\nHost: cache\r\n"
+      "Accept-Encoding: deflate\r\nConnection: close\r\n\r\n");
+    std::string::size_type pos = out.find("\r\n\r\n");
+    Check(out.find("HTTP/1.1 200 ") == 0);
+    Check(out.find("Content-Encoding: deflate\r\n") < pos);
+    return out.substr(pos + 4);
+  }
+};
+
+GFTEST(same etag) {
+  group_fixture.responder.data = std::string(2000, 'a');
+  group_fixture.responder.tag = "\"same\"";
+  std::string first = group_fixture.get();
+
+  // the cached entity is sent although the data changed
+  group_fixture.responder.data = std::string(2000, 'b');
+  Equals(group_fixture.get(), first);
+}
+
+GFTEST(different etag) {
+  group_fixture.responder.data = std::string(2000, 'a');
+  group_fixture.responder.tag = "\"different-a\"";
+  std::string first = group_fixture.get();
+
+  group_fixture.responder.data = std::string(2000, 'b');
+  group_fixture.responder.tag = "\"different-b\"";
+  Not_equals(group_fixture.get(), first);
+}
+
+GFTEST(same host name in another container) {
+  group_fixture.responder.data = std::string(2000, 'a');
+  group_fixture.responder.tag = "\"shared\"";
+  std::string first = group_fixture.get();
+
+  etag_responder other_responder;
+  other_responder.data = std::string(2000, 'b');
+  other_responder.tag = "\"shared\"";
+  rest::host other("cache");
+  other.get_context().bind("/", other_responder);
+  rest::host_container other_hosts;
+  other_hosts.add_host(other);
+  Not_equals(group_fixture.get(other_hosts), first);
+}
+
+GFTEST(no etag) {
+  group_fixture.responder.data = std::string(2000, 'a');
+  group_fixture.responder.tag = "";
+  std::string first = group_fixture.get();
+
+  group_fixture.responder.data = std::string(2000, 'b');
+  Not_equals(group_fixture.get(), first);
+}
+
+}
+
+TEST_GROUP(response_cache) {
+
+struct counting_responder : rest::responder<rest::GET> {
+  int calls;
+  rest::cache::flags flags;
+  std::string vary;
+
+  counting_responder() : calls(0), flags(rest::cache::NO_FLAGS) {}
+
+  time_t expires() const {
+    return get_time() + 60;
+  }
+
+  std::string etag() const {
+    return "\"counted\"";
+  }
+
+  rest::cache::flags cache() const {
+    return flags;
+  }
+
+  rest::response get() {
+    ++calls;
+    rest::response resp("text/plain", std::string("call ") + char('0' + calls));
+    if (!vary.empty())
+      resp.get_headers().set_header("Vary", vary);
+    return resp;
+  }
+};
+
+struct group_fixture_t {
+  counting_responder responder;
+  rest::host host;
+  rest::host_container hosts;
+
+  group_fixture_t()
+  : host("response-cache")
+  {
+    rest::http_connection::set_response_cache_size(1048576);
+    host.get_context().bind("/", responder);
+    hosts.add_host(host);
+  }
+
+  ~group_fixture_t() {
+    rest::http_connection::set_response_cache_size(0);
+  }
+
+  std::string serve(std::string const &uri, std::string const &headers = "") {
+    return serve_to(hosts, uri, headers);
+  }
+
+  std::string serve_to(rest::host_container const &container,
+                       std::string const &uri,
+                       std::string const &headers = "")
+  {
+    return serve_in_memory(container,
+      "GET " + uri + " HTTP/1.1\r\nHost: response-cache\r\n" + headers +
+      "Connection: close\r\n\r\n");
+  }
+
+};
+
+GFTEST(hit) {
+  std::string first = group_fixture.serve("/");
+  std::string second = group_fixture.serve("/");
+  Equals(group_fixture.responder.calls, 1);
+  Equals(body(second), "call 1");
+  Check(second.find("ETag: \"counted\"\r\n") != std::string::npos);
+  Check(second.find("Cache-Control: public, max-age=") != std::string::npos);
+}
+
+GFTEST(revalidate) {
+  group_fixture.serve("/");
+  std::string out = group_fixture.serve("/", "If-None-Match: \"counted\"\r\n");
+  Check(out.find("HTTP/1.1 304 ") == 0);
+  Equals(group_fixture.responder.calls, 1);
+}
+
+GFTEST(private) {
+  group_fixture.responder.flags = rest::cache::private_;
+  group_fixture.serve("/");
+  group_fixture.serve("/");
+  Equals(group_fixture.responder.calls, 2);
+}
+
+GFTEST(same host name in another container) {
+  counting_responder other_responder;
+  rest::host other("response-cache");
+  other.get_context().bind("/", other_responder);
+  rest::host_container other_hosts;
+  other_hosts.add_host(other);
+
+  group_fixture.serve("/");
+  other_responder.calls = 5;
+  std::string out = group_fixture.serve_to(other_hosts, "/");
+  Equals(body(out), "call 6");
+  Equals(body(group_fixture.serve("/")), "call 1");
+  Equals(group_fixture.responder.calls, 1);
+}
+
+GFTEST(vary) {
+  group_fixture.responder.vary = "X-Lang";
+  group_fixture.serve("/", "X-Lang: de\r\n");
+  group_fixture.serve("/", "X-Lang: en\r\n");
+  Equals(group_fixture.responder.calls, 2);
+  Equals(body(group_fixture.serve("/", "X-Lang: de\r\n")),
+         "call 1");
+  Equals(body(group_fixture.serve("/", "X-Lang: en\r\n")),
+         "call 2");
+  Equals(group_fixture.responder.calls, 2);
+}
+
+}
+
+TEST_GROUP(entity_keep_alive) {
+
+// reads the first `want' bytes of the entity only
+struct partial_responder : rest::responder<rest::POST> {
+  std::size_t want;
+  boost::uint64_t max_size;
+  std::vector<std::string> bodies;
+
+  partial_responder() : want(0), max_size(0) {}
+
+  bool allow_entity(std::string const &) const {
+    return true;
+  }
+
+  boost::uint64_t max_entity_size() const {
+    return max_size;
+  }
+
+  void prepare() {
+    get_keywords().declare("body", rest::ENTITY);
+  }
+
+  rest::response post() {
+    std::string body(want, '\0');
+    get_keywords().read("body").read(&body[0], want);
+    body.resize(get_keywords().read("body").gcount());
+    bodies.push_back(body);
+    return rest::response("text/plain", body);
+  }
+};
+
+struct group_fixture_t {
+  partial_responder responder;
+  rest::host host;
+  rest::host_container hosts;
+
+  group_fixture_t()
+  : host("")
+  {
+    host.get_context().bind("/", responder);
+    hosts.add_host(host);
+  }
+
+  ~group_fixture_t() {
+    rest::utils::set(rest::config::get().tree(), 65536,
+                     "general", "limits", "max_unread_entity");
+  }
+
+  static int responses(std::string const &out) {
+    int n = 0;
+    for (std::string::size_type pos = 0;
+        (pos = out.find("HTTP/1.1 ", pos)) != std::string::npos;
+        ++pos)
+      ++n;
+    return n;
+  }
+};
+
+GFTEST(unread remainder drained) {
+  group_fixture.responder.want = 3;
+  std::string post =
+    "POST / HTTP/1.1\r\nHost: x\r\nContent-Type: text/plain\r\n"
+    "Content-Length: 20000\r\n\r\n012" + std::string(19997, 'x');
+  std::string out = serve_in_memory(group_fixture.hosts, post + post);
+  Equals(group_fixture.responses(out), 2);
+  Equals(group_fixture.responder.bodies.size(), 2U);
+  Equals(group_fixture.responder.bodies[1], "012");
+  Check(out.find("Connection: close") == std::string::npos);
+}
+
+GFTEST(chunked remainder and trailer drained) {
+  group_fixture.responder.want = 2;
+  std::string post =
+    "POST / HTTP/1.1\r\nHost: x\r\nContent-Type: text/plain\r\n"
+    "Transfer-Encoding: chunked\r\n\r\n"
+    "4\r\nabcd\r\n3\r\nefg\r\n0\r\nX-Trailer: 1\r\n\r\n";
+  std::string out = serve_in_memory(group_fixture.hosts, post + post);
+  Equals(group_fixture.responses(out), 2);
+  Equals(group_fixture.responder.bodies[1], "ab");
+}
+
+GFTEST(large remainder closes) {
+  rest::utils::set(rest::config::get().tree(), 1000,
+                   "general", "limits", "max_unread_entity");
+  group_fixture.responder.want = 1;
+  // more than the stream buffers read ahead
+  std::string post =
+    "POST / HTTP/1.1\r\nHost: x\r\nContent-Type: text/plain\r\n"
+    "Content-Length: 20000\r\n\r\n" + std::string(20000, 'x');
+  std::string out = serve_in_memory(group_fixture.hosts, post + post);
+  Equals(group_fixture.responses(out), 1);
+}
+
+GFTEST(chunked entity over the limit closes) {
+  group_fixture.responder.want = 1;
+  group_fixture.responder.max_size = 5;
+  std::string post =
+    "POST / HTTP/1.1\r\nHost: x\r\nContent-Type: text/plain\r\n"
+    "Transfer-Encoding: chunked\r\n\r\n"
+    "4\r\nabcd\r\n3\r\nefg\r\n0\r\n\r\n";
+  std::string out = serve_in_memory(group_fixture.hosts, post + post);
+  Equals(group_fixture.responses(out), 1);
+}
+
+}
+
+namespace {
+  struct hello_responder : rest::responder<rest::GET> {
+    rest::response get() {
+      return rest::response("text/plain", "hello");
+    }
+  };
+}
+
+namespace {
+  // An event-driven connection on one end of a socket pair, the test is the
+  // client on the other.
+  struct event_connection {
+    std::string servername;
+    rest::http_scheme schm;
+    int sv[2];
+    rest::http_connection connection;
+
+    event_connection(rest::host_container const &hosts)
+      : servername("SERVERNAME"),
+        connection(hosts, ip4(0), servername, new rest::null_logger)
+    {
+      ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+      ::fcntl(sv[0], F_SETFL, ::fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+      namespace io = boost::iostreams;
+      rest::utils::socket_device socket(sv[0], 0, 0);
+      std::auto_ptr<std::streambuf> p(
+        new io::stream_buffer<rest::utils::socket_device>(socket));
+      connection.open(p, schm, sv[0]);
+    }
+
+    ~event_connection() {
+      ::close(sv[1]);
+    }
+
+    void send(std::string const &data) {
+      ::write(sv[1], data.data(), data.size());
+    }
+
+    // what the client can read right now
+    std::string received() {
+      std::string output;
+      char buf[65536];
+      ssize_t n;
+      while ((n = ::recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        output.append(buf, n);
+      return output;
+    }
+  };
+
+  int count(std::string const &text, std::string const &what) {
+    int n = 0;
+    for (std::string::size_type pos = 0;
+        (pos = text.find(what, pos)) != std::string::npos;
+        pos += what.size())
+      ++n;
+    return n;
+  }
+
+  struct post_responder : rest::responder<rest::POST> {
+    bool allow_entity(std::string const &) const {
+      return true;
+    }
+
+    void prepare() {
+      get_keywords().declare("body", rest::ENTITY);
+    }
+
+    rest::response post() {
+      std::istream &in = get_keywords().read("body");
+      std::string body((std::istreambuf_iterator<char>(in)),
+                       std::istreambuf_iterator<char>());
+      return rest::response("text/plain", "got " + body);
+    }
+  };
+
+  // more than a socket buffer holds
+  struct big_responder : rest::responder<rest::GET> {
+    rest::response get() {
+      return rest::response("text/plain", std::string(4 << 20, 'x'));
+    }
+  };
+}
+
+TEST_GROUP(event_driven) {
+
+struct group_fixture_t {
+  hello_responder hello;
+  post_responder post;
+  big_responder big;
+  rest::host host;
+  rest::host_container hosts;
+
+  group_fixture_t()
+  : host("")
+  {
+    host.get_context().bind("/", hello);
+    host.get_context().bind("/post", post);
+    host.get_context().bind("/big", big);
+    hosts.add_host(host);
+  }
+};
+
+GFTEST(served once the head is complete) {
+  event_connection c(group_fixture.hosts);
+  c.send("GET / HTTP/1.1\r\nHost: x\r\n\r\n"
+         "GET / HTTP/1.1\r\nHost: x\r\n\r");
+  Equals(c.connection.advance(), rest::http_connection::WANT_READ);
+  Equals(count(c.received(), "hello"), 1);
+  Check(c.connection.request_started());
+
+  // completed on the socket, split across the end of the head
+  c.send("\n");
+  Equals(c.connection.advance(), rest::http_connection::WANT_READ);
+  Equals(count(c.received(), "hello"), 1);
+  Check(!c.connection.request_started());
+}
+
+GFTEST(response not held back for a trailing line end) {
+  event_connection c(group_fixture.hosts);
+  c.send("GET / HTTP/1.1\r\nHost: x\r\n\r\n\r\n");
+  Equals(c.connection.advance(), rest::http_connection::WANT_READ);
+  Check(c.received().find("\r\n\r\nhello") != std::string::npos);
+  Check(!c.connection.request_started());
+}
+
+GFTEST(pipelined responses written together) {
+  event_connection c(group_fixture.hosts);
+  std::string input;
+  for (int i = 0; i < 10; ++i)
+    input += "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+  c.send(input + "GET / HTTP/1.1\r\nHo");
+  Equals(c.connection.advance(), rest::http_connection::WANT_READ);
+  Equals(count(c.received(), "\r\n\r\nhello"), 10);
+}
+
+GFTEST(served once the entity is complete) {
+  event_connection c(group_fixture.hosts);
+  c.send("POST /post HTTP/1.1\r\nHost: x\r\nContent-Type: text/plain\r\n"
+         "Content-Length: 5\r\nExpect: 100-continue\r\n\r\nab");
+  Equals(c.connection.advance(), rest::http_connection::WANT_READ);
+  Equals(c.received(), "HTTP/1.1 100 Continue\r\n\r\n");
+
+  c.send("cde");
+  Equals(c.connection.advance(), rest::http_connection::WANT_READ);
+  std::string out = c.received();
+  Check(out.find("HTTP/1.1 200") == 0);
+  Equals(body(out), "got abcde");
+}
+
+GFTEST(served once the chunked entity is complete) {
+  event_connection c(group_fixture.hosts);
+  c.send("POST /post HTTP/1.1\r\nHost: x\r\nContent-Type: text/plain\r\n"
+         "Transfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n2\r\nde\r\n0\r\n");
+  Equals(c.connection.advance(), rest::http_connection::WANT_READ);
+  Equals(c.received(), "");
+
+  // the trailer ends it
+  c.send("\r\n");
+  Equals(c.connection.advance(), rest::http_connection::WANT_READ);
+  Equals(body(c.received()), "got abcde");
+}
+
+GFTEST(entity beyond the buffer limit refused) {
+  event_connection c(group_fixture.hosts);
+  c.send("POST /post HTTP/1.1\r\nHost: x\r\nContent-Type: text/plain\r\n"
+         "Content-Length: 2000000\r\n\r\nabc");
+  Equals(c.connection.advance(), rest::http_connection::CLOSED);
+  Check(c.received().find("HTTP/1.1 413") == 0);
+}
+
+GFTEST(response goes on as the client takes it) {
+  event_connection c(group_fixture.hosts);
+  c.send("GET /big HTTP/1.1\r\nHost: x\r\n\r\n"
+         "GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+  std::string out;
+  int rounds = 0;
+  while (c.connection.advance() == rest::http_connection::WANT_WRITE) {
+    out += c.received();
+    ++rounds;
+  }
+  out += c.received();
+  Check(rounds > 0);
+  Equals(count(out, "HTTP/1.1 200"), 2);
+  Equals(count(out, std::string(1 << 20, 'x')), 4);
+  Equals(out.substr(out.size() - 5), "hello");
+}
+
+GFTEST(closed with the input) {
+  event_connection c(group_fixture.hosts);
+  c.send("GET / HTTP/1.1\r\nHost: x\r\n\r\nGET / HT");
+  ::shutdown(c.sv[1], SHUT_WR);
+  Equals(c.connection.advance(), rest::http_connection::CLOSED);
+  Equals(count(c.received(), "hello"), 1);
+}
+
+GFTEST(http2 preface not served) {
+  // the event engines only speak HTTP/1.1
+  event_connection c(group_fixture.hosts);
+  c.send(std::string("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n")
+         + std::string("\0\0\0\x04\0\0\0\0\0", 9));
+  Equals(c.connection.advance(), rest::http_connection::CLOSED);
+  Check(c.received().find("HTTP/1.1 505") == 0);
+}
+
+}
+
+namespace {
+  // a connected pair of TCP sockets on the loopback interface
+  void tcp_pair(int sv[2]) {
+    int listenfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(listenfd, (sockaddr *) &addr, sizeof(addr));
+    ::listen(listenfd, 1);
+    socklen_t len = sizeof(addr);
+    ::getsockname(listenfd, (sockaddr *) &addr, &len);
+    sv[1] = ::socket(AF_INET, SOCK_STREAM, 0);
+    ::connect(sv[1], (sockaddr *) &addr, sizeof(addr));
+    sv[0] = ::accept(listenfd, 0, 0);
+    ::close(listenfd);
+  }
+
+  // an entity in two parts; before giving out the second it looks whether
+  // the first reached the client. The first part is longer than the copy
+  // buffers on the way, so it gets written before the second is asked for.
+  class probing_buffer : public std::streambuf {
+  public:
+    probing_buffer(int client)
+      : client(client), part(0), arrived(false), first(16384, 'x') {}
+
+    int client;
+    int part;
+    bool arrived;
+
+  private:
+    std::string first;
+
+  protected:
+    int_type underflow() {
+      static char second[] = "the second part";
+      switch (part++) {
+      case 0:
+        setg(&first[0], &first[0], &first[0] + first.size());
+        break;
+      case 1:
+        {
+          pollfd pfd = { client, POLLIN, 0 };
+          arrived = ::poll(&pfd, 1, 100) == 1;
+        }
+        setg(second, second, second + sizeof(second) - 1);
+        break;
+      default:
+        return traits_type::eof();
+      }
+      return traits_type::to_int_type(*gptr());
+    }
+  };
+
+  struct flushing_responder : rest::responder<rest::GET> {
+    probing_buffer *probe;
+
+    rest::response get() {
+      rest::response resp("text/plain");
+      rest::compression c;
+      c.flush_size = 1;
+      resp.set_compression(c);
+      rest::input_stream data(new std::istream(probe));
+      resp.set_data(data, false);
+      return resp;
+    }
+  };
+}
+
+TEST(flushed compressed data reaches the client) {
+  if (!rest::object_registry::get().find<rest::encoding>("deflate"))
+    REST_OBJECT_ADD(rest::encodings::deflate);
+
+  int sv[2];
+  tcp_pair(sv);
+  probing_buffer probe(sv[1]);
+  flushing_responder responder;
+  responder.probe = &probe;
+  rest::host host("");
+  host.get_context().bind("/", responder);
+  rest::host_container hosts;
+  hosts.add_host(host);
+
+  std::string request =
+    "GET / HTTP/1.1\r\nHost: x\r\nAccept-Encoding: deflate\r\n"
+    "Connection: close\r\n\r\n";
+  ::write(sv[1], request.data(), request.size());
+  ::shutdown(sv[1], SHUT_WR);
+
+  namespace io = boost::iostreams;
+  rest::utils::socket_device socket(sv[0], 0, 0);
+  std::auto_ptr<std::streambuf> p(
+    new io::stream_buffer<rest::utils::socket_device>(socket));
+  rest::http_connection(hosts, ip4(0), "SERVERNAME", new rest::null_logger)
+    .serve(p);
+
+  Check(probe.part > 2);
+  Check(probe.arrived);
+  ::close(sv[1]);
+}
@@ -1,5 +1,7 @@
 // vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
 #include "rest/utils/http.hpp"
+#include "rest/utils/request_parser.hpp"
+#include "rest/headers.hpp"
 #include "rest/cookie.hpp"
 #include <sstream>
 #include <cctype>
@@ -331,6 +333,128 @@ TEST_GROUP(read_headers) {
   }
 }
 
+TEST_GROUP(request_parser) {
+  std::string const request =
+    "\r\nGET /x HTTP/1.1\r\nHost: a\r\nX: 1\r\n 2\r\nx:  3 \r\n\r\nBODY";
+
+  void check_parsed(request_parser const &p, char const *data) {
+    Equals(p.state(), request_parser::DONE);
+    Equals(p.method().str(data), "GET");
+    Equals(p.uri().str(data), "/x");
+    Equals(p.version().str(data), "HTTP/1.1");
+    Equals(p.fields().size(), 3U);
+    Equals(p.fields()[0].name.str(data), "Host");
+    Equals(field_value(data, p.fields()[0]), "a");
+    Equals(field_value(data, p.fields()[1]), "1 2");
+    Equals(field_value(data, p.fields()[2]), "3");
+    Equals(std::string(data + p.consumed()), "BODY");
+  }
+
+  TEST(complete) {
+    request_parser p;
+    Equals(p.parse(request.data(), request.size()), request_parser::HEADERS);
+    Equals(p.parse(request.data(), request.size()), request_parser::DONE);
+    check_parsed(p, request.c_str());
+  }
+
+  TEST(resume everywhere) {
+    for (std::size_t split = 0; split < request.size(); ++split) {
+      request_parser p;
+      p.parse(request.data(), split);
+      std::string moved(request); // data may move between calls
+      while (p.parse(moved.data(), moved.size()) != request_parser::DONE)
+        ;
+      check_parsed(p, moved.c_str());
+    }
+  }
+
+  TEST(incomplete) {
+    request_parser p;
+    std::string in("GET / HTTP/1.1\r\nfoo: bar\r\n");
+    p.parse(in.data(), in.size());
+    Equals(p.parse(in.data(), in.size()), request_parser::HEADERS);
+    Equals(p.fields().size(), 1U);
+  }
+
+  XTEST((values, (std::string)
+         ("GET / HTTP/1.1\n\r\n")
+         ("GET /\r\n\r\n")
+         (" / HTTP/1.1\r\n\r\n")
+         ("GET / HTTP/1.1\r\nfoo\r\n\r\n")
+         ("GET / HTTP/1.1\r\n\n")
+         ("GET / HTTP/1.1\r\n x\r\n\r\n")
+         ("GET / HTTP/1.1\r\na: b\rc\r\n\r\n")))
+  {
+    request_parser p;
+    try {
+      // the first call stops after the request line
+      p.parse(value.data(), value.size());
+      p.parse(value.data(), value.size());
+    } catch (bad_format &) {
+      return;
+    }
+    Check(!"bad format expected");
+  }
+
+  XTEST((values, (std::string)
+         ("GETGET / HTTP/1.1\r\n\r\n")
+         ("GET /xxxxx HTTP/1.1\r\n\r\n")
+         ("GET / HTTP/1.1\r\nxxxxx: 1\r\n\r\n")
+         ("GET / HTTP/1.1\r\na: 123456\r\n\r\n")
+         ("GET / HTTP/1.1\r\na: 1\r\nb: 2\r\nc: 3\r\n\r\n")
+         ("GET / HTTP/1.1\r\na: 1234567")
+         ("GET / HTTP/1.1\r\nxxxxx")
+         ("GET /xxxxxxxxxxxxxxxxxx")))
+  {
+    request_parser p(3, 5, 8, 4, 5, 2);
+    try {
+      // the first call stops after the request line
+      p.parse(value.data(), value.size());
+      p.parse(value.data(), value.size());
+    } catch (bad_format &) {
+      return;
+    }
+    Check(!"bad format expected");
+  }
+
+  struct collect {
+    std::map<std::string, std::string> &out;
+    collect(std::map<std::string, std::string> &out) : out(out) {}
+    void operator()(std::string const &name, std::string const &value) {
+      out[name] = value;
+    }
+  };
+
+  TEST(headers) {
+    std::string in("GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\na: 3\r\n\r\n");
+    request_parser p;
+    while (p.parse(in.data(), in.size()) != request_parser::DONE)
+      ;
+
+    rest::headers h;
+    h.read_headers(in.data(), p);
+    in.assign(in.size(), 'x'); // the headers keep their own copy
+
+    Equals(h.get_header("a", ""), "1, 3");
+    Equals(h.get_header("B", ""), "2");
+    Check(!h.get_header("c"));
+
+    std::string value("old");
+    Check(h.find_header("A", value));
+    Equals(value, "1, 3");
+    Check(!h.find_header("c", value));
+
+    std::map<std::string, std::string> all;
+    h.for_each_header(collect(all));
+    Equals(all.size(), 2U);
+    Equals(all["a"], "1, 3");
+
+    h.set_header("C", "4");
+    Equals(h.get_header("A", ""), "1, 3");
+    Equals(h.get_header("c", ""), "4");
+  }
+}
+
 TEST_GROUP(parse_http) {
   TEST_GROUP(parse_parametrised) {
     TEST(parse_parametrised) {
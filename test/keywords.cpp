@@ -1,5 +1,8 @@
 // vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
 #include <rest/keywords.hpp>
+#include <rest/request.hpp>
+#include <rest/headers.hpp>
+#include <stdexcept>
 #include <testsoon.hpp>
 
 using rest::keywords;
@@ -11,3 +14,115 @@ TEST(case insensitivity) {
   Nothrows(x = kw["xY"], ...);
   Equals(x, "ab");
 }
+
+TEST(slots) {
+  rest::keyword_layout layout;
+  rest::keyword_slot a = layout.add("a", rest::NORMAL);
+  rest::keyword_slot b = layout.add("B", rest::FORM_PARAMETER);
+  Equals(layout.find("b"), 1);
+  Equals(layout.find("c"), -1);
+  Throws(layout.add("A", rest::NORMAL), std::logic_error, "");
+
+  keywords kw;
+  kw.set("a", "closure");
+  kw.prepare(layout);
+  Equals(kw.get(a), "closure");
+  Check(!kw.is_set(b));
+  kw.add_uri_encoded("b=1&b=2");
+  Equals(kw.get(b), "1");
+  Equals(kw.get("b", 1), "2");
+  kw["b"] = "x";
+  Equals(kw.get(b), "x");
+
+  // storage reused for the next request
+  kw.reset();
+  Equals(kw.get_declared_type("b"), rest::NONE);
+  Check(!kw.exists("b", 1));
+  kw.prepare(layout);
+  kw.set("a", "again");
+  Equals(kw.get(a), "again");
+
+  // other keywords, slots of a different layout
+  rest::keyword_layout other;
+  other.add("c", rest::NORMAL);
+  kw.prepare(other);
+  Equals(kw.get(a), "again");
+  Equals(kw.get_declared_type("c"), rest::NORMAL);
+
+  keywords kw2;
+  kw2.declare("a", rest::COOKIE);
+  Throws(kw2.prepare(layout), std::logic_error, "");
+}
+
+TEST(slots of another request) {
+  rest::keyword_layout first;
+  first.add("foo", rest::FORM_PARAMETER);
+  first.add("bar", rest::HEADER);
+  rest::keyword_layout empty;
+  rest::keyword_layout second;
+  rest::keyword_slot foo = second.add("foo", rest::NORMAL);
+
+  keywords kw;
+  kw.prepare(first);
+  kw.add_uri_encoded("foo=1");
+  Equals(kw.get("foo"), "1");
+
+  // nothing declared by the first request is left
+  kw.reset();
+  kw.prepare(empty);
+  Equals(kw.get_declared_type("foo"), rest::NONE);
+  Equals(kw.get_declared_type("bar"), rest::NONE);
+  Check(!kw.exists("foo"));
+
+  // nor does it conflict with other declarations
+  kw.reset();
+  kw.prepare(first);
+  kw.reset();
+  kw.prepare(second);
+  Equals(kw.get_declared_type("foo"), rest::NORMAL);
+  Equals(kw.get_declared_type("bar"), rest::NONE);
+  Check(!kw.is_set(foo));
+  kw.set("foo", "2");
+  Equals(kw.get(foo), "2");
+}
+
+namespace {
+  rest::network::address no_address() {
+    rest::network::address addr;
+    addr.type = rest::network::ip4;
+    addr.addr.ip4 = 0;
+    return addr;
+  }
+}
+
+TEST(request data) {
+  rest::request req(no_address());
+  req.get_headers().set_header("X-Test", "header");
+  req.get_headers().set_header("Cookie", "sid=1; Other=2; sid=3");
+
+  rest::keyword_layout layout;
+  rest::keyword_slot test = layout.add("x-test", rest::HEADER);
+  rest::keyword_slot sid = layout.add("sid", rest::COOKIE);
+  layout.add("other", rest::COOKIE);
+  layout.add("missing", rest::HEADER);
+
+  keywords kw;
+  kw.prepare(layout);
+  kw.declare("Accept", rest::HEADER);
+  kw.set_request_data(req);
+  Equals(kw.get(test), "header");
+  Equals(kw.get(sid), "3");
+  Equals(kw.get("OTHER"), "2");
+  Check(!kw.is_set("missing"));
+  Check(!kw.is_set("accept"));
+
+  // values taken from the request are kept when merged
+  keywords copy;
+  copy.merge(kw);
+  Equals(copy.get("x-test"), "header");
+  Equals(copy.get_declared_type("missing"), rest::NONE);
+
+  kw.reset();
+  kw.prepare(layout);
+  Check(!kw.is_set(test));
+}
@@ -0,0 +1,69 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/lru_cache.hpp"
+#include <string>
+#include <testsoon.hpp>
+
+typedef rest::utils::lru_cache<std::string, int> cache_t;
+
+TEST_GROUP(lru_cache) {
+
+TEST(find) {
+  cache_t cache(10);
+  Equals(cache.find("a"), (int const *) 0);
+  Check(cache.insert("a", 1, 1));
+  Check(cache.find("a"));
+  Equals(*cache.find("a"), 1);
+  Equals(cache.size(), 1U);
+  Equals(cache.cost(), 1U);
+}
+
+TEST(replace) {
+  cache_t cache(10);
+  cache.insert("a", 1, 4);
+  cache.insert("a", 2, 3);
+  Equals(*cache.find("a"), 2);
+  Equals(cache.size(), 1U);
+  Equals(cache.cost(), 3U);
+}
+
+TEST(evict least recently used) {
+  cache_t cache(10);
+  cache.insert("a", 1, 4);
+  cache.insert("b", 2, 4);
+  cache.find("a");
+  cache.insert("c", 3, 4);
+  Check(cache.find("a"));
+  Equals(cache.find("b"), (int const *) 0);
+  Check(cache.find("c"));
+  Equals(cache.cost(), 8U);
+}
+
+TEST(too expensive) {
+  cache_t cache(10);
+  cache.insert("a", 1, 4);
+  Check(!cache.insert("b", 2, 11));
+  Equals(cache.find("b"), (int const *) 0);
+  Check(cache.find("a"));
+}
+
+TEST(erase) {
+  cache_t cache(10);
+  cache.insert("a", 1, 4);
+  cache.erase("a");
+  cache.erase("b");
+  Equals(cache.size(), 0U);
+  Equals(cache.cost(), 0U);
+}
+
+TEST(set budget) {
+  cache_t cache(10);
+  cache.insert("a", 1, 4);
+  cache.insert("b", 2, 4);
+  cache.set_budget(5);
+  Equals(cache.find("a"), (int const *) 0);
+  Check(cache.find("b"));
+  cache.set_budget(0);
+  Equals(cache.size(), 0U);
+}
+
+}
@@ -0,0 +1,123 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+// Lookups per second of context::find_responder with 10000 bound routes,
+// walking the bindings, compiled (see context::compile) and with the route
+// cache (context::set_route_cache_size) holding all of them:
+//   router-bench [lookups]
+#include <rest/context.hpp>
+#include <rest/responder.hpp>
+#include <rest/keywords.hpp>
+#include <boost/lexical_cast.hpp>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <new>
+#include <sys/time.h>
+
+namespace {
+  unsigned long allocations = 0;
+}
+
+void *operator new(std::size_t size) throw(std::bad_alloc) {
+  ++allocations;
+  void *p = std::malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) throw() {
+  std::free(p);
+}
+
+namespace {
+  double now() {
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+
+  struct null_responder : rest::responder<rest::GET> {
+    rest::response get() {
+      return rest::response();
+    }
+  };
+
+  std::string n(int i) {
+    return boost::lexical_cast<std::string>(i);
+  }
+
+  void run(char const *name, rest::context &root,
+           std::vector<std::string> const &paths, int lookups)
+  {
+    rest::detail::any_path path_id;
+    rest::detail::responder_base *responder;
+    rest::context *local;
+    int found = 0;
+    unsigned long const before = allocations;
+    double const start = now();
+    for (int i = 0; i < lookups; ++i) {
+      rest::keywords kw;
+      root.find_responder(paths[i % paths.size()], path_id, responder, local, kw);
+      found += responder != 0;
+    }
+    double const elapsed = now() - start;
+    std::cout << std::setw(8) << name << ": "
+              << std::fixed << std::setprecision(0)
+              << lookups / elapsed << " lookups/s, "
+              << std::setprecision(1)
+              << double(allocations - before) / lookups << " allocations each, "
+              << found << " found\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  int lookups = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  if (lookups <= 0) {
+    std::cerr << "usage: router-bench [lookups]\n";
+    return 1;
+  }
+
+  rest::context root;
+  rest::context api[10];
+  null_responder responder;
+  std::vector<std::string> paths;
+
+  // 10 nested contexts with 900 routes each, 1000 routes at the top
+  for (int c = 0; c < 10; ++c) {
+    root.bind("/api/v" + n(c) + "/...", api[c]);
+    for (int i = 0; i < 900; ++i) {
+      std::string resource = "/resource" + n(i % 300);
+      switch (i / 300) {
+      case 0:
+        api[c].bind(resource, responder);
+        paths.push_back("/api/v" + n(c) + resource);
+        break;
+      case 1:
+        api[c].bind(resource + "/{id}", responder);
+        paths.push_back("/api/v" + n(c) + resource + "/" + n(i * 7));
+        break;
+      default:
+        api[c].bind(resource + "/{id}/attr%20" + n(i % 5), responder);
+        paths.push_back("/api/v" + n(c) + resource + "/x" + n(i)
+                        + "/attr%20" + n(i % 5) + "?full=1");
+      }
+    }
+  }
+  for (int i = 0; i < 1000; ++i) {
+    root.bind("/static/s" + n(i) + "/...", responder);
+    paths.push_back("/static/s" + n(i) + "/css/site.css");
+  }
+
+  // unknown ones
+  for (int i = 0; i < 1000; i += 10)
+    paths.push_back("/api/v" + n(i % 10) + "/missing" + n(i));
+
+  run("walk", root, paths, lookups);
+  root.compile();
+  run("compiled", root, paths, lookups);
+  rest::context::set_route_cache_size(paths.size());
+  run("cached", root, paths, lookups);
+  return 0;
+}
@@ -0,0 +1,45 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/scan.hpp"
+#include <string>
+#include <testsoon.hpp>
+
+namespace scan = rest::utils::scan;
+
+TEST_GROUP(scan) {
+  // every implementation has to agree with the plain search, for all
+  // positions of the delimiter and all alignments of the buffer
+  XTEST((values, (int)(scan::SCALAR)(scan::SSE2)(scan::AVX2))) {
+    scan::use(scan::implementation(value));
+
+    std::string text(100, 'x');
+    for (std::size_t offset = 0; offset < 33; ++offset) {
+      for (std::size_t at = offset; at <= text.size(); ++at) {
+        std::string s(text);
+        if (at < s.size())
+          s[at] = '\n';
+        char const *begin = s.data() + offset;
+        char const *end = s.data() + s.size();
+        Equals(std::size_t(scan::find(begin, end, '\n') - s.data()), at);
+        Equals(std::size_t(
+            scan::find_first_of(begin, end, '\r', '\n') - s.data()), at);
+        Equals(scan::find(begin, end, 'x') - s.data(),
+               at == offset ? int(offset + 1) : int(offset));
+      }
+    }
+
+    scan::use(scan::best());
+  }
+
+  TEST(first of) {
+    std::string s("abc:def\r\n");
+    char const *end = s.data() + s.size();
+    Equals(scan::find_first_of(s.data(), end, '\r', '\n') - s.data(), 7);
+    Equals(scan::find_first_of(s.data(), end, ':', '\r') - s.data(), 3);
+    Equals(scan::find_first_of(s.data(), end, 'y', 'z'), end);
+    Equals(scan::find(s.data(), s.data(), 'a'), s.data());
+  }
+
+  TEST(best) {
+    Check(scan::active() <= scan::best());
+  }
+}
@@ -5,6 +5,11 @@
 #include <string>
 #include <sstream>
 #include <boost/iostreams/stream.hpp>
+#include <vector>
+#include <cstdlib>
+#include <stdexcept>
+#include <limits>
+#include <boost/cstdint.hpp>
 
 struct welcomer : rest::responder<rest::GET, rest::DEDUCED_PATH> {
   rest::response get() {
@@ -105,3 +110,295 @@ TEST(main) {
   Equals(path_id.type(), typeid(std::string));
   Equals(boost::any_cast<std::string>(path_id), "bar/bum=xy");
 }
+
+TEST(compiled) {
+  rest::context context;
+  welcomer welcome;
+  context.bind("/", welcome);
+  displayer display;
+  context.bind("/list", display);
+  context.bind("/%20 +/object/{id}", display);
+  rest::context search;
+  searcher search_obj;
+  search.bind("/cookie", search_obj, COOKIE);
+  search.bind("/keyword/{keyword}", search_obj, KEYWORD);
+  search.bind("/keyword/not={keyword}", search_obj, KEYWORD_NOT);
+  context.bind("/search/...", search);
+  rel r;
+  context.bind("/foo/...", r);
+  context.compile();
+
+  rest::keywords kw;
+  rest::detail::any_path path_id;
+  rest::detail::responder_base *responder;
+  rest::context *local;
+  context.find_responder(
+      "/ %20%2B/object/1%37?xyz=b+la",
+      path_id, responder, local, kw);
+  Equals(responder, &display.get_interface());
+  Equals(local, &context);
+  Equals(kw["id"], "17");
+  Equals(boost::any_cast<std::string>(path_id), "object");
+
+  context.find_responder("/foo/bar/bum=xy", path_id, responder, local, kw);
+  Equals(boost::any_cast<std::string>(path_id), "bar/bum=xy");
+
+  context.find_responder("/search/keyword/not=x", path_id, responder, local, kw);
+  Equals(responder, &search_obj.get_interface());
+  Equals(local, &search);
+  Equals(boost::any_cast<mode>(path_id), KEYWORD_NOT);
+  Equals(kw["keyword"], "x");
+
+  context.find_responder("/search/nothing", path_id, responder, local, kw);
+  Equals(responder, (void*)0);
+  Equals(local, &search);
+
+  context.find_responder("/list/more", path_id, responder, local, kw);
+  Equals(responder, (void*)0);
+  Equals(local, &context);
+
+  // a later bind is seen right away
+  rel later;
+  context.bind("/list/more", later);
+  context.find_responder("/list/more", path_id, responder, local, kw);
+  Equals(responder, &later.get_interface());
+
+  // as are those of nested contexts, after binds anywhere else
+  rest::context unrelated;
+  unrelated.bind("/", welcome);
+  search.bind("/late", later);
+  context.find_responder("/search/late", path_id, responder, local, kw);
+  Equals(responder, &later.get_interface());
+  Equals(local, &search);
+}
+
+namespace {
+  struct counted : rest::responder<rest::GET, int> {
+    rest::response get() {
+      return rest::response();
+    }
+  };
+
+  std::string const SEGMENTS[] = {
+    "a", "b", "=", "", "%61", "e", "n", "%62c", "%", "a%", "%%41", "%00a", "x y"
+  };
+  std::size_t const SEGMENT_COUNT = sizeof(SEGMENTS) / sizeof(SEGMENTS[0]);
+
+  std::string describe(
+      rest::context &context, std::string const &path,
+      rest::detail::responder_base *&responder)
+  {
+    rest::keywords kw;
+    rest::detail::any_path path_id;
+    rest::context *local;
+    context.find_responder(path, path_id, responder, local, kw);
+    std::ostringstream out;
+    out << responder << ' ' << local << ' ';
+    if (path_id.type() == typeid(std::string))
+      out << '"' << boost::any_cast<std::string>(path_id) << '"';
+    else if (path_id.type() == typeid(int))
+      out << boost::any_cast<int>(path_id);
+    char const *names[] = { "c1", "c2", "c3" };
+    for (int i = 0; i < 3; ++i)
+      if (kw.get_declared_type(names[i]) != rest::NONE && kw.is_set(names[i]))
+        out << ' ' << names[i] << '=' << kw.get(names[i]);
+    return out.str();
+  }
+}
+
+TEST(compiled matches the bindings) {
+  std::srand(4711);
+  rest::context root;
+  rest::context nested[3];
+  rest::context *contexts[] = { &root, &nested[0], &nested[1], &nested[2] };
+  rel plain[40];
+  counted ellipsis[10];
+  char const *closures[] = { "{c1}", "{c2}", "{c3}" };
+
+  for (int i = 0; i < 60; ++i) {
+    rest::context &c = *contexts[std::rand() % 4];
+    std::string path;
+    int n = std::rand() % 4;
+    for (int k = 0; k < n; ++k) {
+      path += std::rand() % 2 ? "/" : "=";
+      if (std::rand() % 5 == 0)
+        path += closures[std::rand() % 3];
+      else
+        path += SEGMENTS[std::rand() % 4 == 0 ? 4 : std::rand() % 3];
+    }
+    if (path.find("==") != std::string::npos || (path.size() && path[0] == '='))
+      continue;
+    // ellipses end in segments of their own: a responder bound to a node
+    // with an ellipsis and without a path to pass would see the end of the
+    // tokens dereferenced when walking the bindings
+    try {
+      switch (std::rand() % 4) {
+      case 0:
+        c.bind(path + "/e/...", ellipsis[i % 10], i);
+        break;
+      case 1:
+        if (&c == &root)
+          c.bind(path + "/n/...", nested[std::rand() % 3]);
+        break;
+      default:
+        c.bind(path.empty() ? "/" : path, plain[i % 40]);
+      }
+    } catch (std::logic_error &) {
+    }
+  }
+
+  std::vector<std::string> paths;
+  for (int i = 0; i < 3000; ++i) {
+    std::string path;
+    int n = std::rand() % 6;
+    for (int k = 0; k < n; ++k) {
+      path += std::rand() % 4 ? "/" : "=";
+      path += SEGMENTS[std::rand() % SEGMENT_COUNT];
+    }
+    if (std::rand() % 5 == 0)
+      path += "/";
+    if (std::rand() % 5 == 0)
+      path += "?q=1";
+    paths.push_back(path);
+  }
+
+  std::vector<std::string> walked;
+  int found = 0;
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    rest::detail::responder_base *responder;
+    walked.push_back(describe(root, paths[i], responder));
+    found += responder != 0;
+  }
+  Check(found > 100);
+
+  root.compile();
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    rest::detail::responder_base *responder;
+    Equals(describe(root, paths[i], responder), walked[i]);
+  }
+}
+
+TEST(route cache) {
+  rest::context context;
+  context.declare_keyword("xyz", rest::FORM_PARAMETER);
+  displayer display;
+  context.bind("/object/{c1}", display);
+  rest::context search;
+  searcher search_obj;
+  search.bind("/keyword/{c2}", search_obj, KEYWORD);
+  context.bind("/search/...", search);
+
+  char const *paths[] = {
+    "/object/17?xyz=b+la", "/search/keyword/x%20y", "/nothing"
+  };
+  std::vector<std::string> walked;
+  for (int i = 0; i < 3; ++i) {
+    rest::detail::responder_base *responder;
+    walked.push_back(describe(context, paths[i], responder));
+  }
+
+  rest::context::set_route_cache_size(2);
+  rest::context::route_cache_statistics before =
+    rest::context::route_cache_stats();
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < 3; ++i) {
+      rest::detail::responder_base *responder;
+      Equals(describe(context, paths[i], responder), walked[i]);
+    }
+  }
+  rest::context::route_cache_statistics after =
+    rest::context::route_cache_stats();
+  Equals(after.hits - before.hits, 2ul);
+  Equals(after.misses - before.misses, 4ul);
+  Equals(after.size, 2u);
+
+  rest::keywords kw;
+  rest::detail::any_path path_id;
+  rest::detail::responder_base *responder;
+  rest::context *local;
+  context.find_responder("/object/17?xyz=b+la", path_id, responder, local, kw);
+  Equals(kw["xyz"], "b la");
+  Equals(kw["c1"], "17");
+
+  // binding empties the cache
+  rel r;
+  context.bind("/nothing", r);
+  context.find_responder("/nothing", path_id, responder, local, kw);
+  Equals(responder, &r.get_interface());
+  Equals(rest::context::route_cache_stats().size, 1u);
+
+  rest::context::set_route_cache_size(0);
+}
+
+TEST(typed closures) {
+  rest::context context;
+  displayer display;
+  context.bind("/item/{id:uint64}", display);
+  context.bind("/item/{id:uint64}/delta/{d:int64}", display);
+  rel r;
+  context.bind("/tag/{slug:[a-z0-9-]+}", r);
+  context.bind("/not/{x:[^-]*}/end", r);
+
+  Equals(context.get_keyword_type("id"), rest::NONE);
+
+  for (int compiled = 0; compiled < 2; ++compiled) {
+    if (compiled)
+      context.compile();
+
+    rest::keywords kw;
+    rest::detail::any_path path_id;
+    rest::detail::responder_base *responder;
+    rest::context *local;
+
+    context.find_responder(
+        "/item/0018446744073709551615", path_id, responder, local, kw);
+    Equals(responder, &display.get_interface());
+    Equals(kw["id"], "0018446744073709551615");
+    Not_equals(kw.get_value<boost::uint64_t>("id"), (void*)0);
+    Equals(*kw.get_value<boost::uint64_t>("id"),
+           std::numeric_limits<boost::uint64_t>::max());
+    Equals(kw.get_value<int>("id"), (void*)0);
+
+    char const *misses[] = {
+      "/item/18446744073709551616", "/item/-1", "/item/1x", "/item/",
+      "/item/1/delta/9223372036854775808", "/item/1/delta/--1",
+      "/tag/Big", "/tag/", "/tag/a%20b", "/not/a-b/end"
+    };
+    for (std::size_t i = 0; i < sizeof(misses) / sizeof(misses[0]); ++i) {
+      rest::keywords kw;
+      context.find_responder(misses[i], path_id, responder, local, kw);
+      Equals(responder, (void*)0);
+    }
+
+    rest::keywords kw2;
+    context.find_responder(
+        "/item/%31/delta/-9223372036854775808", path_id, responder, local, kw2);
+    Equals(responder, &display.get_interface());
+    Equals(*kw2.get_value<boost::uint64_t>("id"), 1u);
+    Equals(*kw2.get_value<boost::int64_t>("d"),
+           std::numeric_limits<boost::int64_t>::min());
+    kw2.set("d", "text");
+    Equals(kw2.get_value("d"), (void*)0);
+
+    rest::keywords kw3;
+    context.find_responder("/tag/a-b0", path_id, responder, local, kw3);
+    Equals(responder, &r.get_interface());
+    Equals(kw3["slug"], "a-b0");
+    Equals(kw3.get_value("slug"), (void*)0);
+
+    rest::keywords kw4;
+    context.find_responder("/not//end", path_id, responder, local, kw4);
+    Equals(responder, &r.get_interface());
+  }
+
+  try {
+    context.bind("/item/{id}/other", display);
+    Check(!"closure type changed");
+  } catch (std::logic_error &) {
+  }
+  try {
+    context.bind("/x/{id:int32}", display);
+    Check(!"invalid closure type");
+  } catch (std::logic_error &) {
+  }
+}
@@ -0,0 +1,178 @@
+// vim:ts=2:sw=2:expandtab:autoindent:filetype=cpp:
+#include "rest/utils/timer_wheel.hpp"
+#include <boost/bind.hpp>
+#include <vector>
+#include <cstdlib>
+#include <testsoon.hpp>
+
+using rest::utils::timer_wheel;
+
+namespace {
+  void record(std::vector<int> &fired, int n) {
+    fired.push_back(n);
+  }
+}
+
+TEST_GROUP(timer_wheel) {
+
+TEST(fires at deadline) {
+  std::vector<int> fired;
+  timer_wheel wheel(1000);
+  wheel.add(1010, boost::bind(&record, boost::ref(fired), 1));
+  Equals(wheel.size(), 1U);
+  Equals(wheel.advance(1009), 0U);
+  Check(fired.empty());
+  Equals(wheel.advance(1010), 1U);
+  Equals(fired.size(), 1U);
+  Equals(wheel.size(), 0U);
+  Equals(wheel.advance(2000), 0U);
+}
+
+TEST(order) {
+  std::vector<int> fired;
+  timer_wheel wheel(0);
+  wheel.add(300, boost::bind(&record, boost::ref(fired), 3));
+  wheel.add(5, boost::bind(&record, boost::ref(fired), 1));
+  wheel.add(70, boost::bind(&record, boost::ref(fired), 2));
+  wheel.add(100000, boost::bind(&record, boost::ref(fired), 4));
+  wheel.advance(200000);
+  Equals(fired.size(), 4U);
+  Equals(fired[0], 1);
+  Equals(fired[1], 2);
+  Equals(fired[2], 3);
+  Equals(fired[3], 4);
+}
+
+TEST(cascade) {
+  std::vector<int> fired;
+  timer_wheel wheel(0);
+  // beyond the first and second level
+  wheel.add(5000, boost::bind(&record, boost::ref(fired), 1));
+  wheel.advance(4999);
+  Check(fired.empty());
+  wheel.advance(5000);
+  Equals(fired.size(), 1U);
+}
+
+TEST(beyond the wheel) {
+  std::vector<int> fired;
+  timer_wheel wheel(0);
+  timer_wheel::time_type const far = timer_wheel::time_type(1) << 26;
+  wheel.add(far, boost::bind(&record, boost::ref(fired), 1));
+  for (timer_wheel::time_type t = 0; t < far; t += far / 16)
+    wheel.advance(t);
+  Check(fired.empty());
+  wheel.advance(far);
+  Equals(fired.size(), 1U);
+}
+
+TEST(cancel) {
+  std::vector<int> fired;
+  timer_wheel wheel(0);
+  timer_wheel::timer_id a = wheel.add(10, boost::bind(&record, boost::ref(fired), 1));
+  wheel.add(10, boost::bind(&record, boost::ref(fired), 2));
+  Check(wheel.cancel(a));
+  Check(!wheel.cancel(a));
+  wheel.advance(10);
+  Equals(fired.size(), 1U);
+  Equals(fired[0], 2);
+}
+
+TEST(reschedule) {
+  std::vector<int> fired;
+  timer_wheel wheel(0);
+  timer_wheel::timer_id a = wheel.add(10, boost::bind(&record, boost::ref(fired), 1));
+  Check(wheel.reschedule(a, 1000));
+  wheel.advance(999);
+  Check(fired.empty());
+  wheel.advance(1000);
+  Equals(fired.size(), 1U);
+  Check(!wheel.reschedule(a, 2000));
+}
+
+TEST(resolution) {
+  std::vector<int> fired;
+  timer_wheel wheel(0, 10);
+  wheel.add(15, boost::bind(&record, boost::ref(fired), 1));
+  // rounded up, never early
+  wheel.advance(19);
+  Check(fired.empty());
+  wheel.advance(20);
+  Equals(fired.size(), 1U);
+}
+
+TEST(next expiry) {
+  timer_wheel wheel(0);
+  Equals(wheel.next_expiry(), timer_wheel::NEVER);
+  wheel.add(20, boost::function<void ()>(&std::abort));
+  Equals(wheel.next_expiry(), 20U);
+  timer_wheel::timer_id far = wheel.add(100000, boost::function<void ()>(&std::abort));
+  Equals(wheel.next_expiry(), 20U);
+  wheel.cancel(far);
+  wheel.add(5000, boost::function<void ()>(&std::abort));
+  Check(wheel.next_expiry() <= 20U);
+}
+
+TEST(next expiry of far timer) {
+  std::vector<int> fired;
+  timer_wheel wheel(0);
+  wheel.add(100000, boost::bind(&record, boost::ref(fired), 1));
+  // following next_expiry() reaches the deadline in a few steps, never late
+  int steps = 0;
+  while (fired.empty()) {
+    timer_wheel::time_type t = wheel.next_expiry();
+    Check(t <= 100000U);
+    wheel.advance(t);
+    ++steps;
+  }
+  Check(steps < 10);
+}
+
+namespace {
+  void cancel_other(timer_wheel &wheel, timer_wheel::timer_id &id) {
+    wheel.cancel(id);
+  }
+
+  void add_again(timer_wheel &wheel, std::vector<int> &fired) {
+    fired.push_back(0);
+    wheel.add(0, boost::bind(&record, boost::ref(fired), 1));
+  }
+}
+
+TEST(callback cancels expiring timer) {
+  std::vector<int> fired;
+  timer_wheel wheel(0);
+  timer_wheel::timer_id other = 0;
+  wheel.add(10, boost::bind(&cancel_other, boost::ref(wheel), boost::ref(other)));
+  other = wheel.add(10, boost::bind(&record, boost::ref(fired), 1));
+  wheel.advance(10);
+  Check(fired.empty());
+  Equals(wheel.size(), 0U);
+}
+
+TEST(callback adds due timer) {
+  std::vector<int> fired;
+  timer_wheel wheel(0);
+  wheel.add(10, boost::bind(&add_again, boost::ref(wheel), boost::ref(fired)));
+  wheel.advance(10);
+  Equals(fired.size(), 1U);
+  wheel.advance(11);
+  Equals(fired.size(), 2U);
+}
+
+TEST(many) {
+  std::vector<int> fired;
+  timer_wheel wheel(0);
+  std::vector<timer_wheel::timer_id> ids;
+  for (int i = 0; i < 10000; ++i)
+    ids.push_back(wheel.add(i * 7 % 30000, boost::bind(&record, boost::ref(fired), i)));
+  for (int i = 0; i < 10000; i += 2)
+    wheel.cancel(ids[i]);
+  Equals(wheel.size(), 5000U);
+  wheel.advance(30000);
+  Equals(fired.size(), 5000U);
+  for (std::size_t i = 1; i < fired.size(); ++i)
+    Check(fired[i - 1] * 7 % 30000 <= fired[i] * 7 % 30000);
+}
+
+}